@@ -0,0 +1,93 @@
+
+#include <stdlib.h>
+#include <string.h>
+#include "Clock.h"
+#include "Bench.h"
+
+static int CompareDoubles(const void * a, const void * b)
+{
+	double da = *(const double *)a;
+	double db = *(const double *)b;
+	return da < db? -1 : da > db? 1 : 0;
+}
+
+Bench::Bench(double target_ms, int repetitions)
+{
+	_results = NULL;
+	_count = 0;
+	_max = 0;
+	_target_ms = target_ms;
+	_repetitions = repetitions > 0? repetitions : 1;
+	_filter = NULL;
+}
+
+Bench::~Bench()
+{
+	free(_results);
+}
+
+void Bench::Run(const char * name, Function function, void * context)
+{
+	if (_filter && !strstr(name, _filter))
+	{
+		return;
+	}
+
+	// double up until one run takes a tenth of the target, then scale to it
+	long long iterations = 1;
+	long long ns;
+	for (;;)
+	{
+		long long start = GetTimeNs();
+		function(context, iterations);
+		ns = GetTimeNs() - start;
+		if (ns * 10 >= _target_ms * 1000000.0 || iterations >= (1LL << 40))
+		{
+			break;
+		}
+		iterations *= 2;
+	}
+	double scale = _target_ms * 1000000.0 / (ns > 0? ns : 1);
+	if (scale > 1.0)
+	{
+		iterations = (long long)(iterations * scale);
+	}
+
+	double * times = new double[_repetitions];
+	for (int i = 0; i < _repetitions; i++)
+	{
+		long long start = GetTimeNs();
+		function(context, iterations);
+		times[i] = (GetTimeNs() - start) / (double)iterations;
+	}
+	qsort(times, _repetitions, sizeof(double), CompareDoubles);
+
+	if (_count == _max)
+	{
+		_max = _max? _max * 2 : 32;
+		_results = (BenchResult *)realloc(_results, _max * sizeof(BenchResult));
+	}
+	BenchResult &result = _results[_count++];
+	snprintf(result._name, sizeof(result._name), "%s", name);
+	result._iterations = iterations;
+	result._min_ns = times[0];
+	result._median_ns = times[_repetitions / 2];
+	result._max_ns = times[_repetitions - 1];
+	delete [] times;
+
+	printf("%-36s %12.2f ns  (min %.2f, max %.2f, %lld iterations)\n", name,
+			result._median_ns, result._min_ns, result._max_ns, iterations);
+}
+
+void Bench::WriteJson(FILE * file)
+{
+	fprintf(file, "{\n  \"repetitions\": %d,\n  \"target_ms\": %.0f,\n  \"benchmarks\": [\n", _repetitions, _target_ms);
+	for (int i = 0; i < _count; i++)
+	{
+		const BenchResult &result = _results[i];
+		fprintf(file, "    { \"name\": \"%s\", \"iterations\": %lld, \"median_ns\": %.3f, \"min_ns\": %.3f, \"max_ns\": %.3f }%s\n",
+				result._name, result._iterations, result._median_ns, result._min_ns, result._max_ns,
+				i + 1 < _count? "," : "");
+	}
+	fprintf(file, "  ]\n}\n");
+}
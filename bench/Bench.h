@@ -0,0 +1,52 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdio.h>
+
+// Keeps a result the optimiser would otherwise drop with the work behind it.
+template <class T> static inline void Keep(const T &value)
+{
+	asm volatile("" : : "g"(&value) : "memory");
+}
+
+struct BenchResult
+{
+	char _name[64];
+	long long _iterations;
+	// per call, over the repetitions
+	double _min_ns;
+	double _median_ns;
+	double _max_ns;
+};
+
+// Times a function over enough iterations to fill the target time, a few
+// times over, and keeps the results to print as text or JSON.
+class Bench
+{
+public:
+	typedef void (*Function)(void * context, long long iterations);
+
+protected:
+	BenchResult * _results;
+	int _count;
+	int _max;
+	double _target_ms;
+	int _repetitions;
+	const char * _filter;
+
+public:
+	Bench(double target_ms = 200.0, int repetitions = 5);
+	~Bench();
+
+	// only benchmarks with the filter in their name run
+	void SetFilter(const char * filter) { _filter = filter; }
+
+	void Run(const char * name, Function function, void * context);
+
+	int count() { return _count; }
+	const BenchResult & result(int i) { return _results[i]; }
+
+	void WriteJson(FILE * file);
+};
+
+#endif//BENCH_H
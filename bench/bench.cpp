@@ -0,0 +1,327 @@
+
+// Microbenchmarks of the matrix and window code the frame runs every time
+// round. The window sets are synthetic, no X server needed.
+//
+// x3d_bench [-filter name] [-time ms] [-json file]
+
+#include <X11/Xlib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "Matrix.h"
+#include "XWindow.h"
+#include "XDisplay.h"
+#include "Clock.h"
+#include "Bench.h"
+
+#define POINTS 1024
+#define EVENT_MASKS (ButtonPressMask | ButtonReleaseMask | PointerMotionMask)
+
+// xman stamps the events it sends with this, phasetest has the one x3d uses
+unsigned int GetTime()
+{
+	return (unsigned int)(GetTimeNs() / 1000000);
+}
+
+static float Random(float lo, float hi)
+{
+	return lo + (hi - lo) * (rand() / (float)RAND_MAX);
+}
+
+// matrices
+
+struct MatrixContext
+{
+	Matrix _a;
+	Matrix _b;
+};
+
+static void MatrixMultiply(void * context, long long iterations)
+{
+	MatrixContext * c = (MatrixContext *)context;
+	Matrix m = c->_a;
+	for (long long i = 0; i < iterations; i++)
+	{
+		// b only rotates and moves, the chain stays in range
+		m = m * c->_b;
+		Keep(m);
+	}
+}
+
+static void MatrixFastInverse(void * context, long long iterations)
+{
+	MatrixContext * c = (MatrixContext *)context;
+	Matrix m = c->_a;
+	for (long long i = 0; i < iterations; i++)
+	{
+		m.FastInverse();
+		Keep(m);
+	}
+}
+
+// the chains are reset every so often, scales and translations would run away
+#define MATRIX_OP(function, call) \
+static void function(void * context, long long iterations) \
+{ \
+	MatrixContext * c = (MatrixContext *)context; \
+	Matrix m = c->_a; \
+	for (long long i = 0; i < iterations; i++) \
+	{ \
+		if (!(i & 1023)) \
+			m = c->_a; \
+		m.call; \
+		Keep(m); \
+	} \
+}
+
+MATRIX_OP(MatrixPrependTranslate, PrependTranslate(1.f, 2.f, 3.f))
+MATRIX_OP(MatrixPrependScale, PrependScale(1.001f, 0.999f, 1.f))
+MATRIX_OP(MatrixPrependRotate, PrependRotate(3.f, 0.f, 1.f, 0.f))
+MATRIX_OP(MatrixAppendTranslate, AppendTranslate(1.f, 2.f, 3.f))
+MATRIX_OP(MatrixAppendScale, AppendScale(1.001f, 0.999f, 1.f))
+MATRIX_OP(MatrixAppendRotate, AppendRotate(3.f, 0.f, 1.f, 0.f))
+
+// windows
+
+// top levels on a wall facing +z, stacked a little apart like x3d's,
+// each with a grid of children and a grandchild in every child
+struct Scene
+{
+	XWindow * _root;
+	XWindow ** _windows;
+	int _count;
+	int _toplevels;
+	Vector3 _origins[POINTS];
+	Vector3 _dirs[POINTS];
+	Vector3 _near[POINTS];
+	int _x[POINTS];
+	int _y[POINTS];
+};
+
+static XWindow * NewWindow(Scene &scene, XWindow * parent, int x, int y, int width, int height, int hdepth)
+{
+	// ids spread over the table like server ids would be
+	Window id = 0x400000 + scene._count * 0x41;
+	XWindow * w = new XWindow(NULL, id);
+	w->Synthesize(x, y, width, height, EVENT_MASKS, hdepth);
+	if (parent)
+	{
+		parent->Add(w);
+	}
+	XDisplay::AddWindow(w);
+	scene._windows[scene._count++] = w;
+	return w;
+}
+
+static void BuildScene(Scene &scene, int toplevels, int children)
+{
+	srand(toplevels * 131 + children);
+	int grid = (int)ceilf(sqrtf((float)children));
+	scene._windows = new XWindow*[1 + toplevels * (1 + children * 2)];
+	scene._count = 0;
+	scene._toplevels = toplevels;
+	scene._root = NewWindow(scene, NULL, 0, 0, 4096, 4096, 0);
+
+	const int width = 640;
+	const int height = 480;
+	int cols = (int)ceilf(sqrtf((float)toplevels));
+	for (int i = 0; i < toplevels; i++)
+	{
+		XWindow * top = NewWindow(scene, scene._root, (i % cols) * width / 2, (i / cols) * height / 2, width, height, 1);
+		top->matrix().translation()._z = i * 0.1f;
+		int cw = width / grid;
+		int ch = height / grid;
+		for (int j = 0; j < children; j++)
+		{
+			XWindow * child = NewWindow(scene, top, (j % grid) * cw, (j / grid) * ch, cw, ch, 2);
+			NewWindow(scene, child, cw / 4, ch / 4, cw / 2, ch / 2, 3);
+		}
+	}
+
+	float extent_x = (cols + 1) * width / 2.f;
+	float extent_y = (cols + 1) * height / 2.f;
+	for (int i = 0; i < POINTS; i++)
+	{
+		Vector3 target(Random(0.f, extent_x), -Random(0.f, extent_y), 0.f);
+		scene._origins[i] = Vector3(extent_x * 0.5f, -extent_y * 0.5f, 1000.f);
+		scene._dirs[i] = target - scene._origins[i];
+		scene._dirs[i].normalize();
+		scene._near[i] = Vector3(target._x, target._y, Random(-20.f, 40.f));
+		scene._x[i] = (int)Random(0.f, width);
+		scene._y[i] = (int)Random(0.f, height);
+	}
+}
+
+static void FreeScene(Scene &scene)
+{
+	XDisplay::ForgetWindows();
+	for (int i = 0; i < scene._count; i++)
+	{
+		delete scene._windows[i];
+	}
+	delete [] scene._windows;
+}
+
+static void HitTest(void * context, long long iterations)
+{
+	Scene * scene = (Scene *)context;
+	for (long long i = 0; i < iterations; i++)
+	{
+		int p = i & (POINTS - 1);
+		XDisplay::Hit hit(scene->_origins[p], scene->_dirs[p]);
+		XDisplay::HitTest(hit, EVENT_MASKS);
+		Keep(hit._w);
+	}
+}
+
+static void GetNearest(void * context, long long iterations)
+{
+	Scene * scene = (Scene *)context;
+	for (long long i = 0; i < iterations; i++)
+	{
+		XDisplay::Nearest nearest(scene->_near[i & (POINTS - 1)], 50.f);
+		XDisplay::GetNearest(nearest, EVENT_MASKS);
+		Keep(nearest._w);
+	}
+}
+
+static void GetEventWindow(void * context, long long iterations)
+{
+	Scene * scene = (Scene *)context;
+	// the first top level, its children are what gets walked
+	XWindow * top = scene->_windows[1];
+	for (long long i = 0; i < iterations; i++)
+	{
+		int p = i & (POINTS - 1);
+		int x = scene->_x[p];
+		int y = scene->_y[p];
+		XWindow * w = top->GetEventWindow(EVENT_MASKS, x, y);
+		Keep(w);
+	}
+}
+
+// capture
+
+struct SwizzleContext
+{
+	unsigned char * _src;
+	unsigned char * _dst;
+	int _width;
+	int _height;
+};
+
+static void Swizzle(void * context, long long iterations)
+{
+	SwizzleContext * c = (SwizzleContext *)context;
+	for (long long i = 0; i < iterations; i++)
+	{
+		XWindow::Swizzle(c->_dst, c->_src, c->_width, c->_height, c->_width * 4, 4);
+		Keep(c->_dst[0]);
+	}
+}
+
+static void usage(const char * program)
+{
+	fprintf(stderr, "usage: %s [-filter name] [-time ms] [-json file]\n", program);
+}
+
+int main(int argc, char ** argv)
+{
+	const char * filter = NULL;
+	const char * json = NULL;
+	double target_ms = 200.0;
+	for (int i = 1; i < argc; i++)
+	{
+		if (i + 1 >= argc)
+		{
+			usage(argv[0]);
+			return 1;
+		}
+		if (!strcmp(argv[i], "-filter"))
+			filter = argv[++i];
+		else if (!strcmp(argv[i], "-time"))
+			target_ms = atof(argv[++i]);
+		else if (!strcmp(argv[i], "-json"))
+			json = argv[++i];
+		else
+		{
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	Bench bench(target_ms);
+	bench.SetFilter(filter);
+
+	MatrixContext matrices;
+	matrices._a = Matrix(Matrix::identity);
+	matrices._a.PrependRotate(30.f, 0.f, 1.f, 0.f);
+	matrices._a.PrependTranslate(10.f, 20.f, 30.f);
+	matrices._b = Matrix(Matrix::identity);
+	matrices._b.PrependRotate(1.f, 1.f, 0.f, 0.f);
+	matrices._b.PrependTranslate(0.1f, 0.f, 0.f);
+	bench.Run("matrix/multiply", MatrixMultiply, &matrices);
+	bench.Run("matrix/fast_inverse", MatrixFastInverse, &matrices);
+	bench.Run("matrix/prepend_translate", MatrixPrependTranslate, &matrices);
+	bench.Run("matrix/prepend_scale", MatrixPrependScale, &matrices);
+	bench.Run("matrix/prepend_rotate", MatrixPrependRotate, &matrices);
+	bench.Run("matrix/append_translate", MatrixAppendTranslate, &matrices);
+	bench.Run("matrix/append_scale", MatrixAppendScale, &matrices);
+	bench.Run("matrix/append_rotate", MatrixAppendRotate, &matrices);
+
+	static const int toplevels[] = { 4, 32, 256 };
+	for (int i = 0; i < 3; i++)
+	{
+		Scene * scene = new Scene;
+		BuildScene(*scene, toplevels[i], 16);
+		char name[64];
+		snprintf(name, sizeof(name), "xdisplay/hit_test/%d", toplevels[i]);
+		bench.Run(name, HitTest, scene);
+		snprintf(name, sizeof(name), "xdisplay/get_nearest/%d", toplevels[i]);
+		bench.Run(name, GetNearest, scene);
+		FreeScene(*scene);
+		delete scene;
+	}
+
+	static const int children[] = { 4, 64, 1024 };
+	for (int i = 0; i < 3; i++)
+	{
+		Scene * scene = new Scene;
+		BuildScene(*scene, 1, children[i]);
+		char name[64];
+		snprintf(name, sizeof(name), "xwindow/get_event_window/%d", children[i]);
+		bench.Run(name, GetEventWindow, scene);
+		FreeScene(*scene);
+		delete scene;
+	}
+
+	static const int sizes[][2] = { { 64, 64 }, { 640, 480 }, { 1920, 1080 } };
+	for (int i = 0; i < 3; i++)
+	{
+		SwizzleContext swizzle;
+		swizzle._width = sizes[i][0];
+		swizzle._height = sizes[i][1];
+		swizzle._src = (unsigned char *)malloc(swizzle._width * swizzle._height * 4);
+		swizzle._dst = (unsigned char *)malloc(swizzle._width * swizzle._height * 4);
+		memset(swizzle._src, 0x5a, swizzle._width * swizzle._height * 4);
+		char name[64];
+		snprintf(name, sizeof(name), "xwindow/swizzle/%dx%d", swizzle._width, swizzle._height);
+		bench.Run(name, Swizzle, &swizzle);
+		free(swizzle._src);
+		free(swizzle._dst);
+	}
+
+	if (json)
+	{
+		FILE * file = fopen(json, "w");
+		if (!file)
+		{
+			fprintf(stderr, "unable to write %s\n", json);
+			return 1;
+		}
+		bench.WriteJson(file);
+		fclose(file);
+	}
+	return 0;
+}
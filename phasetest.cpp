@@ -1,12 +1,15 @@
 
 // use with: Xephyr :9 +bs -wm -screen 1280x720
 // then: phasetest -display :9
+// unattended: Xvfb :9 -screen 0 1280x720x24 & phasetest -display :9 -headless -count 1000
+// under load: the same with util/loadgen -d :9 running, reported per scenario
 
 #include <x3dConfig.h>
 
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
 #include <X11/keysym.h>
+#include <X11/Xatom.h>
 #include <X11/extensions/Xdamage.h>
 
 #include <GL/glew.h>
@@ -17,8 +20,11 @@
 #include <stdlib.h>
 #include <string.h>
 #include <malloc.h>
+#include <math.h>
 
 #include <sys/time.h>
+#include <signal.h>
+#include <pthread.h>
 
 #if defined(USE_HYDRA)
 #include "Hydra.h"
@@ -27,6 +33,26 @@
 #endif
 #include "XWindow.h"
 #include "XDisplay.h"
+#include "FramePacer.h"
+#include "Occlusion.h"
+#include "Headless.h"
+#include "Reprojector.h"
+#include "ResolutionScaler.h"
+#include "MipUpdater.h"
+#include "GLBackend.h"
+#include "Recorder.h"
+#include "InputSampler.h"
+#include "PoseFilter.h"
+#include "XTrace.h"
+#include "LatencyTest.h"
+#include "XCalls.h"
+#if defined(USE_VULKAN)
+#include "VulkanBackend.h"
+#endif
+#include "Clock.h"
+#include "Profile.h"
+#include "Log.h"
+#include "Control.h"
 
 #define ESCAPE 9
 
@@ -45,15 +71,100 @@ Vector3 g_pos(0,0,30.0f);
 
 Matrix g_camera = Matrix::identity;
 
+FramePacer * g_pacer;
+int g_inflight = 2;
+
+OcclusionBuffer g_occlusion;
+
+bool g_headless = false;
+int g_count = 0;
+
+Reprojector * g_reprojector;
+bool g_reproject = false;
+float g_period = 1.f / 60.f;
+GLXContext g_reproctx;
+int g_stall_every = 0;
+int g_stall_ms = 50;
+
+MipUpdater * g_mips;
+bool g_mipmaps = true;
+
+RenderBackend * g_backend;
+bool g_vulkan = false;
+#if defined(USE_VULKAN)
+VulkanBackend * g_vk;
+#endif
+
+Recorder * g_recorder;
+const char * g_record_path;
+int g_record_width = 0;
+int g_record_height = 0;
+
+ResolutionScaler * g_scaler;
+// a fixed scale of 1 and targets of the eye size unless -scale asks for a range
+float g_scale_min = 1.f;
+float g_scale_max = 1.f;
+
+float * g_frame_times;
+int g_frame_times_count;
+int g_frame_times_max;
+
 XWindow * xw;
 Display * g_dpy;
 Window g_root;
 Window g_mouse_focus;
 Window g_kb_focus;
 int g_button_state = 0;
+// XTest moves the real pointer and types into the server's focus, so only with -inject xtest
+XDisplay::Injection g_injection = XDisplay::INJECT_SEND_EVENT;
+
+// polls the trackers on their own thread, the frame only reads what was sampled
+InputSampler * g_input;
+float g_input_rate = 250.f;
+
+// per tracked device, the hands are in cm and the head in m
+enum { POSE_LEFT, POSE_RIGHT, POSE_HEAD, POSE_DEVICES };
+const char * g_pose_names[POSE_DEVICES] = { "left", "right", "head" };
+PoseFilter g_pose_filter[POSE_DEVICES];
+// raw poses as they come in, for util/posetrace
+FILE * g_pose_trace;
+// when the poses getHands returned were sampled
+long long g_hands_ns;
+
+// X events and tracker input, recorded or replayed
+XTrace * g_xtrace;
+const char * g_xrecord_path;
+const char * g_xreplay_path;
+bool g_replay_max = false;
+
+// the last seconds of every stage, dumped on SIGUSR1 or F12
+const char * g_profile_path = "x3d_trace.json";
+float g_profile_seconds = 5.f;
+ProfileStage g_stage_events("events");
+ProfileStage g_stage_input("input");
+
+// a window of its own painted with codes read back from the eye buffer
+LatencyTest * g_latency_test;
+Matrix g_latency_modelview;
+
+// util/x3dctl talks to it, the tunables are copies applied at the frame boundary
+const char * g_control_path;
+PoseFilterParams g_pose_params[POSE_DEVICES];
+char g_pose_param_names[POSE_DEVICES][4][32];
+int g_log_level;
+int g_texbudget_mb;
+
+// the step util/loadgen is on, named in a property of the root window
+Atom g_scenario_atom;
+char g_scenario[256];
 
 #if defined(USE_HYDRA)
 Hydra * g_hydra;
+
+int PollHydra(void * context, Matrix &left, Matrix &right, float * controls)
+{
+	return getHands((Hydra *)context, left, right, controls);
+}
 #elif defined(USE_OPENVR)
 vr::IVRSystem * pVR;
 
@@ -77,6 +188,18 @@ void ConvertMatrix34(float * mat, const vr::HmdMatrix34_t &mat34)
 	mat[15] = 1;
 }
 
+// back the other way, for the pose a submitted frame was rendered with
+void ConvertToMatrix34(vr::HmdMatrix34_t &mat34, const float * mat)
+{
+	for (int row = 0; row < 3; row++)
+	{
+		for (int column = 0; column < 4; column++)
+		{
+			mat34.m[row][column] = mat[column * 4 + row];
+		}
+	}
+}
+
 void ConvertMatrix44(float * mat, const vr::HmdMatrix44_t &mat44)
 {
 	mat[0] = mat44.m[0][0];
@@ -117,17 +240,33 @@ void SetupProjection2D(int Width, int Height)
    glMatrixMode(GL_MODELVIEW);
 }
 
+// same as glFrustum(-near, near, -near * yscale, near * yscale, near, far)
+void GetProjection3D(int Width, int Height, Matrix &proj)
+{
+   if (Height==0)				// Prevent A Divide By Zero If The Window Is Too Small
+	  Height=1;
+   float near = 0.1f;
+   float far = 1000.f;
+   float yscale = Height / (float)Width;
+
+   memset(proj._m, 0, sizeof(proj._m));
+   proj._m[0] = 1.f;
+   proj._m[5] = 1.f / yscale;
+   proj._m[10] = -(far + near) / (far - near);
+   proj._m[11] = -1.f;
+   proj._m[14] = -2.f * far * near / (far - near);
+}
+
 void SetupProjection3D(int Width, int Height)
 {
    if (Height==0)				// Prevent A Divide By Zero If The Window Is Too Small
 	  Height=1;
    glViewport(0, 0, Width, Height);		// Reset The Current Viewport And Perspective Transformation
 
+   Matrix proj;
+   GetProjection3D(Width, Height, proj);
    glMatrixMode(GL_PROJECTION);
-   glLoadIdentity();
-   float near = 0.1f;
-   float yscale = Height / (float)Width;
-   glFrustum(-near, near, -near * yscale, near * yscale, near, 1000.f);
+   glLoadMatrixf(proj._m);
 
    glMatrixMode(GL_MODELVIEW);
 }
@@ -163,9 +302,18 @@ void InitGL(int Width, int Height)			// We call this right after our OpenGL wind
 	renderTargetSize_w = Width;
 	renderTargetSize_h = Height;
 #if defined(USE_OPENVR)
-	pVR->GetRecommendedRenderTargetSize( &renderTargetSize_w, &renderTargetSize_h );
+	if (pVR)
+	{
+		pVR->GetRecommendedRenderTargetSize( &renderTargetSize_w, &renderTargetSize_h );
+	}
 #endif
 
+	// allocated for the largest scale, the eyes render to a corner of it
+	g_scaler = new ResolutionScaler(g_scale_min, g_scale_max);
+	g_scaler->Initialize(renderTargetSize_w, renderTargetSize_h);
+	renderTargetSize_w = g_scaler->target_width();
+	renderTargetSize_h = g_scaler->target_height();
+
 	glGenFramebuffers(2, frameBuffer);
 	glGenTextures(2, texture);
 	glGenRenderbuffers(2, renderBuffer);
@@ -425,13 +573,43 @@ struct VRInputState {
 	bool active;
 	bool tracking;
 	Matrix relativeMat;
+	bool grabbing;
+	Matrix grabMat;
 } vrInputState;
 
 Matrix cursorMat;
 XDisplay::Nearest nearest;
 
+void UpdateCursor(const Matrix &right)
+{
+	cursorMat = Matrix::identity;
+#if defined(USE_HYDRA)
+	cursorMat.Translate(0, -12.f * 2.56f, 0);
+#endif
+	cursorMat = right * cursorMat;
+	cursorMat.Scale(0.3f, 0.3f, 0.3f);
+}
+
+int LatestHands(Matrix &left, Matrix &right, float * controls)
+{
+	PoseSample sample;
+	if (!g_input->Latest(sample))
+	{
+		return 0;
+	}
+	left = sample._left;
+	right = sample._right;
+	memcpy(controls, sample._controls, sizeof(sample._controls));
+	g_hands_ns = sample._time_ns;
+	return sample._hands;
+}
+
 bool VRInputPressed(int control)
 {
+	if (g_input)
+	{
+		return g_input->pressed(control) > 0;
+	}
 	int prev = vrInputState.controli;
 	int next = 1 - prev;
 	VRControls &controls = vrInputState.controls;
@@ -440,6 +618,10 @@ bool VRInputPressed(int control)
 
 bool VRInputReleased(int control)
 {
+	if (g_input)
+	{
+		return g_input->released(control) > 0;
+	}
 	int prev = vrInputState.controli;
 	int next = 1 - prev;
 	VRControls &controls = vrInputState.controls;
@@ -452,6 +634,10 @@ int g_hmdIndex;
 Matrix projMat[2];
 Matrix eyeMat[2];
 Matrix hmdMat = Matrix::identity;
+// the head pose of the last warp, the reprojection thread's own
+Matrix g_warp_hmd = Matrix::identity;
+float g_frameDuration;
+float g_vsyncToPhotons;
 
 const char * sInputError[17] = {
 	"None",
@@ -506,7 +692,17 @@ bool failedGetDigitalActionData = false;
 bool vrInit() {
 #if defined(USE_HYDRA)
 	g_hydra = initHydra();
-	return g_hydra? true : false;
+	if (!g_hydra)
+	{
+		return false;
+	}
+	g_input = new InputSampler(PollHydra, g_hydra, g_input_rate);
+	if (!g_input->Start())
+	{
+		delete g_input;
+		g_input = NULL;
+	}
+	return true;
 #elif defined(USE_OPENVR)
 	float m_fNearClip = 0.01f;
  	float m_fFarClip = 100.0f;
@@ -517,6 +713,10 @@ bool vrInit() {
 	ConvertMatrix34(eyeMat[1]._m, pVR->GetEyeToHeadTransform( vr::Eye_Right ));
 	g_hmdIndex = vr::k_unTrackedDeviceIndex_Hmd;
 
+	float displayFrequency = pVR->GetFloatTrackedDeviceProperty(g_hmdIndex, vr::Prop_DisplayFrequency_Float);
+	g_frameDuration = displayFrequency > 0.f? 1.f / displayFrequency : 1.f / 90.f;
+	g_vsyncToPhotons = pVR->GetFloatTrackedDeviceProperty(g_hmdIndex, vr::Prop_SecondsFromVsyncToPhotons_Float);
+
 	//vr::IVRInput * vrInput = vr::VRInput();
 	#define vrInput (vr::VRInput())
 	if (!vrInput) {
@@ -588,17 +788,82 @@ bool vrInit() {
 #endif
 }
 
+// when the frame being built is expected to reach the eye
+long long DisplayTimeNs()
+{
+	if (g_xtrace && g_xtrace->replaying())
+	{
+		// trace time, so the filters see the same input at any replay speed
+		return g_xtrace->time_ns() + (long long)(g_period * 1e9f);
+	}
+#if defined(USE_OPENVR)
+	float sinceVsync = 0.f;
+	pVR->GetTimeSinceLastVsync(&sinceVsync, NULL);
+	return GetTimeNs() + (long long)((g_frameDuration - sinceVsync + g_vsyncToPhotons) * 1e9f);
+#else
+	// nothing to tell where the scanout is, assume a period from now
+	return GetTimeNs() + (long long)(g_period * 1e9f);
+#endif
+}
+
+void FilterPose(int device, long long time_ns, long long display_ns, Matrix &pose)
+{
+	if (g_pose_trace)
+	{
+		fprintf(g_pose_trace, "%lld %s", time_ns, g_pose_names[device]);
+		for (int i = 0; i < 16; i++)
+		{
+			fprintf(g_pose_trace, " %g", pose._m[i]);
+		}
+		fprintf(g_pose_trace, "\n");
+	}
+	g_pose_filter[device].Filter(pose, time_ns, display_ns, pose);
+}
+
+void FilterHands(int hands, Matrix &left, Matrix &right)
+{
+	long long display_ns = DisplayTimeNs();
+	Matrix * poses[2] = { &left, &right };
+	for (int i = 0; i < 2; i++)
+	{
+		if (hands & (1 << i))
+		{
+			FilterPose(POSE_LEFT + i, g_hands_ns, display_ns, *poses[i]);
+		}
+		else
+		{
+			g_pose_filter[POSE_LEFT + i].Reset();
+		}
+	}
+}
+
 int getHands(Matrix &left, Matrix &right, float * controls)
 {
+	if (g_xtrace && g_xtrace->replaying())
+	{
+		return g_xtrace->Hands(left, right, controls, g_hands_ns);
+	}
 #if defined(USE_HYDRA)
+	if (g_input)
+	{
+		g_input->Update();
+		return LatestHands(left, right, controls);
+	}
+	g_hands_ns = GetTimeNs();
 	return getHands(g_hydra, left, right, controls);
 #elif defined(USE_OPENVR)
 	vr::VREvent_t e;
 	while( pVR->PollNextEvent( &e, sizeof( e ) ) ) { }
-	vr::VRCompositor()->WaitGetPoses(g_rTrackedDevicePose, vr::k_unMaxTrackedDeviceCount, NULL, 0 );
+	{
+		PROFILE("wait_poses");
+		vr::VRCompositor()->WaitGetPoses(g_rTrackedDevicePose, vr::k_unMaxTrackedDeviceCount, NULL, 0 );
+	}
+	g_hands_ns = GetTimeNs();
 	if ( g_rTrackedDevicePose[g_hmdIndex].bPoseIsValid )
 	{
 		ConvertMatrix34(hmdMat._m, g_rTrackedDevicePose[g_hmdIndex].mDeviceToAbsoluteTracking);
+		// already predicted to the next frame by the compositor, only smoothed
+		FilterPose(POSE_HEAD, g_hands_ns, g_hands_ns, hmdMat);
 		//printf("%f %f %f\n", hmdMat.translation()._x, hmdMat.translation()._y, hmdMat.translation()._z);
 	}
 	vr::VRActiveActionSet_t activeActionSet;
@@ -643,9 +908,9 @@ int getHands(Matrix &left, Matrix &right, float * controls)
 		left.AppendScale(100, 100, 100);
 	} else {
 		if (eInError != vr::VRInputError_None)
-			printf("left pose error %d %s\n", eInError, sInputError[eInError]);
+			LOG_WARN("left pose error %d %s\n", eInError, sInputError[eInError]);
 		else
-			printf("left pose error %d %d\n", poseData.bActive, poseData.pose.bPoseIsValid);
+			LOG_WARN("left pose error %d %d\n", poseData.bActive, poseData.pose.bPoseIsValid);
 	}
 
 	eInError = vr::VRInput()->GetPoseActionData( rightActionPose, vr::TrackingUniverseStanding, 0, &poseData, sizeof( poseData ), vr::k_ulInvalidInputValueHandle );
@@ -661,9 +926,9 @@ int getHands(Matrix &left, Matrix &right, float * controls)
 		//printf("%f %f %f\n", right.translation()._x, right.translation()._y, right.translation()._z);
 	} else {
 		if (eInError != vr::VRInputError_None)
-			printf("right pose error %d %s\n", eInError, sInputError[eInError]);
+			LOG_WARN("right pose error %d %s\n", eInError, sInputError[eInError]);
 		else
-			printf("right pose error %d %d\n", poseData.bActive, poseData.pose.bPoseIsValid);
+			LOG_WARN("right pose error %d %d\n", poseData.bActive, poseData.pose.bPoseIsValid);
 	}
 
 	memset(controls, 0, sizeof(float)*20);
@@ -688,12 +953,17 @@ void vrInputUpdate()
 	Matrix &relativeMat = vrInputState.relativeMat;
 
 	hands = getHands(left, right, controls[controli]);
+	if (g_xtrace)
+	{
+		g_xtrace->RecordHands(hands, left, right, controls[controli]);
+	}
+	FilterHands(hands, left, right);
 	controli = 1 - controli;
 	if (!active)
 	{
 		if (hands)
 		{
-			printf("-= hands activated =-\n");
+			LOG_INFO("-= hands activated =-\n");
 			active = true;
 		}
 	}
@@ -701,7 +971,7 @@ void vrInputUpdate()
 	{
 		if (!hands)
 		{
-			printf("-= hands deactivated =-\n");
+			LOG_INFO("-= hands deactivated =-\n");
 			active = false;
 		}
 	}
@@ -739,9 +1009,8 @@ void vrInputUpdate()
 		//printf("hand %f %f %f, %f %f %f\n", left.translation()._x, left.translation()._y, left.translation()._z, left.back()._x, left.back()._y, left.back()._z);
 	}
 
-	static Matrix grabMat;
-	static Matrix grabMat2;
-	static bool grabbing = false;
+	Matrix &grabMat = vrInputState.grabMat;
+	bool &grabbing = vrInputState.grabbing;
 	if (hands & 2)
 	{
 #if 0
@@ -852,19 +1121,129 @@ void vrInputUpdate()
 				//printf("%f %f %f\n", g_camera.translation()._x, g_camera.translation()._y, g_camera.translation()._z);
 			}
 		}
-		cursorMat = Matrix::identity;
+		UpdateCursor(right);
+
+		//printf("hand %f %f %f\n", right.translation()._x, right.translation()._y, right.translation()._z);
+	}
+
+	// this frame acted on them
+	if (g_input)
+	{
+		g_input->ClearEdges();
+	}
+}
+
+// Re-samples the poses once a frame, after EndCull's captures and right
+// before the eyes are culled again and drawn, so both eyes and that cull see
+// the same scene. Only the matrices change,
+// everything the frame decided (focus, clicks, grabs) stays.
+void vrLatePose()
+{
+	PROFILE("late_pose");
 #if defined(USE_HYDRA)
-		cursorMat.Translate(0, -12.f * 2.56f, 0);
+	Matrix left, right;
+	float controls[20];
+	int hands;
+	if (g_xtrace && g_xtrace->replaying())
+	{
+		hands = getHands(left, right, controls);
+	}
+	else if (g_input)
+	{
+		// the edges it finds are left for the next vrInputUpdate
+		g_input->Update();
+		hands = LatestHands(left, right, controls);
+	}
+	else
+	{
+		g_hands_ns = GetTimeNs();
+		hands = getHands(g_hydra, left, right, controls);
+	}
+	FilterHands(hands, left, right);
+	if ((hands & 1) && vrInputState.tracking)
+	{
+		g_camera = left * vrInputState.relativeMat;
+	}
+	if (hands & 2)
+	{
+		if (vrInputState.grabbing && nearest._frame)
+		{
+			Matrix pixMat = right;
+			pixMat.AppendTranslate(0, -12.f * 2.56f, 0);
+			pixMat.AppendScale(g_scale, g_scale, g_scale);
+			nearest._frame->matrix() = pixMat * vrInputState.grabMat;
+		}
+		UpdateCursor(right);
+	}
+#elif defined(USE_OPENVR)
+	// predict the head to when this frame's photons leave the display
+	float sinceVsync = 0.f;
+	pVR->GetTimeSinceLastVsync(&sinceVsync, NULL);
+	float predicted = g_frameDuration - sinceVsync + g_vsyncToPhotons;
+
+	vr::TrackedDevicePose_t pose[vr::k_unTrackedDeviceIndex_Hmd + 1];
+	pVR->GetDeviceToAbsoluteTrackingPose(vr::TrackingUniverseStanding, predicted, pose, vr::k_unTrackedDeviceIndex_Hmd + 1);
+	if (pose[g_hmdIndex].bPoseIsValid)
+	{
+		ConvertMatrix34(hmdMat._m, pose[g_hmdIndex].mDeviceToAbsoluteTracking);
+		long long now = GetTimeNs();
+		FilterPose(POSE_HEAD, now, now, hmdMat);
+	}
+#endif
+}
 #endif
-		cursorMat = right * cursorMat;
-		cursorMat.Scale(0.3f, 0.3f, 0.3f);
 
-		//printf("hand %f %f %f\n", right.translation()._x, right.translation()._y, right.translation()._z);
+// Occlusion pass for one eye, mirrors the transforms DrawGLScene applies to xw.
+// what DrawGLScene puts on the modelview before the windows
+void GetSceneView(const Matrix &camera, Matrix &view)
+{
+	view = camera;
+	view.FastInverse();
+#if defined(USE_HYDRA)
+	view.PrependTranslate(-g_pos._x, -g_pos._y, -g_pos._z);
+#endif
+	view.PrependScale(1.f / g_scale, 1.f / g_scale, 1.f / g_scale);
+}
+
+void CullGLScene(const Matrix &proj, const Matrix &camera, int eye)
+{
+	Matrix view;
+	GetSceneView(camera, view);
+
+	XDisplay::Cull(g_occlusion, proj * view, eye);
+}
+
+void GetEyeProjection(int eyeIndex, Matrix &proj)
+{
+#if defined(USE_OPENVR)
+	if (pVR)
+	{
+		proj = projMat[eyeIndex];
+		return;
 	}
+#else
+	// both eyes share the mirror projection
+	(void)eyeIndex;
+#endif
+	GetProjection3D(g_width, g_height, proj);
 }
+
+void GetEyeView(int eyeIndex, Matrix &view)
+{
+#if defined(USE_OPENVR)
+	if (pVR)
+	{
+		view = hmdMat * eyeMat[eyeIndex];
+		view.AppendTranslate(0, -1, 0);
+		view.AppendScale(100, 100, 100);
+		return;
+	}
 #endif
+	view = g_camera;
+	view.PrependTranslate(eyeIndex*4.0f - 2.f, 0, 0);
+}
 
-void DrawGLScene(const Matrix &camera)
+void DrawGLScene(const Matrix &camera, int eye = 0)
 {
 	glPushMatrix();
 
@@ -929,7 +1308,11 @@ void DrawGLScene(const Matrix &camera)
 
 	glScalef(1.f / g_scale, 1.f / g_scale, 1.f / g_scale);
 
-	xw->Draw();
+	if (g_latency_test && eye == 0)
+	{
+		glGetFloatv(GL_MODELVIEW_MATRIX, g_latency_modelview._m);
+	}
+	xw->Draw(eye);
 
 #if defined(USE_HYDRA) || defined(USE_OPENVR)
 	if (nearest._frame)
@@ -944,73 +1327,419 @@ void DrawGLScene(const Matrix &camera)
 #endif
 
 	glPopMatrix();
+}
 
-	glFinish();
+// Reads the middle of the latency test window back from the eye just drawn.
+// That waits for the gpu, so only with -latencytest.
+void LatencyProbe()
+{
+	XWindow * w = XDisplay::GetWindow(g_dpy, g_latency_test->w());
+	if (!w || !w->mapped())
+	{
+		return;
+	}
+	Matrix proj;
+	glGetFloatv(GL_PROJECTION_MATRIX, proj._m);
+	Matrix mvp = proj * g_latency_modelview * xw->matrix() * w->matrix();
+	Vector4 clip = mvp * Vector4(w->width() * 0.5f, -w->height() * 0.5f, 0.f, 1.f);
+	if (clip._w <= 0.f)
+	{
+		return;
+	}
+	int viewport[4];
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	int x = viewport[0] + (int)((clip._x / clip._w + 1.f) * 0.5f * viewport[2]);
+	int y = viewport[1] + (int)((clip._y / clip._w + 1.f) * 0.5f * viewport[3]);
+	if (x < viewport[0] + 1 || y < viewport[1] + 1 || x >= viewport[0] + viewport[2] - 1 || y >= viewport[1] + viewport[3] - 1)
+	{
+		return;
+	}
+	unsigned char pixels[3 * 3 * 4];
+	glReadPixels(x - 1, y - 1, 3, 3, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+	g_latency_test->Decode(pixels, 3 * 3, GetTimeNs());
 }
 
-void keyPressed(unsigned char key, int x, int y)
+// fixed camera path for unattended runs, sways in front of the desktop
+void SyntheticCamera(float frame, Matrix &camera)
 {
-	if (key == ESCAPE)
+	float t = frame * 0.02f;
+	camera = Matrix::identity;
+	camera.Translate(g_pos._x + 4.f * sinf(t), g_pos._y + 2.f * sinf(t * 0.7f), g_pos._z);
+	camera.Rotate(10.f * sinf(t), 0.f, 1.f, 0.f);
+}
+
+bool BindReprojectionContext()
+{
+	if (g_headless)
 	{
-#if defined(USE_HYDRA)
-		exitHydra();
-#elif defined (USE_OPENVR)
-		if( pVR )
-		{
-			vr::VR_Shutdown();
-			pVR = NULL;
-		}
-#endif
-		exit(0);
+		return bindHeadlessSharedContext();
 	}
+	return glXMakeCurrent(g_gldpy, g_glwin, g_reproctx);
 }
 
-static void usage(char * program_name)
+// Newest view for an eye, runs on the reprojection thread so it must not
+// touch anything the render thread writes, the Store stamp comes with it.
+bool ReprojectionView(int eye, int stored_frame, long long stored_ns, Matrix &view)
 {
-	fprintf (stderr, "usage: %s [-display host:dpy]", program_name);
+	if (g_headless)
+	{
+		// the synthetic path keeps moving while the render thread stalls
+		float frame = stored_frame + (GetTimeNs() - stored_ns) / (g_period * 1000000000.f);
+		SyntheticCamera(frame, view);
+		view.PrependTranslate(eye*4.0f - 2.f, 0, 0);
+		return true;
+	}
+#if defined(USE_OPENVR)
+	if (pVR)
+	{
+		float sinceVsync = 0.f;
+		pVR->GetTimeSinceLastVsync(&sinceVsync, NULL);
+		float predicted = g_frameDuration - sinceVsync + g_vsyncToPhotons;
+
+		// one head pose for both eyes of a warp, submitted with them
+		if (eye == 0)
+		{
+			vr::TrackedDevicePose_t pose[vr::k_unTrackedDeviceIndex_Hmd + 1];
+			pVR->GetDeviceToAbsoluteTrackingPose(vr::TrackingUniverseStanding, predicted, pose, vr::k_unTrackedDeviceIndex_Hmd + 1);
+			if (!pose[g_hmdIndex].bPoseIsValid)
+			{
+				return false;
+			}
+			ConvertMatrix34(g_warp_hmd._m, pose[g_hmdIndex].mDeviceToAbsoluteTracking);
+		}
+		view = g_warp_hmd * eyeMat[eye];
+		view.AppendTranslate(0, -1, 0);
+		view.AppendScale(100, 100, 100);
+		return true;
+	}
+#endif
+	return false;
 }
 
+#if defined(USE_OPENVR)
+// the compositor isn't thread safe, the main loop and the reprojection
+// thread take turns submitting
+pthread_mutex_t g_submit_mutex = PTHREAD_MUTEX_INITIALIZER;
 
-static const char s_tabs[] = "\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t";
-#define TABS(x) (&s_tabs[sizeof(s_tabs) - (x)])
+// with the head pose they were rendered from, the late one rather than the
+// WaitGetPoses one, so the compositor reprojects them from the right place
+bool SubmitEyes(GLuint * eyes, float u, float v, const Matrix &hmd)
+{
+	// bounds are top down, the rendered corner is at the bottom of a GL texture
+	vr::VRTextureBounds_t bounds = { 0.f, 1.f - v, u, 1.f };
+	vr::VRTextureWithPose_t leftEyeTexture;
+	leftEyeTexture.handle = (void*)(int64_t)eyes[0];
+	leftEyeTexture.eType = vr::TextureType_OpenGL;
+	leftEyeTexture.eColorSpace = vr::ColorSpace_Gamma;
+	ConvertToMatrix34(leftEyeTexture.mDeviceToAbsoluteTracking, hmd._m);
+	vr::VRTextureWithPose_t rightEyeTexture = leftEyeTexture;
+	rightEyeTexture.handle = (void*)(int64_t)eyes[1];
+	pthread_mutex_lock(&g_submit_mutex);
+	vr::EVRCompositorError left = vr::VRCompositor()->Submit(vr::Eye_Left, &leftEyeTexture, &bounds, vr::Submit_TextureWithPose );
+	vr::EVRCompositorError right = vr::VRCompositor()->Submit(vr::Eye_Right, &rightEyeTexture, &bounds, vr::Submit_TextureWithPose );
+	pthread_mutex_unlock(&g_submit_mutex);
+	return left == vr::VRCompositorError_None && right == vr::VRCompositorError_None;
+}
 
-void DumpWindow(Display * dpy, Window w, int depth)
+// on the reprojection thread, with the pose ReprojectionView warped to
+bool ReprojectionPresent(GLuint * eyes, float u, float v)
 {
-	Window *children, dummy;
-	unsigned int nchildren;
-	int i;
-	char *window_name;
-	XWindowAttributes attrib;
+	return SubmitEyes(eyes, u, v, g_warp_hmd);
+}
+#endif
 
-	if (!XFetchName(dpy, w, &window_name))
+void AddFrameTime(float ms)
+{
+	if (g_frame_times_count == g_frame_times_max)
 	{
-		window_name = NULL;
+		if (g_frame_times_max >= (1 << 20))
+		{
+			return;
+		}
+		g_frame_times_max = g_frame_times_max? g_frame_times_max * 2 : 1024;
+		g_frame_times = (float*)realloc(g_frame_times, sizeof(float) * g_frame_times_max);
 	}
+	g_frame_times[g_frame_times_count++] = ms;
+}
 
-	XGetWindowAttributes(dpy, w, &attrib);
-
-	printf("%s%08x (%d, %d) \"%s\" %08x %d %d %d %d\n", TABS(depth),
-		(unsigned int)w, attrib.c_class, attrib.map_state, window_name, (int)attrib.all_event_masks,
-		attrib.x, attrib.y, attrib.width, attrib.height);
+static int CompareFloats(const void * a, const void * b)
+{
+	float fa = *(const float *)a;
+	float fb = *(const float *)b;
+	return fa < fb? -1 : fa > fb? 1 : 0;
+}
 
-	if (!XQueryTree(dpy, w, &dummy, &dummy, &children, &nchildren))
+void ReportFrameTimes()
+{
+	int count = g_frame_times_count;
+	if (!count)
 	{
 		return;
 	}
+	float total = 0.f;
+	for (int i = 0; i < count; i++)
+	{
+		total += g_frame_times[i];
+	}
+	qsort(g_frame_times, count, sizeof(float), CompareFloats);
+
+	float seconds = total / 1000.f;
+	float mb = XDisplay::capture_bytes() / (1024.f * 1024.f);
+	printf("%d frames in %.2f s, %.1f fps, %s\n", count, seconds, count / seconds, g_backend->name());
+	printf("frame ms: min %.2f avg %.2f p50 %.2f p90 %.2f p99 %.2f max %.2f\n",
+			g_frame_times[0], total / count, g_frame_times[count / 2],
+			g_frame_times[count * 9 / 10], g_frame_times[count * 99 / 100], g_frame_times[count - 1]);
+	printf("captured %.1f MB, %.1f MB/s, %.3f ms per frame%s\n", mb, mb / seconds,
+			NsToMs(XDisplay::capture_ns()) / count, g_mips? " with mips" : "");
+	printf("textures %.1f MB resident, %.1f MB evicted, %d evictions\n",
+			XDisplay::resident_bytes() / (1024.f * 1024.f), XDisplay::evicted_bytes() / (1024.f * 1024.f),
+			XDisplay::evictions());
+	if (g_reprojector)
+	{
+		printf("reprojected %d frames, %d stores skipped\n", g_reprojector->reprojected(), g_reprojector->skipped());
+	}
+	if (g_input)
+	{
+		printf("input sampled %d times, %d overruns\n", g_input->samples(), g_input->overruns());
+	}
+	if (g_recorder)
+	{
+		printf("recorded %d of %d frames, dropped %d waiting on the gpu, %d waiting on the disk\n",
+				g_recorder->written(), g_recorder->captured(), g_recorder->dropped_gpu(), g_recorder->dropped_disk());
+	}
+#if defined(USE_VULKAN)
+	if (g_vk)
+	{
+		printf("vulkan waited %.2f ms on the timeline, %d uploads dropped\n", g_vk->wait_ms(), g_vk->dropped_uploads());
+	}
+#endif
+	XDisplay::ReportLatency(stdout);
+	if (g_latency_test)
+	{
+		g_latency_test->Report(stdout);
+	}
+	if (useRenderTarget)
+	{
+		// sorted above, the misses are the tail
+		int missed = 0;
+		while (missed < count && g_frame_times[count - 1 - missed] > g_period * 1000.f)
+		{
+			missed++;
+		}
+		printf("render scale %.2f, %d of %d frames over %.2f ms\n", g_scaler->scale(), missed, count, g_period * 1000.f);
+	}
+	g_frame_times_count = 0;
+}
 
-	for (i=0; i<nchildren; i++)
+// Called back at the frame boundary when util/x3dctl asks for stats
+void ControlReport()
+{
+	static float sorted[4096];
+	static long long last_ns;
+	static long long last_bytes;
+
+	int windows, toplevels;
+	XDisplay::CountWindows(windows, toplevels);
+	Control::Stat("frame", frame);
+	Control::Stat("windows", windows);
+	Control::Stat("toplevels", toplevels);
+	Control::Stat("texture_resident_mb", XDisplay::resident_bytes() / (1024. * 1024.));
+	Control::Stat("texture_evicted_mb", XDisplay::evicted_bytes() / (1024. * 1024.));
+	Control::Stat("texture_evictions", XDisplay::evictions());
+
+	// since the last time anyone asked, the capture totals only reset per scenario
+	long long now = GetTimeNs();
+	long long bytes = XDisplay::capture_bytes();
+	if (last_ns && bytes >= last_bytes)
 	{
-		DumpWindow(dpy, children[i], depth + 1);
+		Control::Stat("capture_mb_per_s", (bytes - last_bytes) / (1024. * 1024.) / ((now - last_ns) / 1e9));
 	}
+	last_ns = now;
+	last_bytes = bytes;
 
-	if (children)
+	// the frames ReportFrameTimes would report next
+	int count = g_frame_times_count < 4096? g_frame_times_count : 4096;
+	if (count)
 	{
-		XFree ((char *)children);
+		memcpy(sorted, g_frame_times + g_frame_times_count - count, count * sizeof(float));
+		qsort(sorted, count, sizeof(float), CompareFloats);
+		float total = 0.f;
+		for (int i = 0; i < count; i++)
+		{
+			total += sorted[i];
+		}
+		Control::Stat("fps", count * 1000.f / total);
+		Control::Stat("frame_ms_p50", sorted[count / 2]);
+		Control::Stat("frame_ms_p90", sorted[count * 9 / 10]);
+		Control::Stat("frame_ms_p99", sorted[count * 99 / 100]);
+		Control::Stat("frame_ms_max", sorted[count - 1]);
+	}
+	if (useRenderTarget)
+	{
+		Control::Stat("render_scale", g_scaler->scale());
+	}
+	if (XDisplay::reactions())
+	{
+		Control::Stat("input_to_redraw_ms", XDisplay::reaction_ms());
+	}
+	if (XDisplay::latency_count())
+	{
+		Control::Stat("damage_to_eye_ms_p50", XDisplay::latency_ms(0.5f));
+		Control::Stat("damage_to_eye_ms_p99", XDisplay::latency_ms(0.99f));
+	}
+	if (g_input)
+	{
+		Control::Stat("input_overruns", g_input->overruns());
 	}
+	XCalls::Stats(Control::Stat);
+	Control::Stat("log_dropped", Log::dropped());
 }
 
+void RegisterTunables()
+{
+	static const char * params[4] = { "min_cutoff", "beta", "rotation_beta", "lead_ms" };
+	Control::Register("ppi", &g_ppi, 10.f, 2000.f);
+	Control::Register("stall_every", &g_stall_every, 0, 100000);
+	Control::Register("stall_ms", &g_stall_ms, 0, 1000);
+	g_texbudget_mb = (int)(XDisplay::texture_budget() / (1024 * 1024));
+	Control::Register("texbudget_mb", &g_texbudget_mb, 0, 65536);
+	g_log_level = Log::level();
+	Control::Register("log_level", &g_log_level, LOG_LEVEL_ERROR, LOG_LEVEL_DEBUG);
+	for (int d = 0; d < POSE_DEVICES; d++)
+	{
+		g_pose_params[d] = g_pose_filter[d].params();
+		float * values[4] = { &g_pose_params[d]._min_cutoff, &g_pose_params[d]._beta,
+				&g_pose_params[d]._rotation_beta, &g_pose_params[d]._lead_ms };
+		for (int p = 0; p < 4; p++)
+		{
+			snprintf(g_pose_param_names[d][p], sizeof(g_pose_param_names[d][p]), "%s.%s", g_pose_names[d], params[p]);
+			Control::Register(g_pose_param_names[d][p], values[p], 0.f, p == 3? 100.f : 1000.f);
+		}
+	}
+	Control::SetReport(ControlReport);
+}
 
-Window createWindow(const char * name, int width, int height)
+// pushes what Control::Apply changed to where it takes effect
+void TunablesChanged()
+{
+	for (int d = 0; d < POSE_DEVICES; d++)
+	{
+		g_pose_filter[d].SetParams(g_pose_params[d]);
+	}
+	Log::SetLevel(g_log_level);
+	XDisplay::SetTextureBudget(g_texbudget_mb * 1024LL * 1024LL);
+}
+
+// Reports the frames of the scenario that ended, if one was running, and
+// starts counting for the next. Frames between scenarios are dropped.
+void ScenarioChanged(Display * dpy, Window root)
+{
+	if (g_scenario[0])
+	{
+		printf("scenario %s\n", g_scenario);
+		ReportFrameTimes();
+	}
+	g_frame_times_count = 0;
+	XDisplay::ResetCaptureStats();
+	g_scenario[0] = 0;
+
+	Atom type;
+	int format;
+	unsigned long count, remaining;
+	unsigned char * value = NULL;
+	XCALL(property, "XGetWindowProperty (scenario)", 1);
+	if (XGetWindowProperty(dpy, root, g_scenario_atom, 0, sizeof(g_scenario) / 4, False, XA_STRING,
+			&type, &format, &count, &remaining, &value) == Success && value)
+	{
+		property.End(32 + count);
+		if (type == XA_STRING && format == 8)
+		{
+			snprintf(g_scenario, sizeof(g_scenario), "%.*s", (int)count, (char *)value);
+		}
+		XFree(value);
+	}
+}
+
+void keyPressed(unsigned char key, int x, int y)
+{
+	if (key == ESCAPE)
+	{
+		if (g_recorder)
+		{
+			g_recorder->Stop();
+		}
+		if (g_xtrace)
+		{
+			g_xtrace->Close();
+		}
+		if (g_latency_test)
+		{
+			g_latency_test->Stop();
+		}
+		ReportFrameTimes();
+#if defined(USE_HYDRA)
+		if (g_input)
+		{
+			g_input->Stop();
+		}
+		exitHydra();
+#elif defined (USE_OPENVR)
+		if( pVR )
+		{
+			vr::VR_Shutdown();
+			pVR = NULL;
+		}
+#endif
+		exit(0);
+	}
+}
+
+static void usage(char * program_name)
+{
+	fprintf (stderr, "usage: %s [-display host:dpy] [-inflight frames] [-headless] [-size WxH] [-count frames] [-reproject] [-stall every[,ms]] [-scale min,max] [-texbudget MB] [-tilesize pixels] [-nomips] [-vulkan] [-record file.y4m] [-recordsize WxH] [-inputrate hz] [-posefilter device,min_cutoff,beta[,rotation_beta,lead_ms]] [-posetrace file] [-inject xtest|sendevent] [-xrecord file] [-xreplay file] [-replaymax] [-profiletrace file[,seconds]] [-loglevel error|warn|info|debug] [-control socket] [-latencytest]", program_name);
+}
+
+
+static const char s_tabs[] = "\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t";
+#define TABS(x) (&s_tabs[sizeof(s_tabs) - (x)])
+
+void DumpWindow(Display * dpy, Window w, int depth)
+{
+	Window *children, dummy;
+	unsigned int nchildren;
+	int i;
+	char *window_name;
+	XWindowAttributes attrib;
+
+	if (!XFetchName(dpy, w, &window_name))
+	{
+		window_name = NULL;
+	}
+
+	XGetWindowAttributes(dpy, w, &attrib);
+
+	printf("%s%08x (%d, %d) \"%s\" %08x %d %d %d %d\n", TABS(depth),
+		(unsigned int)w, attrib.c_class, attrib.map_state, window_name, (int)attrib.all_event_masks,
+		attrib.x, attrib.y, attrib.width, attrib.height);
+
+	if (!XQueryTree(dpy, w, &dummy, &dummy, &children, &nchildren))
+	{
+		return;
+	}
+
+	for (i=0; i<nchildren; i++)
+	{
+		DumpWindow(dpy, children[i], depth + 1);
+	}
+
+	if (children)
+	{
+		XFree ((char *)children);
+	}
+}
+
+
+Window createWindow(const char * name, int width, int height)
 {
    int attrib[] = { GLX_RGBA,
 			GLX_RED_SIZE, 1,
@@ -1108,12 +1837,18 @@ int main(int argc, char **argv)
 	int i;
 
 	printf("version %d.%d\n", x3d_VERSION_MAJOR, x3d_VERSION_MINOR);
+
+	// the reprojection thread binds its own context to the GLX display
+	XInitThreads();
 #if defined(USE_HYDRA)
 	printf("  using hydra module\n");
 #endif
 
 	Display * dpy;
 	const char * display_name = NULL;
+
+	// the head is in m rather than cm and lag there is felt the most
+	g_pose_filter[POSE_HEAD].SetParams(PoseFilterParams(5.f, 50.f, 0.5f));
 	for (i = 1; i < argc; i++)
 	{
 		char *arg = argv[i];
@@ -1129,6 +1864,314 @@ int main(int argc, char **argv)
 			display_name = argv[i];
 			continue;
 		}
+
+		if (!strcmp (arg, "-inflight"))
+		{
+			if (++i >= argc)
+			{
+				usage(argv[0]);
+				exit(0);
+			}
+
+			g_inflight = atoi(argv[i]);
+			continue;
+		}
+
+		// the X events and tracker input of a run, to replay it later
+		if (!strcmp (arg, "-xrecord"))
+		{
+			if (++i >= argc)
+			{
+				usage(argv[0]);
+				exit(0);
+			}
+			g_xrecord_path = argv[i];
+			continue;
+		}
+
+		// on a fresh server, Xvfb as large as the recording's, x3d stops once it's played
+		if (!strcmp (arg, "-xreplay"))
+		{
+			if (++i >= argc)
+			{
+				usage(argv[0]);
+				exit(0);
+			}
+			g_xreplay_path = argv[i];
+			continue;
+		}
+
+		// a recorded frame per frame rather than the recorded timing
+		if (!strcmp (arg, "-replaymax"))
+		{
+			g_replay_max = true;
+			continue;
+		}
+
+		// where F12 or SIGUSR1 write the last seconds of stage timings
+		if (!strcmp (arg, "-profiletrace"))
+		{
+			if (++i >= argc)
+			{
+				usage(argv[0]);
+				exit(0);
+			}
+			static char path[256];
+			if (sscanf(argv[i], "%255[^,],%f", path, &g_profile_seconds) < 1)
+			{
+				usage(argv[0]);
+				exit(0);
+			}
+			g_profile_path = path;
+			continue;
+		}
+
+		// debug needs a build with LOG_COMPILED_LEVEL raised as well
+		if (!strcmp (arg, "-loglevel"))
+		{
+			static const char * levels[] = { "error", "warn", "info", "debug" };
+			int level = -1;
+			if (++i < argc)
+			{
+				for (int l = LOG_LEVEL_ERROR; l <= LOG_LEVEL_DEBUG; l++)
+				{
+					if (!strcmp(argv[i], levels[l]))
+					{
+						level = l;
+					}
+				}
+			}
+			if (level < 0)
+			{
+				usage(argv[0]);
+				exit(0);
+			}
+			Log::SetLevel(level);
+			continue;
+		}
+
+		// stats and live tunables for util/x3dctl
+		if (!strcmp (arg, "-control"))
+		{
+			if (++i >= argc)
+			{
+				usage(argv[0]);
+				exit(0);
+			}
+			g_control_path = argv[i];
+			continue;
+		}
+
+		// paints codes into a window of its own and times them into the eye buffer
+		if (!strcmp (arg, "-latencytest"))
+		{
+			g_latency_test = new LatencyTest();
+			continue;
+		}
+
+		if (!strcmp (arg, "-headless"))
+		{
+			g_headless = true;
+			continue;
+		}
+
+		if (!strcmp (arg, "-size"))
+		{
+			if (++i >= argc || sscanf(argv[i], "%dx%d", &g_width, &g_height) != 2)
+			{
+				usage(argv[0]);
+				exit(0);
+			}
+			continue;
+		}
+
+		if (!strcmp (arg, "-count"))
+		{
+			if (++i >= argc)
+			{
+				usage(argv[0]);
+				exit(0);
+			}
+
+			g_count = atoi(argv[i]);
+			continue;
+		}
+
+		// bounds of the eye render scale, -scale 1,1 keeps it fixed
+		if (!strcmp (arg, "-scale"))
+		{
+			if (++i >= argc || sscanf(argv[i], "%f,%f", &g_scale_min, &g_scale_max) != 2)
+			{
+				usage(argv[0]);
+				exit(0);
+			}
+			continue;
+		}
+
+		// window textures kept resident, least recently seen ones go first
+		if (!strcmp (arg, "-texbudget"))
+		{
+			if (++i >= argc)
+			{
+				usage(argv[0]);
+				exit(0);
+			}
+
+			XDisplay::SetTextureBudget(atoi(argv[i]) * 1024LL * 1024LL);
+			continue;
+		}
+
+		// smaller tiles than the driver allows, mostly to exercise tiling
+		if (!strcmp (arg, "-tilesize"))
+		{
+			if (++i >= argc)
+			{
+				usage(argv[0]);
+				exit(0);
+			}
+
+			XDisplay::SetTileSize(atoi(argv[i]));
+			continue;
+		}
+
+		// plain linear window textures, to compare against
+		if (!strcmp (arg, "-nomips"))
+		{
+			g_mipmaps = false;
+			continue;
+		}
+
+		if (!strcmp (arg, "-vulkan"))
+		{
+#if defined(USE_VULKAN)
+			g_vulkan = true;
+#else
+			fprintf(stderr, "built without USE_VULKAN\n");
+			exit(1);
+#endif
+			continue;
+		}
+
+		// both eyes side by side, uncompressed, played back by anything ffmpeg based
+		if (!strcmp (arg, "-record"))
+		{
+			if (++i >= argc)
+			{
+				usage(argv[0]);
+				exit(0);
+			}
+
+			g_record_path = argv[i];
+			continue;
+		}
+
+		if (!strcmp (arg, "-recordsize"))
+		{
+			if (++i >= argc || sscanf(argv[i], "%dx%d", &g_record_width, &g_record_height) != 2)
+			{
+				usage(argv[0]);
+				exit(0);
+			}
+			continue;
+		}
+
+		// how often the input thread polls the trackers
+		if (!strcmp (arg, "-inputrate"))
+		{
+			if (++i >= argc)
+			{
+				usage(argv[0]);
+				exit(0);
+			}
+
+			g_input_rate = atof(argv[i]);
+			continue;
+		}
+
+		// device,min_cutoff,beta,rotation_beta,lead_ms with device left, right or head
+		if (!strcmp (arg, "-posefilter"))
+		{
+			char device[16];
+			PoseFilterParams params;
+			int device_index = -1;
+			if (++i < argc && sscanf(argv[i], "%15[a-z],%f,%f,%f,%f", device, &params._min_cutoff,
+					&params._beta, &params._rotation_beta, &params._lead_ms) >= 3)
+			{
+				for (int d = 0; d < POSE_DEVICES; d++)
+				{
+					if (!strcmp(device, g_pose_names[d]))
+					{
+						device_index = d;
+					}
+				}
+			}
+			if (device_index < 0)
+			{
+				usage(argv[0]);
+				exit(0);
+			}
+			g_pose_filter[device_index].SetParams(params);
+			continue;
+		}
+
+		if (!strcmp (arg, "-posetrace"))
+		{
+			if (++i >= argc || !(g_pose_trace = fopen(argv[i], "w")))
+			{
+				usage(argv[0]);
+				exit(0);
+			}
+			continue;
+		}
+
+		// xtest moves the real pointer, sendevent talks to the windows directly
+		if (!strcmp (arg, "-inject"))
+		{
+			if (++i >= argc)
+			{
+				usage(argv[0]);
+				exit(0);
+			}
+
+			if (!strcmp(argv[i], "xtest"))
+			{
+				g_injection = XDisplay::INJECT_XTEST;
+			}
+			else if (!strcmp(argv[i], "sendevent"))
+			{
+				g_injection = XDisplay::INJECT_SEND_EVENT;
+			}
+			else
+			{
+				usage(argv[0]);
+				exit(0);
+			}
+			continue;
+		}
+
+		if (!strcmp (arg, "-reproject"))
+		{
+			g_reproject = true;
+			continue;
+		}
+
+		// inject a slow frame every so often, to exercise reprojection
+		if (!strcmp (arg, "-stall"))
+		{
+			if (++i >= argc || sscanf(argv[i], "%d,%d", &g_stall_every, &g_stall_ms) < 1)
+			{
+				usage(argv[0]);
+				exit(0);
+			}
+			continue;
+		}
+	}
+
+	// no swapchain, the vulkan eyes only ever live offscreen
+	if (g_vulkan && !g_headless)
+	{
+		printf("vulkan renders offscreen, running headless\n");
+		g_headless = true;
 	}
 
 	if (!display_name)
@@ -1148,6 +2191,16 @@ int main(int argc, char **argv)
 		exit(0);
 	}
 
+	if (g_latency_test && (g_vulkan || !g_latency_test->Start(display_name, 128, 128)))
+	{
+		if (g_vulkan)
+		{
+			printf("the latency test reads back GL eye buffers, not with -vulkan\n");
+		}
+		delete g_latency_test;
+		g_latency_test = NULL;
+	}
+
 	int damageError, damageEvent;
 	if (!XDamageQueryExtension (dpy, &damageEvent, &damageError))
 	{
@@ -1155,31 +2208,94 @@ int main(int argc, char **argv)
 		return 1;
 	}
 
-	g_glwin = createWindow("test", 640, 480);
-	g_glctx = glXCreateContext( g_gldpy, g_glvisinfo, NULL, True );
-	if (!g_glctx)
+	if (!XDisplay::SetInjection(dpy, g_injection))
+	{
+		printf("no XTest, sending events to the windows instead\n");
+	}
+	printf("  injecting input through %s\n", XDisplay::injection() == XDisplay::INJECT_XTEST? "XTest" : "XSendEvent");
+
+	if (g_xreplay_path)
 	{
-		printf("Error: glXCreateContext failed\n");
-		exit(1);
+		// recreates the windows there at the start before x3d looks for them
+		g_xtrace = new XTrace();
+		if (!g_xtrace->Open(g_xreplay_path, display_name, g_replay_max))
+		{
+			return 1;
+		}
+		printf("  replaying %s%s\n", g_xreplay_path, g_replay_max? " at full speed" : "");
+	}
+
+	if (g_headless)
+	{
+		if (!initHeadless(g_width, g_height))
+		{
+			return 1;
+		}
+		// glew may complain about the missing GLX display, the GL entry points load regardless
+		glewExperimental = GL_TRUE;
+		glewInit();
 	}
-	//XMapWindow(g_gldpy, g_glwin);
-	XMapRaised(g_gldpy, g_glwin);
-	//XGrabKeyboard(g_gldpy, g_glwin, True, GrabModeAsync, GrabModeAsync, CurrentTime);
-	glXMakeCurrent(g_gldpy, g_glwin, g_glctx);
-	glewExperimental = GL_TRUE;
-	glewInit();
+	else
+	{
+		g_glwin = createWindow("test", g_width, g_height);
+		g_glctx = glXCreateContext( g_gldpy, g_glvisinfo, NULL, True );
+		if (!g_glctx)
+		{
+			printf("Error: glXCreateContext failed\n");
+			exit(1);
+		}
+		//XMapWindow(g_gldpy, g_glwin);
+		XMapRaised(g_gldpy, g_glwin);
+		//XGrabKeyboard(g_gldpy, g_glwin, True, GrabModeAsync, GrabModeAsync, CurrentTime);
+		glXMakeCurrent(g_gldpy, g_glwin, g_glctx);
+		glewExperimental = GL_TRUE;
+		glewInit();
 
 #if defined(USE_OPENVR)
-	vr::EVRInitError eError = vr::VRInitError_None;
-	pVR = vr::VR_Init( &eError, vr::VRApplication_Scene );
-	if ( eError != vr::VRInitError_None )
+		vr::EVRInitError eError = vr::VRInitError_None;
+		pVR = vr::VR_Init( &eError, vr::VRApplication_Scene );
+		if ( eError != vr::VRInitError_None )
+		{
+			fprintf(stderr, "%d %s", eError, vr::VR_GetVRInitErrorAsEnglishDescription( eError ));
+			return 1;
+		}
+#endif
+	}
+
+	InitGL(g_width, g_height);
+	// without the FBOs the loop would swap a window headless doesn't have
+	if (g_headless && !useRenderTarget)
 	{
-		fprintf(stderr, "%d %s", eError, vr::VR_GetVRInitErrorAsEnglishDescription( eError ));
+		fprintf(stderr, "%s: headless needs framebuffers to render to\n", argv[0]);
 		return 1;
 	}
-#endif
 
-	InitGL(640, 480);
+	g_pacer = new FramePacer(g_inflight);
+	g_pacer->Initialize();
+	printf("  %d frames in flight\n", g_pacer->frames());
+
+#if defined(USE_VULKAN)
+	if (g_vulkan)
+	{
+		g_vk = new VulkanBackend(g_inflight);
+		if (!g_vk->Initialize(g_scaler->width(), g_scaler->height()))
+		{
+			return 1;
+		}
+		g_backend = g_vk;
+	}
+	else
+#endif
+	{
+		if (g_mipmaps)
+		{
+			g_mips = new MipUpdater();
+			g_mips->Initialize();
+		}
+		g_backend = new GLBackend(g_pacer, g_mips);
+	}
+	XDisplay::SetBackend(g_backend);
+	printf("  %s renderer\n", g_backend->name());
 
 	//clickMouse();
 
@@ -1205,7 +2321,23 @@ int main(int argc, char **argv)
 	g_mouse_focus = None;
 	g_kb_focus = None;
 
-	XSelectInput (dpy, XRootWindow (dpy, 0), StructureNotifyMask | SubstructureNotifyMask | FocusChangeMask);
+	XSelectInput (dpy, XRootWindow (dpy, 0), StructureNotifyMask | SubstructureNotifyMask | FocusChangeMask | PropertyChangeMask);
+	g_scenario_atom = XInternAtom(dpy, "_X3D_SCENARIO", False);
+	// loadgen may be mid step already
+	ScenarioChanged(dpy, root);
+	if (g_xrecord_path && !g_xtrace)
+	{
+		g_xtrace = new XTrace();
+		if (!g_xtrace->Create(g_xrecord_path, DisplayWidth(dpy, DefaultScreen(dpy)), DisplayHeight(dpy, DefaultScreen(dpy))))
+		{
+			delete g_xtrace;
+			g_xtrace = NULL;
+		}
+		else
+		{
+			g_xtrace->RecordWindows(dpy, root);
+		}
+	}
 	xw = XDisplay::GetWindow(dpy, root);
 	xw->UpdateHierarchy();
 
@@ -1223,40 +2355,141 @@ int main(int argc, char **argv)
 	}
 
 #if defined(USE_HYDRA) || defined(USE_OPENVR)
-	if (!vrInit())
+	if (!g_headless && !vrInit())
 	{
 		return 1;
 	}
 #endif
 
-	while (1)
+#if defined(USE_OPENVR)
+	if (pVR)
+	{
+		g_period = g_frameDuration;
+	}
+#endif
+	g_scaler->SetPeriod(g_period);
+
+	if (g_reproject && useRenderTarget && !g_vulkan)
+	{
+		Reprojector::Present present = NULL;
+#if defined(USE_OPENVR)
+		if (pVR)
+		{
+			present = ReprojectionPresent;
+		}
+#endif
+		if (!g_headless)
+		{
+			g_reproctx = glXCreateContext(g_gldpy, g_glvisinfo, g_glctx, True);
+		}
+		g_reprojector = new Reprojector(BindReprojectionContext, ReprojectionView, present);
+		if (!g_reprojector->Start(renderTargetSize_w, renderTargetSize_h, g_period))
+		{
+			delete g_reprojector;
+			g_reprojector = NULL;
+		}
+	}
+
+	if (g_record_path && useRenderTarget && !g_vulkan)
+	{
+		// half the unscaled eye size each unless asked otherwise, the disk has to keep up
+		if (!g_record_width || !g_record_height)
+		{
+			g_record_width = g_scaler->base_width();
+			g_record_height = g_scaler->base_height() / 2;
+		}
+		g_recorder = new Recorder();
+		if (!g_recorder->Start(g_record_path, g_record_width, g_record_height, g_period))
+		{
+			delete g_recorder;
+			g_recorder = NULL;
+		}
+	}
+
+	Profiler::DumpOnSignal(SIGUSR1);
+
+	if (g_control_path)
+	{
+		RegisterTunables();
+		if (Control::Start(g_control_path))
+		{
+			printf("  control on %s\n", g_control_path);
+		}
+	}
+
+	long long frame_start = GetTimeNs();
+	while (!g_count || frame < g_count)
 	{
+		PROFILE("frame");
+		if (Control::Apply())
+		{
+			TunablesChanged();
+		}
+		{
+			// blocks only when the gpu is g_inflight frames behind
+			PROFILE("pace");
+			g_pacer->BeginFrame();
+		}
+#if defined(USE_VULKAN)
+		if (g_vk)
+		{
+			g_vk->BeginFrame();
+		}
+#endif
+
+		if (g_xtrace)
+		{
+			if (!g_xtrace->replaying())
+			{
+				g_xtrace->RecordFrame(frame);
+			}
+			else if (!g_xtrace->Replay())
+			{
+				break;
+			}
+		}
+
+		// captures for damage included
+		ProfileScope events(g_stage_events);
 		XEvent event;
 		while (XPending(dpy) > 0)
 		{
 			XNextEvent(dpy, &event);
+			if (g_xtrace)
+			{
+				g_xtrace->RecordEvent(event, damageEvent);
+			}
+			XCalls::BeginEvent(event, damageEvent);
 			switch (event.type)
 			{
 			case ConfigureNotify:
-				printf("ConfigureNotify %08x\n", (int)event.xconfigure.window);
+				LOG_INFO("ConfigureNotify %08x\n", (int)event.xconfigure.window);
 				{
 					Window wabove;
 					XWindow * w = XDisplay::GetWindow(dpy, event.xconfigure.window);
 					xw->UpdateHierarchy();
+					if (w)
+					{
+						w->Configure(event.xconfigure.x, event.xconfigure.y,
+								event.xconfigure.width, event.xconfigure.height);
+					}
 
 					XWindow * above = NULL;
-					if (XGetTransientForHint(dpy, w->w(), &wabove) && wabove != None)
+					XCALL(transient, "XGetTransientForHint (configure)", 1);
+					bool is_transient = XGetTransientForHint(dpy, w->w(), &wabove);
+					transient.End(is_transient? 36 : 32);
+					if (is_transient && wabove != None)
 					{
-						printf("   transient for %08x\n", (int)wabove);
+						LOG_DEBUG("   transient for %08x\n", (int)wabove);
 						above = XDisplay::GetWindow(dpy, wabove);
 					}
 					if ((!above || !above->mapped()) && event.xconfigure.above != None)
 					{
-						printf("   above %08x\n", (int)event.xconfigure.above);
+						LOG_DEBUG("   above %08x\n", (int)event.xconfigure.above);
 						above = XDisplay::GetWindow(dpy, event.xconfigure.above);
 					}
-					if (!above) printf("no above\n");
-					else if (!above->mapped()) printf("above not mapped\n");
+					if (!above) LOG_DEBUG("no above\n");
+					else if (!above->mapped()) LOG_DEBUG("above not mapped\n");
 
 					if (above && above->mapped())
 					{
@@ -1265,13 +2498,13 @@ int main(int argc, char **argv)
 						w->matrix() = above->matrix();
 						//w->matrix().translation() += Vector3(x, y, 1.f);
 						w->matrix().translation() += w->matrix().right() * x - w->matrix().up() * y + w->matrix().back() * 0.1f;
-						printf("   above %08x %f %f\n", (int)above->w(), above->matrix().translation()._x, above->matrix().translation()._y);
-						printf("   windo %08x %f %f\n", (int)w->w(), w->matrix().translation()._x, w->matrix().translation()._y);
+						LOG_DEBUG("   above %08x %f %f\n", (int)above->w(), above->matrix().translation()._x, above->matrix().translation()._y);
+						LOG_DEBUG("   windo %08x %f %f\n", (int)w->w(), w->matrix().translation()._x, w->matrix().translation()._y);
 					}
 				}
 				break;
 			case Expose:
-				printf("Expose %08x\n", (int)event.xexpose.window);
+				LOG_INFO("Expose %08x\n", (int)event.xexpose.window);
 				{
 					XWindow * w = XDisplay::GetWindow(dpy, event.xexpose.window);
 					if (w)
@@ -1282,40 +2515,47 @@ int main(int argc, char **argv)
 				}
 				break;
 			case MapNotify:
-				printf("Map %08x\n", (int)event.xmap.window);
+				LOG_INFO("Map %08x\n", (int)event.xmap.window);
 				{
 					XWindow * w = XDisplay::GetWindow(dpy, event.xmap.window);
 					xw->UpdateHierarchy();
 					if (w)
 					{
+						w->Mapped();
 						XDamageCreate (dpy, event.xmap.window, XDamageReportRawRectangles);
 						w->Update(0,0,0,0);
 					}
 				}
 				break;
 			case UnmapNotify:
-				printf("Unmap %08x\n", (int)event.xunmap.window);
+				LOG_INFO("Unmap %08x\n", (int)event.xunmap.window);
 				{
 					XWindow * w = XDisplay::GetWindow(dpy, event.xunmap.window);
 					if (w)
 					{
-						w->Unmap();
+						w->Unmapped();
 						for (XWindow * child = xw->children(); child; child = child->sibling())
 						{
 							if (child->mapped())
 							{
-								printf("focus %08x\n", (int)child->w());
+								LOG_INFO("focus %08x\n", (int)child->w());
 								XSetInputFocus(dpy, child->w(), RevertToParent, CurrentTime);
 							}
 						}
 					}
 				}
 				break;
+			case PropertyNotify:
+				if (event.xproperty.atom == g_scenario_atom)
+				{
+					ScenarioChanged(dpy, root);
+				}
+				break;
 			case FocusIn:
-				printf("focus in %08x\n", (int)event.xfocus.window);
+				LOG_INFO("focus in %08x\n", (int)event.xfocus.window);
 				break;
 			case FocusOut:
-				printf("focus out %08x\n", (int)event.xfocus.window);
+				LOG_INFO("focus out %08x\n", (int)event.xfocus.window);
 				break;
 			default:
 				if (event.type == damageEvent + XDamageNotify)
@@ -1324,15 +2564,17 @@ int main(int argc, char **argv)
 					XWindow * w = XDisplay::GetWindow(dpy, de->drawable);
 					if (w)
 					{
+						w->Damaged(GetTimeNs(), (unsigned int)de->timestamp);
 						/*printf ("damage %08x %08x %d %d %d %d, %d %d %d %d\n", de->drawable, w->w(),
 								de->area.x, de->area.y, de->area.width, de->area.height,
 								de->geometry.x, de->geometry.y, de->geometry.width, de->geometry.height);*/
 						w->Update(de->area.x, de->area.y, de->area.width, de->area.height);
+						XDisplay::Reacted(w);
 					}
 				}
 			}
 		}
-		while (XPending(g_gldpy) > 0)
+		while (!g_headless && XPending(g_gldpy) > 0)
 		{
 			XNextEvent(g_gldpy, &event);
 			switch (event.type)
@@ -1346,8 +2588,12 @@ int main(int argc, char **argv)
 				ReSizeGLScene(event.xconfigure.width, event.xconfigure.height);
 				break;
 			case KeyPress:
-				printf("key %08x %d \n", (int)g_kb_focus, event.xkey.keycode);
+				LOG_DEBUG("key %08x %d \n", (int)g_kb_focus, event.xkey.keycode);
 				keyPressed(event.xkey.keycode, 0, 0);
+				if (XLookupKeysym(&event.xkey, 0) == XK_F12)
+				{
+					Profiler::RequestDump();
+				}
 				if (g_kb_focus != None)
 				{
 					XWindow * w = XDisplay::GetWindow(dpy, g_kb_focus);
@@ -1382,12 +2628,12 @@ int main(int argc, char **argv)
 			case ButtonPress:
 				{
 					Vector3 ray(event.xbutton.x * 2.f / g_width - 1.f, -(event.xbutton.y * 2.f - g_height) / g_width, -1.f);
-					printf ("ray %f %f %f\n", ray._x, ray._y, ray._z);
+					LOG_DEBUG("ray %f %f %f\n", ray._x, ray._y, ray._z);
 					ray.normalize();
 					XDisplay::Hit hit(g_pos * g_scale, ray);
 					if (!XDisplay::HitTest(hit, ButtonPressMask))
 					{
-						printf ("miss\n");
+						LOG_DEBUG("miss\n");
 						break;
 					}
 					if (hit._w->w() != g_kb_focus)
@@ -1395,7 +2641,7 @@ int main(int argc, char **argv)
 						g_kb_focus = hit._w->w();
 						XSetInputFocus(dpy, g_kb_focus, RevertToParent, CurrentTime);
 					}
-					printf ("hit %08x %f %f %f, %f %f %f\n", (int)g_kb_focus, hit._x, -hit._y, hit._t,
+					LOG_DEBUG("hit %08x %f %f %f, %f %f %f\n", (int)g_kb_focus, hit._x, -hit._y, hit._t,
 							hit._matrix.translation()._x, hit._matrix.translation()._y, hit._matrix.translation()._z);
 					hit._w->SendButtonEvent(root, hit._x, -hit._y, event.xbutton.button, event.xbutton.state, true);
 				}
@@ -1403,12 +2649,12 @@ int main(int argc, char **argv)
 			case ButtonRelease:
 				{
 					Vector3 ray(event.xbutton.x * 2.f / g_width - 1.f, -(event.xbutton.y * 2.f - g_height) / g_width, -1.f);
-					printf ("ray %f %f %f\n", ray._x, ray._y, ray._z);
+					LOG_DEBUG("ray %f %f %f\n", ray._x, ray._y, ray._z);
 					ray.normalize();
 					XDisplay::Hit hit(g_pos * g_scale, ray);
 					if (!XDisplay::HitTest(hit, ButtonReleaseMask))
 					{
-						printf ("miss\n");
+						LOG_DEBUG("miss\n");
 						break;
 					}
 					if (hit._w->w() != g_kb_focus)
@@ -1416,7 +2662,7 @@ int main(int argc, char **argv)
 						g_kb_focus = hit._w->w();
 						XSetInputFocus(dpy, g_kb_focus, RevertToParent, CurrentTime);
 					}
-					printf ("hit %08x %f %f %f, %f %f %f\n", (int)g_kb_focus, hit._x, -hit._y, hit._t,
+					LOG_DEBUG("hit %08x %f %f %f, %f %f %f\n", (int)g_kb_focus, hit._x, -hit._y, hit._t,
 							hit._matrix.translation()._x, hit._matrix.translation()._y, hit._matrix.translation()._z);
 					hit._w->SendButtonEvent(root, hit._x, -hit._y, event.xbutton.button, event.xbutton.state, false);
 				}
@@ -1424,12 +2670,34 @@ int main(int argc, char **argv)
 #endif
 			}
 		}
+		XCalls::EndEvent();
+		events.End();
 
 		g_scale = g_ppi / 2.56f;//960.f;
 
 #if defined(USE_HYDRA) || defined(USE_OPENVR)
-		vrInputUpdate();
+		// replayed hands drive the view headless too
+		bool synthetic = g_headless && !(g_xtrace && g_xtrace->replaying());
+#else
+		bool synthetic = g_headless;
+#endif
+		ProfileScope input(g_stage_input);
+		if (synthetic)
+		{
+			SyntheticCamera(frame, g_camera);
+		}
+#if defined(USE_HYDRA) || defined(USE_OPENVR)
+		else
+		{
+			vrInputUpdate();
+		}
 #endif
+		input.End();
+		{
+			// everything synthetic this frame goes out together
+			PROFILE("flush");
+			XDisplay::FlushEvents();
+		}
 
 		//float screen = xw->width();
 		//xw->matrix() = *(Matrix*)Matrix::identity;
@@ -1438,8 +2706,59 @@ int main(int argc, char **argv)
 		//xw->matrix().Rotate(45.f, 0, 1, 0);
 
 		if (useRenderTarget) {
+			Matrix eyeProj[2];
+			Matrix eyeView[2];
 			for (int eyeIndex = 0; eyeIndex < 2; eyeIndex++)
 			{
+				GetEyeProjection(eyeIndex, eyeProj[eyeIndex]);
+				GetEyeView(eyeIndex, eyeView[eyeIndex]);
+			}
+
+			{
+				// both eyes before drawing either, so revealed windows get
+				// captured first, from the top of frame pose so the captures
+				// stay out from between the late pose and the draws
+				PROFILE("cull");
+				XDisplay::BeginCull();
+				for (int eyeIndex = 0; eyeIndex < 2; eyeIndex++)
+				{
+					CullGLScene(eyeProj[eyeIndex], eyeView[eyeIndex], eyeIndex);
+				}
+				XDisplay::EndCull(2);
+			}
+#if defined(USE_HYDRA) || defined(USE_OPENVR)
+			// only the cull and the view matrix loads sit between this and the draws
+			if (!g_headless)
+			{
+				vrLatePose();
+				// what the eyes skip, nothing captured, a window only the late
+				// pose reveals is drawn as it was and catches up next frame
+				PROFILE("late_cull");
+				XDisplay::BeginCull();
+				for (int eyeIndex = 0; eyeIndex < 2; eyeIndex++)
+				{
+					GetEyeView(eyeIndex, eyeView[eyeIndex]);
+					CullGLScene(eyeProj[eyeIndex], eyeView[eyeIndex], eyeIndex);
+				}
+			}
+#endif
+
+			int eyeWidth = g_scaler->width();
+			int eyeHeight = g_scaler->height();
+			g_scaler->BeginGpu();
+			for (int eyeIndex = 0; eyeIndex < 2; eyeIndex++)
+			{
+#if defined(USE_VULKAN)
+				if (g_vk)
+				{
+					Matrix view;
+					GetSceneView(eyeView[eyeIndex], view);
+					g_vk->BeginEye(eyeIndex, eyeProj[eyeIndex] * view);
+					xw->Draw(eyeIndex);
+					g_vk->EndEye();
+					continue;
+				}
+#endif
 				glBindFramebuffer(GL_FRAMEBUFFER, frameBuffer[eyeIndex]);
 				glEnable(GL_DEPTH_TEST);
 
@@ -1447,27 +2766,52 @@ int main(int argc, char **argv)
 				glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);		// Clear The Screen And The Depth Buffer
 
 #if defined(USE_OPENVR)
-				glViewport( 0, 0, renderTargetSize_w, renderTargetSize_h);
-				glMatrixMode(GL_PROJECTION);
-				glLoadMatrixf(projMat[eyeIndex]._m);
-				glMatrixMode(GL_MODELVIEW);
-				glLoadIdentity();
-
-				Matrix viewMat = hmdMat * eyeMat[eyeIndex];
-				viewMat.AppendTranslate(0, -1, 0);
-				viewMat.AppendScale(100, 100, 100);
-#else
-				SetupProjection3D(g_width, g_height);
-				glLoadIdentity();
-
-				Matrix viewMat = g_camera;
-				viewMat.PrependTranslate(eyeIndex*4.0f - 2.f, 0, 0);
+				if (pVR)
+				{
+					glViewport( 0, 0, eyeWidth, eyeHeight);
+					glMatrixMode(GL_PROJECTION);
+					glLoadMatrixf(eyeProj[eyeIndex]._m);
+					glMatrixMode(GL_MODELVIEW);
+					glLoadIdentity();
+				}
+				else
 #endif
+				{
+					SetupProjection3D(g_width, g_height);
+					glViewport(0, 0, eyeWidth, eyeHeight);
+					glLoadIdentity();
+				}
 
-				DrawGLScene(viewMat);
+				PROFILE("draw");
+				DrawGLScene(eyeView[eyeIndex], eyeIndex);
+				if (g_latency_test && eyeIndex == 0)
+				{
+					LatencyProbe();
+				}
 			}
+			g_scaler->EndGpu();
 
 			glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+			if (g_reprojector)
+			{
+				PROFILE("reproject");
+				g_reprojector->Store(texture, eyeProj, eyeView, g_scaler->u(), g_scaler->v(), frame);
+			}
+			if (g_recorder)
+			{
+				PROFILE("record");
+				g_recorder->Capture(frameBuffer, eyeWidth, eyeHeight);
+			}
+		}
+
+		if (g_headless)
+		{
+			// no window to mirror to, the eyes stay in their FBOs
+		}
+		else if (useRenderTarget) {
+			// the submits included
+			PROFILE("mirror");
 			glViewport(0, 0, g_width, g_height);
 			glClearColor(1, 0, 1, 1.f);
 			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);		// Clear The Screen And The Depth Buffer
@@ -1491,10 +2835,18 @@ int main(int argc, char **argv)
 				1, 0,
 				0, 0,
 			};
+			float u = g_scaler->u();
+			float v = g_scaler->v();
+			float texcoords2[] = {
+				0, v,
+				u, v,
+				u, 0,
+				0, 0,
+			};
 			glEnableClientState(GL_VERTEX_ARRAY);
 			glVertexPointer(2, GL_FLOAT, 0, verts2);
 			glEnableClientState(GL_TEXTURE_COORD_ARRAY);
-			glTexCoordPointer(2, GL_FLOAT, 0, verts2 );
+			glTexCoordPointer(2, GL_FLOAT, 0, texcoords2 );
 			glColor4f(1.f, 1.f, 1.f, 1.f);
 
 			glBindTexture(GL_TEXTURE_2D, texture[0]);
@@ -1504,31 +2856,155 @@ int main(int argc, char **argv)
 			glBindTexture(GL_TEXTURE_2D, texture[1]);
 			glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
 
-			glFinish();
-
 #if defined(USE_OPENVR)
-			vr::Texture_t leftEyeTexture = {(void*)(int64_t)texture[0], vr::TextureType_OpenGL, vr::ColorSpace_Gamma };
-			vr::VRCompositor()->Submit(vr::Eye_Left, &leftEyeTexture );
-			vr::Texture_t rightEyeTexture = {(void*)(int64_t)texture[1], vr::TextureType_OpenGL, vr::ColorSpace_Gamma };
-			vr::VRCompositor()->Submit(vr::Eye_Right, &rightEyeTexture );
+			SubmitEyes(texture, u, v, hmdMat);
 #endif
 
+			PROFILE("swap");
+			glXSwapBuffers(g_gldpy, g_glwin);
 		} else {
 			glClearColor(96.f / 255.f, 118.f / 255.f, 98.f / 255.f, 1.f);
 			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);		// Clear The Screen And The Depth Buffer
 
+			Matrix proj;
+			GetProjection3D(g_width, g_height, proj);
+			{
+				PROFILE("cull");
+				XDisplay::BeginCull();
+				CullGLScene(proj, g_camera, 0);
+				XDisplay::EndCull(1);
+			}
+#if defined(USE_HYDRA) || defined(USE_OPENVR)
+			if (!g_headless)
+			{
+				vrLatePose();
+				PROFILE("late_cull");
+				XDisplay::BeginCull();
+				CullGLScene(proj, g_camera, 0);
+			}
+#endif
+
 			SetupProjection3D(g_width, g_height);
 
 			glLoadIdentity();
-			DrawGLScene(g_camera);
+			{
+				PROFILE("draw");
+				DrawGLScene(g_camera);
+			}
+			if (g_latency_test)
+			{
+				LatencyProbe();
+			}
+
+			PROFILE("swap");
+			glXSwapBuffers(g_gldpy, g_glwin);
+		}
+
+		// whatever damage made it into the eyes this frame
+		XDisplay::FrameSubmitted(GetTimeNs());
+		XCalls::EndFrame();
+
+#if defined(USE_VULKAN)
+		if (g_vk)
+		{
+			g_vk->EndFrame();
+		}
+#endif
+		g_pacer->EndFrame();
+		if (g_pacer->stat_frames() >= 300)
+		{
+			// cpu time overlapping the gpu vs time blocked on the fence
+			printf("frame %d: cpu %.2f ms, fence wait %.2f ms, worst %.2f ms, culled %.1f, reprojected %d\n", frame,
+					g_pacer->stat_cpu_ms(), g_pacer->stat_wait_ms(), g_pacer->stat_max_ms(), XDisplay::stat_culled(),
+					g_reprojector? g_reprojector->reprojected() : 0);
+			if (useRenderTarget)
+			{
+				printf("  scale %.2f (%.2f-%.2f), eyes gpu %.2f ms, %d hit %d missed\n", g_scaler->scale(),
+						g_scaler->stat_min_scale(), g_scaler->stat_max_scale(), g_scaler->gpu_ms(),
+						g_scaler->stat_hits(), g_scaler->stat_misses());
+			}
+			printf("  textures %.1f MB resident, %.1f MB evicted, %d evictions\n",
+					XDisplay::resident_bytes() / (1024.f * 1024.f), XDisplay::evicted_bytes() / (1024.f * 1024.f),
+					XDisplay::evictions());
+			printf("  events %.2f sent, %.2f coalesced, %.2f flushes per frame\n",
+					XDisplay::events_sent() / (float)g_pacer->stat_frames(),
+					XDisplay::events_coalesced() / (float)g_pacer->stat_frames(),
+					XDisplay::flushes() / (float)g_pacer->stat_frames());
+			if (XDisplay::reactions())
+			{
+				printf("  input to redraw avg %.2f ms, worst %.2f ms over %d injections\n",
+						XDisplay::reaction_ms(), XDisplay::reaction_max_ms(), XDisplay::reactions());
+			}
+			XDisplay::ResetEventStats();
+			XDisplay::ResetReactionStats();
+			XDisplay::ResetCullStats();
+			if (g_latency_test)
+			{
+				g_latency_test->Report(stdout);
+			}
+			XCalls::Report(stdout);
+			if (Log::dropped())
+			{
+				printf("  log %d messages written, %d dropped\n", Log::written(), Log::dropped());
+			}
+			if (g_mips)
+			{
+				printf("  mips %.2f ms over %d updates, %lld texels\n", g_mips->stat_ms(),
+						g_mips->stat_updates(), g_mips->stat_texels());
+				g_mips->ResetStats();
+			}
+			g_pacer->ResetStats();
+			g_scaler->ResetStats();
+			Profiler::Report(stdout);
+		}
+		if (Profiler::DumpRequested())
+		{
+			Profiler::DumpTrace(g_profile_path, g_profile_seconds);
 		}
 
-		glXSwapBuffers(g_gldpy, g_glwin);
+		if (g_stall_every && frame % g_stall_every == g_stall_every - 1)
+		{
+			usleep(g_stall_ms * 1000);
+		}
+
+		long long now = GetTimeNs();
+		AddFrameTime(NsToMs(now - frame_start));
+		g_scaler->EndFrame(NsToMs(now - frame_start));
+		frame_start = now;
 
 		frame++;
 	}
 
-	return 1;
+	// only reached with -count or at the end of a replay
+	if (g_reprojector)
+	{
+		g_reprojector->Stop();
+	}
+	if (g_recorder)
+	{
+		g_recorder->Stop();
+	}
+	if (g_latency_test)
+	{
+		g_latency_test->Stop();
+	}
+	if (g_xtrace)
+	{
+		if (g_xtrace->replaying())
+		{
+			printf("replayed %d recorded frames, %d records\n", g_xtrace->frames(), g_xtrace->records());
+		}
+		g_xtrace->Close();
+	}
+	ReportFrameTimes();
+#if defined(USE_VULKAN)
+	delete g_vk;
+#endif
+	if (g_headless)
+	{
+		exitHeadless();
+	}
+	return 0;
 }
 
 
@@ -0,0 +1,149 @@
+
+#include <GL/glew.h>
+#include <stdio.h>
+#include "Clock.h"
+#include "FramePacer.h"
+
+// wake up every so often to complain about a gpu that never finishes
+#define FENCE_TIMEOUT 100000000ULL
+
+FramePacer::FramePacer(int frames, int upload_size)
+{
+	if (frames < 1)
+		frames = 1;
+	if (frames > FRAMEPACER_MAX_FRAMES)
+		frames = FRAMEPACER_MAX_FRAMES;
+	_frames = frames;
+	_slot = 0;
+	_frame = 0;
+	_in_frame = false;
+	_upload_size = upload_size;
+	_upload_used = 0;
+	_upload_offset = 0;
+	_begin_ns = 0;
+	_wait_ns = 0;
+	_cpu_ns = 0;
+	for (int i = 0; i < FRAMEPACER_MAX_FRAMES; i++)
+	{
+		_fence[i] = 0;
+		_upload[i] = 0;
+	}
+	ResetStats();
+}
+
+FramePacer::~FramePacer()
+{
+	for (int i = 0; i < FRAMEPACER_MAX_FRAMES; i++)
+	{
+		if (_fence[i])
+		{
+			glDeleteSync(_fence[i]);
+		}
+	}
+	if (_upload[0])
+	{
+		glDeleteBuffers(_frames, _upload);
+	}
+}
+
+void FramePacer::Initialize()
+{
+	glGenBuffers(_frames, _upload);
+	for (int i = 0; i < _frames; i++)
+	{
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, _upload[i]);
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, _upload_size, NULL, GL_STREAM_DRAW);
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+void FramePacer::BeginFrame()
+{
+	long long start = GetTimeNs();
+
+	_slot = _frame % _frames;
+	if (_fence[_slot])
+	{
+		// the gpu is _frames behind, wait until it consumed this slot
+		while (glClientWaitSync(_fence[_slot], GL_SYNC_FLUSH_COMMANDS_BIT, FENCE_TIMEOUT) == GL_TIMEOUT_EXPIRED)
+		{
+			printf("frame %u: still waiting on the gpu\n", _frame);
+		}
+		glDeleteSync(_fence[_slot]);
+		_fence[_slot] = 0;
+	}
+
+	_begin_ns = GetTimeNs();
+	_wait_ns = _begin_ns - start;
+	_upload_used = 0;
+	_in_frame = true;
+}
+
+void FramePacer::EndFrame()
+{
+	_fence[_slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	glFlush();
+
+	_cpu_ns = GetTimeNs() - _begin_ns;
+	_in_frame = false;
+	_frame++;
+
+	_stat_frames++;
+	_stat_wait_ns += _wait_ns;
+	_stat_cpu_ns += _cpu_ns;
+	if (_wait_ns + _cpu_ns > _stat_max_ns)
+		_stat_max_ns = _wait_ns + _cpu_ns;
+}
+
+// Returns write only memory for an upload of size bytes, the unpack buffer
+// stays bound until the caller is done with the matching glTex*Image call.
+// Returns NULL outside of a frame or once the slot's buffer is used up.
+void * FramePacer::MapUpload(int size)
+{
+	if (!_in_frame || !_upload[_slot])
+	{
+		return NULL;
+	}
+	int offset = (_upload_used + 63) & ~63;
+	if (offset + size > _upload_size)
+	{
+		return NULL;
+	}
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, _upload[_slot]);
+	// the fence waited on in BeginFrame already guarantees the gpu is done with it
+	void * data = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, offset, size,
+			GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+	if (!data)
+	{
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		return NULL;
+	}
+	_upload_offset = offset;
+	_upload_used = offset + size;
+	return data;
+}
+
+const void * FramePacer::UnmapUpload()
+{
+	glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+	return (const void *)(long)_upload_offset;
+}
+
+float FramePacer::stat_wait_ms()
+{
+	return _stat_frames? _stat_wait_ns / (_stat_frames * 1000000.f) : 0.f;
+}
+
+float FramePacer::stat_cpu_ms()
+{
+	return _stat_frames? _stat_cpu_ns / (_stat_frames * 1000000.f) : 0.f;
+}
+
+void FramePacer::ResetStats()
+{
+	_stat_frames = 0;
+	_stat_wait_ns = 0;
+	_stat_cpu_ns = 0;
+	_stat_max_ns = 0;
+}
@@ -0,0 +1,64 @@
+#ifndef FRAMEPACER_H
+#define FRAMEPACER_H
+
+#include <GL/glew.h>
+
+#define FRAMEPACER_MAX_FRAMES 4
+
+// Paces the cpu against the gpu with one fence per frame instead of glFinish.
+// Up to _frames frames may be queued before BeginFrame blocks, resources tied
+// to a slot (the upload buffer) are only touched once that slot's fence passed.
+
+class FramePacer
+{
+protected:
+	int _frames;
+	int _slot;
+	unsigned int _frame;
+	bool _in_frame;
+
+	GLsync _fence[FRAMEPACER_MAX_FRAMES];
+
+	GLuint _upload[FRAMEPACER_MAX_FRAMES];
+	int _upload_size;
+	int _upload_used;
+	int _upload_offset;
+
+	long long _begin_ns;
+	long long _wait_ns;
+	long long _cpu_ns;
+
+	// accumulated since the last ResetStats
+	int _stat_frames;
+	long long _stat_wait_ns;
+	long long _stat_cpu_ns;
+	long long _stat_max_ns;
+
+public:
+	FramePacer(int frames = 2, int upload_size = 16 * 1024 * 1024);
+	~FramePacer();
+
+	void Initialize();
+
+	void BeginFrame();
+	void EndFrame();
+
+	void * MapUpload(int size);
+	const void * UnmapUpload();
+
+	int frames() { return _frames; }
+	int slot() { return _slot; }
+	unsigned int frame() { return _frame; }
+	bool in_frame() { return _in_frame; }
+
+	float wait_ms() { return _wait_ns / 1000000.f; }
+	float cpu_ms() { return _cpu_ns / 1000000.f; }
+
+	int stat_frames() { return _stat_frames; }
+	float stat_wait_ms();
+	float stat_cpu_ms();
+	float stat_max_ms() { return _stat_max_ns / 1000000.f; }
+	void ResetStats();
+};
+
+#endif//FRAMEPACER_H
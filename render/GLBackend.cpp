@@ -0,0 +1,145 @@
+#include <GL/glew.h>
+#include <stdlib.h>
+#include "FramePacer.h"
+#include "MipUpdater.h"
+#include "GLBackend.h"
+
+GLBackend::GLBackend(FramePacer * pacer, MipUpdater * mips)
+{
+	_pacer = pacer;
+	_mips = mips;
+	_max_size = 0;
+	_mapped = false;
+	_sizes = NULL;
+	_nsizes = 0;
+}
+
+GLBackend::~GLBackend()
+{
+	free(_sizes);
+}
+
+int GLBackend::max_image_size()
+{
+	if (!_max_size)
+	{
+		glGetIntegerv(GL_MAX_TEXTURE_SIZE, &_max_size);
+	}
+	return _max_size;
+}
+
+int GLBackend::ImageBytes(int width, int height)
+{
+	// a full chain adds a third
+	int bytes = width * height * 4;
+	return _mips? bytes + bytes / 3 : bytes;
+}
+
+unsigned int GLBackend::CreateImage(int width, int height)
+{
+	GLuint texture;
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	// no seams to blend across, each tile clamps at its own edge
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+	if (_mips)
+	{
+		_mips->Allocate(texture, width, height);
+	}
+
+	if (texture >= _nsizes)
+	{
+		unsigned int count = texture * 2 + 64;
+		_sizes = (int*)realloc(_sizes, sizeof(int) * 2 * count);
+		_nsizes = count;
+	}
+	_sizes[texture * 2] = width;
+	_sizes[texture * 2 + 1] = height;
+	return texture;
+}
+
+void GLBackend::DestroyImage(unsigned int image)
+{
+	GLuint texture = image;
+	glDeleteTextures(1, &texture);
+}
+
+void * GLBackend::MapUpload(int size)
+{
+	void * data = _pacer? _pacer->MapUpload(size) : NULL;
+	_mapped = data != NULL;
+	return data;
+}
+
+// with an upload buffer bound the pixels are an offset into it
+const void * GLBackend::UnmapUpload()
+{
+	return _pacer->UnmapUpload();
+}
+
+void GLBackend::UploadImage(unsigned int image, int x, int y, int width, int height,
+		const void * pixels, int row_length, int bytes_per_pixel)
+{
+	GLenum format = bytes_per_pixel == 4? GL_RGBA : GL_RGB;
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, row_length);
+	glBindTexture(GL_TEXTURE_2D, image);
+	glTexSubImage2D( GL_TEXTURE_2D, 0, x, y, width, height, format, GL_UNSIGNED_BYTE, pixels);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	if (_mips)
+	{
+		_mips->Update(image, _sizes[image * 2], _sizes[image * 2 + 1], x, y, x + width, y + height);
+	}
+}
+
+void GLBackend::EndUpload()
+{
+	if (_mapped)
+	{
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		_mapped = false;
+	}
+	if (_mips)
+	{
+		_mips->End();
+	}
+}
+
+void GLBackend::DrawImage(unsigned int image, const Matrix &model, const float * rect)
+{
+	float x = rect[0];
+	float y = rect[1];
+	float x2 = rect[2];
+	float y2 = rect[3];
+	float vertices[] =
+	{
+		x, y, 0.f, 0.f,
+		x2, y, 1.f, 0.f,
+		x2, y2, 1.f, 1.f,
+		x, y2, 0.f, 1.f
+	};
+
+	glPushMatrix();
+	glMultMatrixf(model._m);
+
+	glColor4f(1.0, 1.0, 1.0, 1.0);
+	glBindTexture(GL_TEXTURE_2D, image);
+
+	glDisable(GL_BLEND);
+	glBlendFunc( GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	glEnable(GL_TEXTURE_2D);
+	glClientActiveTexture(GL_TEXTURE0);
+	glActiveTexture(GL_TEXTURE0);
+	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+	glEnableClientState(GL_VERTEX_ARRAY);
+
+	glVertexPointer(2, GL_FLOAT, 4*4, vertices );
+	glTexCoordPointer(2, GL_FLOAT, 4*4, vertices + 2 );
+
+	glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+
+	glPopMatrix();
+}
@@ -0,0 +1,45 @@
+#ifndef GLBACKEND_H
+#define GLBACKEND_H
+
+#include "RenderBackend.h"
+
+class FramePacer;
+class MipUpdater;
+
+// Images are GL textures, uploads go through the pacer's unpack buffers and
+// quads draw with whatever modelview and projection the caller set up.
+
+class GLBackend : public RenderBackend
+{
+protected:
+	FramePacer * _pacer;
+	MipUpdater * _mips;
+	GLint _max_size;
+	bool _mapped;
+
+	// level 0 size by texture name, names stay small so a flat table does
+	int * _sizes;
+	unsigned int _nsizes;
+
+public:
+	GLBackend(FramePacer * pacer, MipUpdater * mips);
+	~GLBackend();
+
+	const char * name() { return "opengl"; }
+
+	int max_image_size();
+	int ImageBytes(int width, int height);
+
+	unsigned int CreateImage(int width, int height);
+	void DestroyImage(unsigned int image);
+
+	void * MapUpload(int size);
+	const void * UnmapUpload();
+	void UploadImage(unsigned int image, int x, int y, int width, int height,
+			const void * pixels, int row_length, int bytes_per_pixel);
+	void EndUpload();
+
+	void DrawImage(unsigned int image, const Matrix &model, const float * rect);
+};
+
+#endif//GLBACKEND_H
@@ -0,0 +1,153 @@
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <stdio.h>
+#include "Headless.h"
+
+static EGLDisplay s_display = EGL_NO_DISPLAY;
+static EGLContext s_context = EGL_NO_CONTEXT;
+static EGLSurface s_surface = EGL_NO_SURFACE;
+static EGLConfig s_config;
+static bool s_pbuffer;
+
+static EGLDisplay GetDisplay()
+{
+	// the surfaceless platform doesn't need any native display at all
+	PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+		(PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if (getPlatformDisplay)
+	{
+		EGLDisplay display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+		if (display != EGL_NO_DISPLAY)
+		{
+			return display;
+		}
+	}
+	return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+
+bool initHeadless(int width, int height)
+{
+	s_display = GetDisplay();
+	if (s_display == EGL_NO_DISPLAY)
+	{
+		fprintf(stderr, "headless: no egl display\n");
+		return false;
+	}
+
+	EGLint major, minor;
+	if (!eglInitialize(s_display, &major, &minor))
+	{
+		fprintf(stderr, "headless: eglInitialize failed 0x%x\n", eglGetError());
+		return false;
+	}
+	printf("  headless egl %d.%d %s\n", major, minor, eglQueryString(s_display, EGL_VENDOR));
+
+	// the renderer is fixed function, so a compatibility desktop GL context
+	if (!eglBindAPI(EGL_OPENGL_API))
+	{
+		fprintf(stderr, "headless: no desktop GL through egl\n");
+		return false;
+	}
+
+	EGLint pbuffer_attrib[] = {
+		EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_RED_SIZE, 8,
+		EGL_GREEN_SIZE, 8,
+		EGL_BLUE_SIZE, 8,
+		EGL_DEPTH_SIZE, 24,
+		EGL_NONE
+	};
+	EGLint surfaceless_attrib[] = {
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_NONE
+	};
+
+	EGLConfig config;
+	EGLint count = 0;
+	bool pbuffer = eglChooseConfig(s_display, pbuffer_attrib, &config, 1, &count) && count > 0;
+	if (!pbuffer)
+	{
+		if (!eglChooseConfig(s_display, surfaceless_attrib, &config, 1, &count) || count == 0)
+		{
+			fprintf(stderr, "headless: no usable egl config\n");
+			return false;
+		}
+	}
+
+	s_context = eglCreateContext(s_display, config, EGL_NO_CONTEXT, NULL);
+	if (s_context == EGL_NO_CONTEXT)
+	{
+		fprintf(stderr, "headless: eglCreateContext failed 0x%x\n", eglGetError());
+		return false;
+	}
+
+	if (pbuffer)
+	{
+		EGLint surface_attrib[] = {
+			EGL_WIDTH, width,
+			EGL_HEIGHT, height,
+			EGL_NONE
+		};
+		s_surface = eglCreatePbufferSurface(s_display, config, surface_attrib);
+	}
+
+	// without a pbuffer this needs EGL_KHR_surfaceless_context
+	if (!eglMakeCurrent(s_display, s_surface, s_surface, s_context))
+	{
+		fprintf(stderr, "headless: eglMakeCurrent failed 0x%x\n", eglGetError());
+		return false;
+	}
+	printf("  headless %s surface %dx%d\n", pbuffer? "pbuffer" : "surfaceless", width, height);
+	s_config = config;
+	s_pbuffer = pbuffer;
+	return true;
+}
+
+bool bindHeadlessSharedContext()
+{
+	EGLContext context = eglCreateContext(s_display, s_config, s_context, NULL);
+	if (context == EGL_NO_CONTEXT)
+	{
+		fprintf(stderr, "headless: shared eglCreateContext failed 0x%x\n", eglGetError());
+		return false;
+	}
+	EGLSurface surface = EGL_NO_SURFACE;
+	if (s_pbuffer)
+	{
+		EGLint surface_attrib[] = {
+			EGL_WIDTH, 1,
+			EGL_HEIGHT, 1,
+			EGL_NONE
+		};
+		surface = eglCreatePbufferSurface(s_display, s_config, surface_attrib);
+	}
+	if (!eglMakeCurrent(s_display, surface, surface, context))
+	{
+		fprintf(stderr, "headless: shared eglMakeCurrent failed 0x%x\n", eglGetError());
+		return false;
+	}
+	return true;
+}
+
+void exitHeadless()
+{
+	if (s_display == EGL_NO_DISPLAY)
+	{
+		return;
+	}
+	eglMakeCurrent(s_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	if (s_surface != EGL_NO_SURFACE)
+	{
+		eglDestroySurface(s_display, s_surface);
+		s_surface = EGL_NO_SURFACE;
+	}
+	if (s_context != EGL_NO_CONTEXT)
+	{
+		eglDestroyContext(s_display, s_context);
+		s_context = EGL_NO_CONTEXT;
+	}
+	eglTerminate(s_display);
+	s_display = EGL_NO_DISPLAY;
+}
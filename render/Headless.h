@@ -0,0 +1,13 @@
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+// Offscreen GL context through EGL, no window and no X server needed for the
+// rendering itself (Mesa llvmpipe is fine). Everything draws into FBOs.
+
+bool initHeadless(int width, int height);
+void exitHeadless();
+
+// binds a second context sharing with the first on the calling thread
+bool bindHeadlessSharedContext();
+
+#endif//HEADLESS_H
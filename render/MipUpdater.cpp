@@ -0,0 +1,143 @@
+#include <GL/glew.h>
+#include "Clock.h"
+#include "MipUpdater.h"
+
+// more than this rarely shows on text and costs bandwidth at grazing angles
+#define MIP_MAX_ANISOTROPY 8.f
+
+MipUpdater::MipUpdater()
+{
+	_fbo[0] = 0;
+	_fbo[1] = 0;
+	_anisotropy = 0.f;
+	_begun = false;
+	ResetStats();
+}
+
+MipUpdater::~MipUpdater()
+{
+	if (_fbo[0])
+	{
+		glDeleteFramebuffers(2, _fbo);
+	}
+}
+
+void MipUpdater::Initialize()
+{
+	glGenFramebuffers(2, _fbo);
+	if (GLEW_EXT_texture_filter_anisotropic)
+	{
+		glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &_anisotropy);
+		if (_anisotropy > MIP_MAX_ANISOTROPY)
+			_anisotropy = MIP_MAX_ANISOTROPY;
+	}
+}
+
+int MipUpdater::Levels(int width, int height)
+{
+	int size = width > height? width : height;
+	int levels = 1;
+	while (size > 1)
+	{
+		size >>= 1;
+		levels++;
+	}
+	return levels;
+}
+
+void MipUpdater::Allocate(GLuint texture, int width, int height)
+{
+	int levels = Levels(width, height);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	for (int level = 1; level < levels; level++)
+	{
+		int w = width >> level;
+		int h = height >> level;
+		glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA, w? w : 1, h? h : 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+	}
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	if (_anisotropy > 1.f)
+	{
+		glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, _anisotropy);
+	}
+}
+
+// Captures happen anywhere in the frame, the bindings are left as they were.
+// Queried once per capture rather than per tile, the queries can stall.
+void MipUpdater::Begin()
+{
+	glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &_read_fbo);
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &_draw_fbo);
+	_scissor = glIsEnabled(GL_SCISSOR_TEST);
+	glDisable(GL_SCISSOR_TEST);
+
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, _fbo[0]);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, _fbo[1]);
+	_begun = true;
+}
+
+void MipUpdater::End()
+{
+	if (!_begun)
+	{
+		return;
+	}
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, _read_fbo);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, _draw_fbo);
+	if (_scissor)
+	{
+		glEnable(GL_SCISSOR_TEST);
+	}
+	_begun = false;
+}
+
+void MipUpdater::Update(GLuint texture, int width, int height, int x, int y, int x2, int y2)
+{
+	long long start = GetTimeNs();
+	int levels = Levels(width, height);
+	if (!_begun)
+	{
+		Begin();
+	}
+
+	int w = width;
+	int h = height;
+	for (int level = 1; level < levels; level++)
+	{
+		int lw = w >> 1? w >> 1 : 1;
+		int lh = h >> 1? h >> 1 : 1;
+		// grow outwards so every texel that saw a changed texel is refiltered
+		int lx = x >> 1;
+		int ly = y >> 1;
+		int lx2 = (x2 + 1) >> 1;
+		int ly2 = (y2 + 1) >> 1;
+		if (lx2 > lw) lx2 = lw;
+		if (ly2 > lh) ly2 = lh;
+
+		int sx2 = lx2 * 2 < w? lx2 * 2 : w;
+		int sy2 = ly2 * 2 < h? ly2 * 2 : h;
+
+		glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, level - 1);
+		glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, level);
+		glBlitFramebuffer(lx * 2, ly * 2, sx2, sy2, lx, ly, lx2, ly2, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+		_stat_texels += (lx2 - lx) * (ly2 - ly);
+
+		x = lx;
+		y = ly;
+		x2 = lx2;
+		y2 = ly2;
+		w = lw;
+		h = lh;
+	}
+
+	_stat_updates++;
+	_stat_ns += GetTimeNs() - start;
+}
+
+void MipUpdater::ResetStats()
+{
+	_stat_updates = 0;
+	_stat_texels = 0;
+	_stat_ns = 0;
+}
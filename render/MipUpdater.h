@@ -0,0 +1,49 @@
+#ifndef MIPUPDATER_H
+#define MIPUPDATER_H
+
+// Keeps the mip chains of window textures current one dirty rectangle at a
+// time. Each level is a linear 2:1 framebuffer blit of the rectangle from the
+// level above, which is a box filter, so only what changed is ever filtered.
+
+class MipUpdater
+{
+protected:
+	GLuint _fbo[2];
+	float _anisotropy;
+
+	// what Begin found bound, put back by End
+	bool _begun;
+	GLint _read_fbo;
+	GLint _draw_fbo;
+	GLboolean _scissor;
+
+	void Begin();
+
+	// accumulated since the last ResetStats
+	int _stat_updates;
+	long long _stat_texels;
+	long long _stat_ns;
+
+public:
+	MipUpdater();
+	~MipUpdater();
+
+	void Initialize();
+
+	static int Levels(int width, int height);
+
+	// sets up the filtering, level 0 is expected to be allocated already
+	void Allocate(GLuint texture, int width, int height);
+	// refilters x,y to x2,y2 of level 0 down through every smaller level,
+	// the first since End saves the framebuffer bindings
+	void Update(GLuint texture, int width, int height, int x, int y, int x2, int y2);
+	// after the last Update of a capture, restores what the first one saved
+	void End();
+
+	int stat_updates() { return _stat_updates; }
+	long long stat_texels() { return _stat_texels; }
+	float stat_ms() { return _stat_ns / 1000000.f; }
+	void ResetStats();
+};
+
+#endif//MIPUPDATER_H
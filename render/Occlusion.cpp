@@ -0,0 +1,135 @@
+
+#include <math.h>
+#include "Occlusion.h"
+
+// anything closer than this to the eye is never culled nor used as occluder
+#define OCCLUSION_NEAR 0.001f
+
+OcclusionBuffer::OcclusionBuffer() : _clip(Matrix::identity)
+{
+	Clear(_clip);
+}
+
+void OcclusionBuffer::Clear(const Matrix &clip)
+{
+	_clip = clip;
+	for (int i = 0; i < OCCLUSION_SIZE * OCCLUSION_SIZE; i++)
+	{
+		_depth[i] = 1000000.f;
+	}
+}
+
+// Projects the window rectangle (0,0)-(width,-height) into grid space.
+// Returns false when it crosses the near plane and can't be reasoned about.
+bool OcclusionBuffer::Project(const Matrix &world, float width, float height, Quad &quad)
+{
+	Matrix m = _clip * world;
+	Vector4 corners[4] =
+	{
+		Vector4(0.f, 0.f, 0.f, 1.f),
+		Vector4(width, 0.f, 0.f, 1.f),
+		Vector4(width, -height, 0.f, 1.f),
+		Vector4(0.f, -height, 0.f, 1.f),
+	};
+
+	float minx = 1000000.f, miny = 1000000.f;
+	float maxx = -1000000.f, maxy = -1000000.f;
+	quad._near = 1000000.f;
+	quad._far = 0.f;
+	for (int i = 0; i < 4; i++)
+	{
+		Vector4 c = m * corners[i];
+		if (c._w < OCCLUSION_NEAR)
+		{
+			return false;
+		}
+		quad._x[i] = (c._x / c._w * 0.5f + 0.5f) * OCCLUSION_SIZE;
+		quad._y[i] = (c._y / c._w * 0.5f + 0.5f) * OCCLUSION_SIZE;
+		if (quad._x[i] < minx) minx = quad._x[i];
+		if (quad._x[i] > maxx) maxx = quad._x[i];
+		if (quad._y[i] < miny) miny = quad._y[i];
+		if (quad._y[i] > maxy) maxy = quad._y[i];
+		if (c._w < quad._near) quad._near = c._w;
+		if (c._w > quad._far) quad._far = c._w;
+	}
+
+	quad._outside = maxx < 0.f || maxy < 0.f || minx >= OCCLUSION_SIZE || miny >= OCCLUSION_SIZE;
+
+	// every cell the rectangle touches, clamped to the screen
+	quad._x0 = minx < 0.f? 0 : (int)minx;
+	quad._y0 = miny < 0.f? 0 : (int)miny;
+	quad._x1 = maxx >= OCCLUSION_SIZE? OCCLUSION_SIZE - 1 : (int)maxx;
+	quad._y1 = maxy >= OCCLUSION_SIZE? OCCLUSION_SIZE - 1 : (int)maxy;
+	return true;
+}
+
+bool OcclusionBuffer::IsOccluded(const Quad &quad)
+{
+	if (quad._outside)
+	{
+		return true;
+	}
+	for (int y = quad._y0; y <= quad._y1; y++)
+	{
+		const float * row = _depth + y * OCCLUSION_SIZE;
+		for (int x = quad._x0; x <= quad._x1; x++)
+		{
+			if (row[x] >= quad._near)
+			{
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+static inline float Edge(const float * x, const float * y, int a, int b, float px, float py)
+{
+	return (x[b] - x[a]) * (py - y[a]) - (y[b] - y[a]) * (px - x[a]);
+}
+
+static inline bool Inside(const OcclusionBuffer::Quad &quad, float sign, float px, float py)
+{
+	for (int i = 0; i < 4; i++)
+	{
+		if (Edge(quad._x, quad._y, i, (i + 1) & 3, px, py) * sign < 0.f)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+void OcclusionBuffer::AddOccluder(const Quad &quad)
+{
+	if (quad._outside)
+	{
+		return;
+	}
+
+	// winding depends on which side of the window faces us
+	float area = Edge(quad._x, quad._y, 0, 1, quad._x[2], quad._y[2]);
+	if (fabsf(area) < 1.f)
+	{
+		return;
+	}
+	float sign = area > 0.f? 1.f : -1.f;
+
+	// only cells with all four corners inside are covered for sure
+	for (int y = quad._y0; y <= quad._y1; y++)
+	{
+		float * row = _depth + y * OCCLUSION_SIZE;
+		for (int x = quad._x0; x <= quad._x1; x++)
+		{
+			if (row[x] <= quad._far)
+			{
+				continue;
+			}
+			if (Inside(quad, sign, x, y) && Inside(quad, sign, x + 1, y) &&
+				Inside(quad, sign, x, y + 1) && Inside(quad, sign, x + 1, y + 1))
+			{
+				row[x] = quad._far;
+			}
+		}
+	}
+}
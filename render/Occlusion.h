@@ -0,0 +1,42 @@
+#ifndef OCCLUSION_H
+#define OCCLUSION_H
+
+#include "Vector.h"
+#include "Matrix.h"
+
+#define OCCLUSION_SIZE 64
+
+// Coarse cpu depth buffer of window rectangles. Every cell keeps the depth of
+// the nearest occluder that covers it completely, measured at the occluder's
+// farthest corner, so testing against it never hides a visible window.
+
+class OcclusionBuffer
+{
+protected:
+	float _depth[OCCLUSION_SIZE * OCCLUSION_SIZE];
+	Matrix _clip;
+
+public:
+	struct Quad
+	{
+		float _x[4];
+		float _y[4];
+		float _near;
+		float _far;
+		int _x0;
+		int _y0;
+		int _x1;
+		int _y1;
+		bool _outside;
+	};
+
+	OcclusionBuffer();
+
+	void Clear(const Matrix &clip);
+
+	bool Project(const Matrix &world, float width, float height, Quad &quad);
+	bool IsOccluded(const Quad &quad);
+	void AddOccluder(const Quad &quad);
+};
+
+#endif//OCCLUSION_H
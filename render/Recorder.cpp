@@ -0,0 +1,360 @@
+
+#include <GL/glew.h>
+#include <stdlib.h>
+#include <string.h>
+#include "Recorder.h"
+
+// how long Stop waits for the last readbacks before giving up on them
+#define STOP_TIMEOUT 1000000000ULL
+
+Recorder::Recorder(int readbacks, int buffers)
+{
+	if (readbacks < 2)
+		readbacks = 2;
+	if (readbacks > RECORDER_MAX_READBACKS)
+		readbacks = RECORDER_MAX_READBACKS;
+	if (buffers < 1)
+		buffers = 1;
+	_readbacks = readbacks;
+	_nbuffers = buffers;
+	_next = 0;
+	_file = NULL;
+	_width = 0;
+	_height = 0;
+	_fbo = 0;
+	_target = 0;
+	for (int i = 0; i < RECORDER_MAX_READBACKS; i++)
+	{
+		_pack[i] = 0;
+		_fence[i] = 0;
+	}
+	_running = false;
+	_buffers = NULL;
+	_free = NULL;
+	_nfree = 0;
+	_queue = NULL;
+	_queue_head = 0;
+	_queue_count = 0;
+	_planes = NULL;
+	_captured = 0;
+	_written = 0;
+	_dropped_gpu = 0;
+	_dropped_disk = 0;
+	_failed = false;
+
+	pthread_mutex_init(&_mutex, NULL);
+	pthread_cond_init(&_cond, NULL);
+}
+
+Recorder::~Recorder()
+{
+	Stop();
+	pthread_cond_destroy(&_cond);
+	pthread_mutex_destroy(&_mutex);
+}
+
+bool Recorder::Start(const char * path, int width, int height, float period)
+{
+	// 4:4:4 has no subsampling constraints, only the halves need to match
+	_width = width & ~1;
+	_height = height;
+	if (_width <= 0 || _height <= 0)
+	{
+		fprintf(stderr, "recorder: bad size %dx%d\n", width, height);
+		return false;
+	}
+
+	_file = fopen(path, "wb");
+	if (!_file)
+	{
+		fprintf(stderr, "recorder: unable to open %s\n", path);
+		return false;
+	}
+	int fps = (int)(1.f / period + 0.5f);
+	fprintf(_file, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n", _width, _height, fps);
+
+	int size = _width * _height * 4;
+	_buffers = new unsigned char *[_nbuffers];
+	_free = new int[_nbuffers];
+	_queue = new int[_nbuffers];
+	for (int i = 0; i < _nbuffers; i++)
+	{
+		_buffers[i] = (unsigned char *)malloc(size);
+		_free[i] = i;
+	}
+	_nfree = _nbuffers;
+	_queue_head = 0;
+	_queue_count = 0;
+	_planes = (unsigned char *)malloc(_width * _height * 3);
+
+	glGenTextures(1, &_target);
+	glBindTexture(GL_TEXTURE_2D, _target);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, _width, _height, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	GLint draw_fbo;
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &draw_fbo);
+	glGenFramebuffers(1, &_fbo);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, _fbo);
+	glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, _target, 0);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, draw_fbo);
+
+	glGenBuffers(_readbacks, _pack);
+	for (int i = 0; i < _readbacks; i++)
+	{
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, _pack[i]);
+		glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	_running = true;
+	if (pthread_create(&_thread, NULL, Run, this))
+	{
+		_running = false;
+		fprintf(stderr, "recorder: unable to start the writer thread\n");
+		return false;
+	}
+	printf("  recording %dx%d at %d fps to %s\n", _width, _height, fps, path);
+	return true;
+}
+
+void Recorder::Stop()
+{
+	if (!_running)
+	{
+		return;
+	}
+
+	// whatever is still in flight, oldest first, nothing renders anymore
+	for (int i = 0; i < _readbacks; i++)
+	{
+		int slot = (_next + i) % _readbacks;
+		if (_fence[slot])
+		{
+			GLenum status = glClientWaitSync(_fence[slot], GL_SYNC_FLUSH_COMMANDS_BIT, STOP_TIMEOUT);
+			if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED)
+			{
+				Harvest(slot);
+			}
+			else
+			{
+				glDeleteSync(_fence[slot]);
+				_fence[slot] = 0;
+				_dropped_gpu++;
+			}
+		}
+	}
+
+	// the writer drains the queue before it leaves
+	pthread_mutex_lock(&_mutex);
+	_running = false;
+	pthread_cond_signal(&_cond);
+	pthread_mutex_unlock(&_mutex);
+	pthread_join(_thread, NULL);
+
+	fclose(_file);
+	_file = NULL;
+
+	glDeleteBuffers(_readbacks, _pack);
+	glDeleteFramebuffers(1, &_fbo);
+	glDeleteTextures(1, &_target);
+	for (int i = 0; i < _readbacks; i++)
+	{
+		_pack[i] = 0;
+	}
+	_fbo = 0;
+	_target = 0;
+
+	for (int i = 0; i < _nbuffers; i++)
+	{
+		free(_buffers[i]);
+	}
+	delete [] _buffers;
+	delete [] _free;
+	delete [] _queue;
+	free(_planes);
+	_buffers = NULL;
+	_free = NULL;
+	_queue = NULL;
+	_planes = NULL;
+}
+
+void Recorder::Capture(const GLuint * framebuffers, int eye_width, int eye_height)
+{
+	if (!_running)
+	{
+		return;
+	}
+	_captured++;
+
+	// readbacks complete in order, take whatever is done without waiting
+	for (int i = 0; i < _readbacks; i++)
+	{
+		int slot = (_next + i) % _readbacks;
+		if (!_fence[slot])
+		{
+			continue;
+		}
+		GLenum status = glClientWaitSync(_fence[slot], 0, 0);
+		if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+		{
+			break;
+		}
+		Harvest(slot);
+	}
+
+	// every buffer still on its way back, the gpu is the one behind
+	if (_fence[_next])
+	{
+		_dropped_gpu++;
+		return;
+	}
+
+	// called from anywhere in the frame, leave the bindings as they were
+	GLint read_fbo, draw_fbo;
+	glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &read_fbo);
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &draw_fbo);
+	GLboolean scissor = glIsEnabled(GL_SCISSOR_TEST);
+	glDisable(GL_SCISSOR_TEST);
+
+	int half = _width / 2;
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, _fbo);
+	for (int eye = 0; eye < 2; eye++)
+	{
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffers[eye]);
+		glBlitFramebuffer(0, 0, eye_width, eye_height, eye * half, 0, (eye + 1) * half, _height,
+				GL_COLOR_BUFFER_BIT, GL_LINEAR);
+	}
+
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, _fbo);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, _pack[_next]);
+	glReadPixels(0, 0, _width, _height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	_fence[_next] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	_next = (_next + 1) % _readbacks;
+
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, read_fbo);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, draw_fbo);
+	if (scissor)
+	{
+		glEnable(GL_SCISSOR_TEST);
+	}
+}
+
+// Called on the render thread once the slot's fence passed, never blocks.
+void Recorder::Harvest(int slot)
+{
+	glDeleteSync(_fence[slot]);
+	_fence[slot] = 0;
+
+	// the writer counts its drops too, so under the lock
+	pthread_mutex_lock(&_mutex);
+	int index = _nfree? _free[--_nfree] : -1;
+	if (index < 0)
+	{
+		// the disk is behind and every buffer is queued
+		_dropped_disk++;
+	}
+	pthread_mutex_unlock(&_mutex);
+	if (index < 0)
+	{
+		return;
+	}
+
+	int size = _width * _height * 4;
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, _pack[slot]);
+	const void * pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+	bool mapped = pixels != NULL;
+	if (mapped)
+	{
+		memcpy(_buffers[index], pixels, size);
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	pthread_mutex_lock(&_mutex);
+	if (mapped)
+	{
+		_queue[(_queue_head + _queue_count) % _nbuffers] = index;
+		_queue_count++;
+		pthread_cond_signal(&_cond);
+	}
+	else
+	{
+		_free[_nfree++] = index;
+		_dropped_gpu++;
+	}
+	pthread_mutex_unlock(&_mutex);
+}
+
+void * Recorder::Run(void * self)
+{
+	((Recorder *)self)->Loop();
+	return NULL;
+}
+
+void Recorder::Loop()
+{
+	pthread_mutex_lock(&_mutex);
+	for (;;)
+	{
+		while (_running && !_queue_count)
+		{
+			pthread_cond_wait(&_cond, &_mutex);
+		}
+		if (!_queue_count)
+		{
+			break;
+		}
+		int index = _queue[_queue_head];
+		_queue_head = (_queue_head + 1) % _nbuffers;
+		_queue_count--;
+		pthread_mutex_unlock(&_mutex);
+
+		bool written = !_failed && Write(_buffers[index]);
+
+		pthread_mutex_lock(&_mutex);
+		_free[_nfree++] = index;
+		if (written)
+		{
+			_written++;
+		}
+		else
+		{
+			_dropped_disk++;
+		}
+	}
+	pthread_mutex_unlock(&_mutex);
+}
+
+// Converts a bottom up RGBA frame to top down BT.601 studio range planes.
+bool Recorder::Write(const unsigned char * rgba)
+{
+	int pixels = _width * _height;
+	unsigned char * py = _planes;
+	unsigned char * pu = _planes + pixels;
+	unsigned char * pv = _planes + pixels * 2;
+	for (int y = 0; y < _height; y++)
+	{
+		const unsigned char * src = rgba + (_height - 1 - y) * _width * 4;
+		for (int x = 0; x < _width; x++, src += 4)
+		{
+			int r = src[0];
+			int g = src[1];
+			int b = src[2];
+			*py++ = (unsigned char)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+			*pu++ = (unsigned char)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+			*pv++ = (unsigned char)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+		}
+	}
+
+	if (fwrite("FRAME\n", 1, 6, _file) != 6 || fwrite(_planes, 1, pixels * 3, _file) != (size_t)(pixels * 3))
+	{
+		fprintf(stderr, "recorder: write failed, dropping the rest\n");
+		_failed = true;
+		return false;
+	}
+	return true;
+}
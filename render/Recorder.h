@@ -0,0 +1,72 @@
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include <pthread.h>
+#include <stdio.h>
+
+#define RECORDER_MAX_READBACKS 4
+
+// Records the eyes side by side to a Y4M stream. Each frame is scaled into a
+// fixed size target and read into a pixel pack buffer, which is only mapped
+// once its fence passed a frame or two later. A writer thread converts and
+// writes, when it falls behind frames are dropped rather than waited for.
+
+class Recorder
+{
+protected:
+	FILE * _file;
+	int _width;
+	int _height;
+
+	GLuint _fbo;
+	GLuint _target;
+	GLuint _pack[RECORDER_MAX_READBACKS];
+	GLsync _fence[RECORDER_MAX_READBACKS];
+	int _readbacks;
+	int _next;
+
+	// filled frames travel from _free to _queue and back through the writer
+	pthread_t _thread;
+	pthread_mutex_t _mutex;
+	pthread_cond_t _cond;
+	bool _running;
+	unsigned char ** _buffers;
+	int _nbuffers;
+	int * _free;
+	int _nfree;
+	int * _queue;
+	int _queue_head;
+	int _queue_count;
+	unsigned char * _planes;
+
+	int _captured;
+	int _written;
+	int _dropped_gpu;
+	int _dropped_disk;
+	bool _failed;
+
+	static void * Run(void * self);
+	void Loop();
+	void Harvest(int slot);
+	bool Write(const unsigned char * rgba);
+
+public:
+	Recorder(int readbacks = 3, int buffers = 8);
+	~Recorder();
+
+	bool Start(const char * path, int width, int height, float period);
+	void Stop();
+
+	// scales the used corner of each eye framebuffer into one half of the frame
+	void Capture(const GLuint * framebuffers, int eye_width, int eye_height);
+
+	int width() { return _width; }
+	int height() { return _height; }
+	int captured() { return _captured; }
+	int written() { return _written; }
+	int dropped() { return _dropped_gpu + _dropped_disk; }
+	int dropped_gpu() { return _dropped_gpu; }
+	int dropped_disk() { return _dropped_disk; }
+};
+
+#endif//RECORDER_H
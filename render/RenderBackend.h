@@ -0,0 +1,41 @@
+#ifndef RENDERBACKEND_H
+#define RENDERBACKEND_H
+
+#include "Vector.h"
+#include "Matrix.h"
+
+// What the window model needs from a renderer: images for the window tiles,
+// staging memory to capture into, and a way to draw an image as a quad.
+// Images are opaque handles, 0 is never a valid one.
+
+class RenderBackend
+{
+public:
+	virtual ~RenderBackend() {}
+
+	virtual const char * name() = 0;
+
+	// largest image a single tile may use
+	virtual int max_image_size() = 0;
+	// what an image of this size costs, for the texture budget
+	virtual int ImageBytes(int width, int height) = 0;
+
+	virtual unsigned int CreateImage(int width, int height) = 0;
+	virtual void DestroyImage(unsigned int image) = 0;
+
+	// Write only staging memory for a capture of size bytes, NULL when there
+	// is none left this frame and the caller has to use its own memory.
+	virtual void * MapUpload(int size) = 0;
+	// done writing, returns what to pass on as pixels to UploadImage
+	virtual const void * UnmapUpload() = 0;
+	// copies width x height at x,y of the image from rows of row_length pixels
+	virtual void UploadImage(unsigned int image, int x, int y, int width, int height,
+			const void * pixels, int row_length, int bytes_per_pixel) = 0;
+	// after the last UploadImage of a capture, mapped upload or not
+	virtual void EndUpload() = 0;
+
+	// rect is x, y, x2, y2 in window units, the image is stretched over it
+	virtual void DrawImage(unsigned int image, const Matrix &model, const float * rect) = 0;
+};
+
+#endif//RENDERBACKEND_H
@@ -0,0 +1,284 @@
+
+#include <GL/glew.h>
+#include <stdio.h>
+#include <string.h>
+#include "Clock.h"
+#include "Reprojector.h"
+
+Reprojector::Reprojector(BindContext bind, GetView get_view, Present present)
+{
+	_bind = bind;
+	_get_view = get_view;
+	_present = present;
+	_running = false;
+	_width = 0;
+	_height = 0;
+	memset(_source, 0, sizeof(_source));
+	memset(_target, 0, sizeof(_target));
+	_fbo = 0;
+	_ready[0] = 0;
+	_ready[1] = 0;
+	_u[0] = _u[1] = 1.f;
+	_v[0] = _v[1] = 1.f;
+	_frame[0] = _frame[1] = 0;
+	_stored_ns[0] = _stored_ns[1] = 0;
+	_front = 0;
+	_busy = -1;
+	_stored = false;
+	_period_ns = 0;
+	_deadline_ns = 0;
+	_stores = 0;
+	_reprojected = 0;
+	_skipped = 0;
+
+	pthread_mutex_init(&_mutex, NULL);
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&_cond, &attr);
+	pthread_condattr_destroy(&attr);
+}
+
+Reprojector::~Reprojector()
+{
+	Stop();
+	pthread_cond_destroy(&_cond);
+	pthread_mutex_destroy(&_mutex);
+}
+
+// Called on the render thread, allocates the copies in the shared namespace.
+bool Reprojector::Start(int width, int height, float period)
+{
+	_width = width;
+	_height = height;
+	_period_ns = (long long)(period * 1000000000.0);
+
+	glGenTextures(4, &_source[0][0]);
+	glGenTextures(2, _target);
+	GLuint * textures[2] = { &_source[0][0], _target };
+	int counts[2] = { 4, 2 };
+	for (int j = 0; j < 2; j++)
+	{
+		for (int i = 0; i < counts[j]; i++)
+		{
+			glBindTexture(GL_TEXTURE_2D, textures[j][i]);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, _width, _height, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+		}
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+	// the other context only sees complete objects after a flush
+	glFlush();
+
+	_running = true;
+	if (pthread_create(&_thread, NULL, Run, this))
+	{
+		_running = false;
+		fprintf(stderr, "reprojection: unable to start the thread\n");
+		return false;
+	}
+	return true;
+}
+
+void Reprojector::Stop()
+{
+	if (!_running)
+	{
+		return;
+	}
+	pthread_mutex_lock(&_mutex);
+	_running = false;
+	pthread_cond_signal(&_cond);
+	pthread_mutex_unlock(&_mutex);
+	pthread_join(_thread, NULL);
+
+	for (int i = 0; i < 2; i++)
+	{
+		if (_ready[i])
+		{
+			glDeleteSync(_ready[i]);
+			_ready[i] = 0;
+		}
+	}
+	glDeleteTextures(4, &_source[0][0]);
+	glDeleteTextures(2, _target);
+}
+
+// Called on the render thread once both eyes are drawn.
+void Reprojector::Store(GLuint * eyes, const Matrix * proj, const Matrix * view, float u, float v, int frame)
+{
+	if (!_running)
+	{
+		return;
+	}
+
+	// only the front set is ever read by the thread, the back one is ours
+	// unless a warp that started before the last Store is still running
+	pthread_mutex_lock(&_mutex);
+	int back = 1 - _front;
+	bool busy = _busy == back;
+	pthread_mutex_unlock(&_mutex);
+	if (busy)
+	{
+		_skipped++;
+		return;
+	}
+
+	int width = (int)(_width * u + 0.5f);
+	int height = (int)(_height * v + 0.5f);
+	for (int eye = 0; eye < 2; eye++)
+	{
+		glCopyImageSubData(eyes[eye], GL_TEXTURE_2D, 0, 0, 0, 0,
+				_source[back][eye], GL_TEXTURE_2D, 0, 0, 0, 0, width, height, 1);
+	}
+	if (_ready[back])
+	{
+		glDeleteSync(_ready[back]);
+	}
+	_ready[back] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	glFlush();
+
+	pthread_mutex_lock(&_mutex);
+	for (int eye = 0; eye < 2; eye++)
+	{
+		_proj[back][eye] = proj[eye];
+		_view[back][eye] = view[eye];
+	}
+	_u[back] = u;
+	_v[back] = v;
+	_frame[back] = frame;
+	_stored_ns[back] = GetTimeNs();
+	_front = back;
+	_stored = true;
+	_deadline_ns = GetTimeNs() + _period_ns + _period_ns / 2;
+	_stores++;
+	pthread_cond_signal(&_cond);
+	pthread_mutex_unlock(&_mutex);
+}
+
+void * Reprojector::Run(void * self)
+{
+	((Reprojector *)self)->Loop();
+	return NULL;
+}
+
+void Reprojector::Loop()
+{
+	if (!_bind || !_bind())
+	{
+		fprintf(stderr, "reprojection: no shared context\n");
+		return;
+	}
+	glGenFramebuffers(1, &_fbo);
+
+	pthread_mutex_lock(&_mutex);
+	while (_running)
+	{
+		unsigned int stores = _stores;
+		long long wake = _stored? _deadline_ns : GetTimeNs() + _period_ns;
+		timespec ts;
+		ts.tv_sec = wake / 1000000000LL;
+		ts.tv_nsec = wake % 1000000000LL;
+		pthread_cond_timedwait(&_cond, &_mutex, &ts);
+
+		if (!_running || !_stored || _stores != stores || GetTimeNs() < _deadline_ns)
+		{
+			continue;
+		}
+
+		// the render thread missed its deadline, show the last frame re-warped
+		int set = _front;
+		_busy = set;
+		_deadline_ns += _period_ns;
+		pthread_mutex_unlock(&_mutex);
+
+		bool warped = Warp(set);
+
+		pthread_mutex_lock(&_mutex);
+		_busy = -1;
+		if (warped)
+		{
+			_reprojected++;
+		}
+	}
+	pthread_mutex_unlock(&_mutex);
+
+	glDeleteFramebuffers(1, &_fbo);
+}
+
+// pure rotation part of a view, the eye views carry translation and scale
+static Matrix Rotation(const Matrix &m)
+{
+	Matrix r = m;
+	r.right().normalize();
+	r.up().normalize();
+	r.back().normalize();
+	r.translation() = Vector4(0.f, 0.f, 0.f, 1.f);
+	return r;
+}
+
+bool Reprojector::Warp(int set)
+{
+	glWaitSync(_ready[set], 0, GL_TIMEOUT_IGNORED);
+
+	float u = _u[set];
+	float v = _v[set];
+	glBindFramebuffer(GL_FRAMEBUFFER, _fbo);
+	glViewport(0, 0, (int)(_width * u + 0.5f), (int)(_height * v + 0.5f));
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_BLEND);
+	glEnable(GL_TEXTURE_2D);
+	glColor4f(1.f, 1.f, 1.f, 1.f);
+	glClearColor(0.f, 0.f, 0.f, 1.f);
+
+	for (int eye = 0; eye < 2; eye++)
+	{
+		Matrix view;
+		if (!_get_view || !_get_view(eye, _frame[set], _stored_ns[set], view))
+		{
+			glBindFramebuffer(GL_FRAMEBUFFER, 0);
+			return false;
+		}
+
+		// from the eye space it was rendered in to the newest one
+		Matrix inv = Rotation(view);
+		inv.FastInverse();
+		Matrix delta = inv * Rotation(_view[set][eye]);
+
+		// the old image plane at z = -1, a rotation is a homography of it
+		const float * p = _proj[set][eye]._m;
+		float l = (-1.f + p[8]) / p[0];
+		float r = (1.f + p[8]) / p[0];
+		float b = (-1.f + p[9]) / p[5];
+		float t = (1.f + p[9]) / p[5];
+		float verts[] =
+		{
+			l, b, -1.f, 0.f, 0.f,
+			r, b, -1.f, u, 0.f,
+			r, t, -1.f, u, v,
+			l, t, -1.f, 0.f, v,
+		};
+
+		glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, _target[eye], 0);
+		glClear(GL_COLOR_BUFFER_BIT);
+
+		glMatrixMode(GL_PROJECTION);
+		glLoadMatrixf(_proj[set][eye]._m);
+		glMatrixMode(GL_MODELVIEW);
+		glLoadMatrixf(delta._m);
+
+		glBindTexture(GL_TEXTURE_2D, _source[set][eye]);
+		glEnableClientState(GL_VERTEX_ARRAY);
+		glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+		glVertexPointer(3, GL_FLOAT, 5 * 4, verts);
+		glTexCoordPointer(2, GL_FLOAT, 5 * 4, verts + 3);
+		glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	// this thread exists to block, the render thread never waits on it
+	glFinish();
+
+	return !_present || _present(_target, u, v);
+}
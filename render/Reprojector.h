@@ -0,0 +1,77 @@
+#ifndef REPROJECTOR_H
+#define REPROJECTOR_H
+
+#include <pthread.h>
+#include "Vector.h"
+#include "Matrix.h"
+
+// Keeps the last rendered eyes with the views they were rendered from and,
+// on its own thread and GL context, re-warps them by rotation to the newest
+// head pose whenever the main loop misses its deadline.
+
+class Reprojector
+{
+public:
+	// makes a context sharing objects with the renderer current on this thread
+	typedef bool (*BindContext)();
+	// newest eye-to-world view for eye, as passed to Store, with the frame
+	// and time of the Store being warped
+	typedef bool (*GetView)(int eye, int frame, long long stored_ns, Matrix &view);
+	// hands warped eyes to the display, called on the reprojection thread with
+	// the part of them that was rendered to, false if the display refused them
+	typedef bool (*Present)(GLuint * eyes, float u, float v);
+
+protected:
+	BindContext _bind;
+	GetView _get_view;
+	Present _present;
+
+	pthread_t _thread;
+	pthread_mutex_t _mutex;
+	pthread_cond_t _cond;
+	bool _running;
+
+	int _width;
+	int _height;
+	GLuint _source[2][2];
+	GLuint _target[2];
+	GLuint _fbo;
+	GLsync _ready[2];
+	int _front;
+	int _busy;
+	bool _stored;
+
+	// per set like the sources, the thread only reads the one it picked
+	Matrix _proj[2][2];
+	Matrix _view[2][2];
+	// the part of the sources the eyes were rendered to, and the targets warped to
+	float _u[2];
+	float _v[2];
+	int _frame[2];
+	long long _stored_ns[2];
+
+	long long _period_ns;
+	long long _deadline_ns;
+	unsigned int _stores;
+
+	int _reprojected;
+	int _skipped;
+
+	static void * Run(void * self);
+	void Loop();
+	bool Warp(int set);
+
+public:
+	Reprojector(BindContext bind, GetView get_view, Present present);
+	~Reprojector();
+
+	bool Start(int width, int height, float period);
+	void Stop();
+
+	void Store(GLuint * eyes, const Matrix * proj, const Matrix * view, float u = 1.f, float v = 1.f, int frame = 0);
+
+	int reprojected() { return _reprojected; }
+	int skipped() { return _skipped; }
+};
+
+#endif//REPROJECTOR_H
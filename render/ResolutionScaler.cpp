@@ -0,0 +1,153 @@
+#include <GL/glew.h>
+#include <math.h>
+#include "ResolutionScaler.h"
+
+// the gpu share of the frame that is aimed for, the rest is capture and input
+#define SCALE_TARGET 0.7f
+// scale up only after this many frames comfortably under the target
+#define SCALE_CALM_FRAMES 30
+#define SCALE_STEP 0.02f
+
+ResolutionScaler::ResolutionScaler(float min_scale, float max_scale)
+{
+	if (min_scale <= 0.f)
+		min_scale = 0.1f;
+	if (max_scale < min_scale)
+		max_scale = min_scale;
+	_min = min_scale;
+	_max = max_scale;
+	_scale = 1.f < _min? _min : 1.f > _max? _max : 1.f;
+	_budget_ms = 1000.f / 60.f;
+	_base_width = 0;
+	_base_height = 0;
+	for (int i = 0; i < RESOLUTIONSCALER_QUERIES; i++)
+	{
+		_query[i] = 0;
+	}
+	_issued = 0;
+	_read = 0;
+	_in_query = false;
+	_gpu_ms = 0.f;
+	_calm = 0;
+	ResetStats();
+}
+
+ResolutionScaler::~ResolutionScaler()
+{
+	if (_query[0])
+	{
+		glDeleteQueries(RESOLUTIONSCALER_QUERIES, _query);
+	}
+}
+
+void ResolutionScaler::Initialize(int base_width, int base_height)
+{
+	_base_width = base_width;
+	_base_height = base_height;
+	if (GLEW_ARB_timer_query)
+	{
+		glGenQueries(RESOLUTIONSCALER_QUERIES, _query);
+	}
+}
+
+int ResolutionScaler::width()
+{
+	int w = (int)(_base_width * _scale + 0.5f);
+	return w < 1? 1 : w;
+}
+
+int ResolutionScaler::height()
+{
+	int h = (int)(_base_height * _scale + 0.5f);
+	return h < 1? 1 : h;
+}
+
+void ResolutionScaler::BeginGpu()
+{
+	// all queries still pending, skip measuring this frame
+	if (!_query[0] || _issued - _read >= RESOLUTIONSCALER_QUERIES)
+	{
+		return;
+	}
+	glBeginQuery(GL_TIME_ELAPSED, _query[_issued % RESOLUTIONSCALER_QUERIES]);
+	_in_query = true;
+}
+
+void ResolutionScaler::EndGpu()
+{
+	if (!_in_query)
+	{
+		return;
+	}
+	glEndQuery(GL_TIME_ELAPSED);
+	_in_query = false;
+	_issued++;
+}
+
+// frame_ms is the whole frame as the cpu saw it, including the fence wait.
+// Only the gpu time of the eye passes steers the scale, a frame that is slow
+// because of captures doesn't get any faster by rendering fewer pixels.
+void ResolutionScaler::EndFrame(float frame_ms)
+{
+	if (frame_ms > _budget_ms)
+		_stat_misses++;
+	else
+		_stat_hits++;
+
+	while (_read < _issued)
+	{
+		GLuint query = _query[_read % RESOLUTIONSCALER_QUERIES];
+		GLint available = 0;
+		glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available)
+		{
+			break;
+		}
+		GLuint64 ns = 0;
+		glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns);
+		_read++;
+		_gpu_ms = ns / 1000000.f;
+		Adjust(_gpu_ms);
+	}
+
+	if (_scale < _stat_min_scale)
+		_stat_min_scale = _scale;
+	if (_scale > _stat_max_scale)
+		_stat_max_scale = _scale;
+}
+
+void ResolutionScaler::Adjust(float gpu_ms)
+{
+	float target = _budget_ms * SCALE_TARGET;
+	if (gpu_ms > target)
+	{
+		// gpu time goes with the pixel count, so with the square of the scale
+		_scale *= sqrtf(target / gpu_ms);
+		_calm = 0;
+	}
+	else if (gpu_ms < target * 0.7f)
+	{
+		if (++_calm >= SCALE_CALM_FRAMES)
+		{
+			_scale += SCALE_STEP;
+			_calm = 0;
+		}
+	}
+	else
+	{
+		_calm = 0;
+	}
+
+	if (_scale < _min)
+		_scale = _min;
+	if (_scale > _max)
+		_scale = _max;
+}
+
+void ResolutionScaler::ResetStats()
+{
+	_stat_hits = 0;
+	_stat_misses = 0;
+	_stat_min_scale = _scale;
+	_stat_max_scale = _scale;
+}
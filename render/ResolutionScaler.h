@@ -0,0 +1,72 @@
+#ifndef RESOLUTIONSCALER_H
+#define RESOLUTIONSCALER_H
+
+#define RESOLUTIONSCALER_QUERIES 4
+
+// Scales the eye viewport with the measured gpu time of the eye passes. The
+// targets are allocated once at the largest scale and only a sub-rectangle
+// of them is rendered to, so changing the scale never reallocates anything.
+
+class ResolutionScaler
+{
+protected:
+	float _min;
+	float _max;
+	float _scale;
+	float _budget_ms;
+
+	int _base_width;
+	int _base_height;
+
+	// time elapsed queries read back a few frames late, never stalling
+	GLuint _query[RESOLUTIONSCALER_QUERIES];
+	int _issued;
+	int _read;
+	bool _in_query;
+	float _gpu_ms;
+	int _calm;
+
+	// accumulated since the last ResetStats
+	int _stat_hits;
+	int _stat_misses;
+	float _stat_min_scale;
+	float _stat_max_scale;
+
+	void Adjust(float gpu_ms);
+
+public:
+	ResolutionScaler(float min_scale = 1.f, float max_scale = 1.f);
+	~ResolutionScaler();
+
+	void Initialize(int base_width, int base_height);
+	void SetPeriod(float period) { _budget_ms = period * 1000.f; }
+
+	// the eye size at scale 1
+	int base_width() { return _base_width; }
+	int base_height() { return _base_height; }
+
+	// the allocation size of the eye targets
+	int target_width() { return (int)(_base_width * _max + 0.5f); }
+	int target_height() { return (int)(_base_height * _max + 0.5f); }
+
+	// the part of the targets rendered to at the current scale
+	int width();
+	int height();
+	float u() { return width() / (float)target_width(); }
+	float v() { return height() / (float)target_height(); }
+
+	void BeginGpu();
+	void EndGpu();
+	void EndFrame(float frame_ms);
+
+	float scale() { return _scale; }
+	float gpu_ms() { return _gpu_ms; }
+
+	int stat_hits() { return _stat_hits; }
+	int stat_misses() { return _stat_misses; }
+	float stat_min_scale() { return _stat_min_scale; }
+	float stat_max_scale() { return _stat_max_scale; }
+	void ResetStats();
+};
+
+#endif//RESOLUTIONSCALER_H
@@ -0,0 +1,986 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "Clock.h"
+#include "VulkanBackend.h"
+
+// captures start on texel boundaries, which bufferOffset needs
+#define STAGING_ALIGN 16
+#define VULKAN_MAX_IMAGES 4096
+
+// GL clip space to Vulkan's, depth goes from -1..1 to 0..1. Y is left alone
+// so the eyes end up bottom row first in memory, just like a GL framebuffer.
+static const float s_gl_to_vulkan[16] =
+{
+	1.f, 0.f, 0.f, 0.f,
+	0.f, 1.f, 0.f, 0.f,
+	0.f, 0.f, 0.5f, 0.f,
+	0.f, 0.f, 0.5f, 1.f,
+};
+
+// what the vertex shader reads, the quad is built from gl_VertexIndex
+struct QuadConstants
+{
+	float _mvp[16];
+	float _rect[4];
+};
+
+VulkanBackend::VulkanBackend(int frames, int staging_size)
+{
+	if (frames < 1)
+		frames = 1;
+	if (frames > VULKAN_MAX_FRAMES)
+		frames = VULKAN_MAX_FRAMES;
+	_frames = frames;
+	_slot = 0;
+	_frame = 0;
+	_recording = false;
+	_in_pass = false;
+
+	_instance = VK_NULL_HANDLE;
+	_physical = VK_NULL_HANDLE;
+	_device = VK_NULL_HANDLE;
+	_queue = VK_NULL_HANDLE;
+	_queue_family = 0;
+	_max_size = 4096;
+
+	_timeline = VK_NULL_HANDLE;
+	_command_pool = VK_NULL_HANDLE;
+	for (int i = 0; i < VULKAN_MAX_FRAMES; i++)
+	{
+		_cmd[i] = VK_NULL_HANDLE;
+		_staging[i] = VK_NULL_HANDLE;
+		_staging_memory[i] = VK_NULL_HANDLE;
+		_staging_data[i] = NULL;
+	}
+	_staging_size = staging_size;
+	_staging_used = 0;
+	_mapped_offset = 0;
+
+	_width = 0;
+	_height = 0;
+	_depth_format = VK_FORMAT_UNDEFINED;
+	for (int i = 0; i < 2; i++)
+	{
+		_color[i] = VK_NULL_HANDLE;
+		_color_memory[i] = VK_NULL_HANDLE;
+		_color_view[i] = VK_NULL_HANDLE;
+		_framebuffer[i] = VK_NULL_HANDLE;
+	}
+	_depth = VK_NULL_HANDLE;
+	_depth_memory = VK_NULL_HANDLE;
+	_depth_view = VK_NULL_HANDLE;
+	_render_pass = VK_NULL_HANDLE;
+
+	_set_layout = VK_NULL_HANDLE;
+	_descriptor_pool = VK_NULL_HANDLE;
+	_sampler = VK_NULL_HANDLE;
+	_pipeline_layout = VK_NULL_HANDLE;
+	_pipeline = VK_NULL_HANDLE;
+
+	_images = NULL;
+	_nimages = 0;
+
+	_wait_ns = 0;
+	_dropped_uploads = 0;
+}
+
+VulkanBackend::~VulkanBackend()
+{
+	if (_device)
+	{
+		vkDeviceWaitIdle(_device);
+
+		for (int i = 0; i < _nimages; i++)
+		{
+			if (_images[i]._used)
+			{
+				_images[i]._release = 1;
+			}
+		}
+		ReleaseImages(~0ULL);
+		free(_images);
+
+		vkDestroyPipeline(_device, _pipeline, NULL);
+		vkDestroyPipelineLayout(_device, _pipeline_layout, NULL);
+		vkDestroySampler(_device, _sampler, NULL);
+		vkDestroyDescriptorPool(_device, _descriptor_pool, NULL);
+		vkDestroyDescriptorSetLayout(_device, _set_layout, NULL);
+
+		for (int i = 0; i < 2; i++)
+		{
+			vkDestroyFramebuffer(_device, _framebuffer[i], NULL);
+			vkDestroyImageView(_device, _color_view[i], NULL);
+			vkDestroyImage(_device, _color[i], NULL);
+			vkFreeMemory(_device, _color_memory[i], NULL);
+		}
+		vkDestroyImageView(_device, _depth_view, NULL);
+		vkDestroyImage(_device, _depth, NULL);
+		vkFreeMemory(_device, _depth_memory, NULL);
+		vkDestroyRenderPass(_device, _render_pass, NULL);
+
+		for (int i = 0; i < _frames; i++)
+		{
+			vkDestroyBuffer(_device, _staging[i], NULL);
+			vkFreeMemory(_device, _staging_memory[i], NULL);
+		}
+		vkDestroyCommandPool(_device, _command_pool, NULL);
+		vkDestroySemaphore(_device, _timeline, NULL);
+		vkDestroyDevice(_device, NULL);
+	}
+	if (_instance)
+	{
+		vkDestroyInstance(_instance, NULL);
+	}
+}
+
+bool VulkanBackend::Initialize(int eye_width, int eye_height)
+{
+	_width = eye_width;
+	_height = eye_height;
+
+	if (!CreateDevice() || !CreateTargets() || !CreatePipeline())
+	{
+		return false;
+	}
+
+	// uploads before the first frame still need somewhere to go
+	Record();
+	return true;
+}
+
+bool VulkanBackend::CreateDevice()
+{
+	VkApplicationInfo app = {};
+	app.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+	app.pApplicationName = "x3d";
+	app.apiVersion = VK_API_VERSION_1_2;
+
+	VkInstanceCreateInfo instance_info = {};
+	instance_info.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+	instance_info.pApplicationInfo = &app;
+	VkResult result = vkCreateInstance(&instance_info, NULL, &_instance);
+	if (result != VK_SUCCESS)
+	{
+		fprintf(stderr, "vulkan: vkCreateInstance failed %d\n", result);
+		return false;
+	}
+
+	uint32_t count = 0;
+	vkEnumeratePhysicalDevices(_instance, &count, NULL);
+	VkPhysicalDevice * devices = (VkPhysicalDevice*)malloc(sizeof(VkPhysicalDevice) * (count? count : 1));
+	vkEnumeratePhysicalDevices(_instance, &count, devices);
+	// the first one with a graphics queue, on a headless box that is lavapipe
+	for (uint32_t i = 0; i < count && !_physical; i++)
+	{
+		uint32_t nfamilies = 0;
+		vkGetPhysicalDeviceQueueFamilyProperties(devices[i], &nfamilies, NULL);
+		VkQueueFamilyProperties * families = (VkQueueFamilyProperties*)malloc(sizeof(VkQueueFamilyProperties) * (nfamilies? nfamilies : 1));
+		vkGetPhysicalDeviceQueueFamilyProperties(devices[i], &nfamilies, families);
+		for (uint32_t j = 0; j < nfamilies; j++)
+		{
+			if (families[j].queueFlags & VK_QUEUE_GRAPHICS_BIT)
+			{
+				_physical = devices[i];
+				_queue_family = j;
+				break;
+			}
+		}
+		free(families);
+	}
+	free(devices);
+	if (!_physical)
+	{
+		fprintf(stderr, "vulkan: no device with a graphics queue\n");
+		return false;
+	}
+
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(_physical, &properties);
+	vkGetPhysicalDeviceMemoryProperties(_physical, &_memory_properties);
+	_max_size = properties.limits.maxImageDimension2D;
+	printf("  vulkan %d.%d %s\n", VK_VERSION_MAJOR(properties.apiVersion), VK_VERSION_MINOR(properties.apiVersion),
+			properties.deviceName);
+
+	float priority = 1.f;
+	VkDeviceQueueCreateInfo queue_info = {};
+	queue_info.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+	queue_info.queueFamilyIndex = _queue_family;
+	queue_info.queueCount = 1;
+	queue_info.pQueuePriorities = &priority;
+
+	VkPhysicalDeviceVulkan12Features features12 = {};
+	features12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+	features12.timelineSemaphore = VK_TRUE;
+
+	VkDeviceCreateInfo device_info = {};
+	device_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+	device_info.pNext = &features12;
+	device_info.queueCreateInfoCount = 1;
+	device_info.pQueueCreateInfos = &queue_info;
+	result = vkCreateDevice(_physical, &device_info, NULL, &_device);
+	if (result != VK_SUCCESS)
+	{
+		fprintf(stderr, "vulkan: vkCreateDevice failed %d, timeline semaphores needed\n", result);
+		return false;
+	}
+	vkGetDeviceQueue(_device, _queue_family, 0, &_queue);
+
+	VkSemaphoreTypeCreateInfo type_info = {};
+	type_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+	type_info.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+	type_info.initialValue = 0;
+	VkSemaphoreCreateInfo semaphore_info = {};
+	semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+	semaphore_info.pNext = &type_info;
+	vkCreateSemaphore(_device, &semaphore_info, NULL, &_timeline);
+
+	VkCommandPoolCreateInfo pool_info = {};
+	pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	pool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+	pool_info.queueFamilyIndex = _queue_family;
+	vkCreateCommandPool(_device, &pool_info, NULL, &_command_pool);
+
+	VkCommandBufferAllocateInfo cmd_info = {};
+	cmd_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	cmd_info.commandPool = _command_pool;
+	cmd_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	cmd_info.commandBufferCount = _frames;
+	vkAllocateCommandBuffers(_device, &cmd_info, _cmd);
+
+	// persistently mapped, coherent, so there is nothing to flush by hand
+	for (int i = 0; i < _frames; i++)
+	{
+		VkBufferCreateInfo buffer_info = {};
+		buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+		buffer_info.size = _staging_size;
+		buffer_info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+		buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		vkCreateBuffer(_device, &buffer_info, NULL, &_staging[i]);
+
+		VkMemoryRequirements requirements;
+		vkGetBufferMemoryRequirements(_device, _staging[i], &requirements);
+		int type = FindMemory(requirements.memoryTypeBits,
+				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+		if (type < 0)
+		{
+			fprintf(stderr, "vulkan: no host visible memory for staging\n");
+			return false;
+		}
+		VkMemoryAllocateInfo alloc_info = {};
+		alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+		alloc_info.allocationSize = requirements.size;
+		alloc_info.memoryTypeIndex = type;
+		if (vkAllocateMemory(_device, &alloc_info, NULL, &_staging_memory[i]) != VK_SUCCESS)
+		{
+			fprintf(stderr, "vulkan: unable to allocate staging memory\n");
+			return false;
+		}
+		vkBindBufferMemory(_device, _staging[i], _staging_memory[i], 0);
+		vkMapMemory(_device, _staging_memory[i], 0, _staging_size, 0, (void**)&_staging_data[i]);
+	}
+	return true;
+}
+
+int VulkanBackend::FindMemory(uint32_t type_bits, VkMemoryPropertyFlags properties)
+{
+	for (uint32_t i = 0; i < _memory_properties.memoryTypeCount; i++)
+	{
+		if ((type_bits & (1 << i)) && (_memory_properties.memoryTypes[i].propertyFlags & properties) == properties)
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+bool VulkanBackend::AllocateImage(VkImage image, VkMemoryPropertyFlags properties, VkDeviceMemory &memory)
+{
+	VkMemoryRequirements requirements;
+	vkGetImageMemoryRequirements(_device, image, &requirements);
+	int type = FindMemory(requirements.memoryTypeBits, properties);
+	if (type < 0)
+	{
+		return false;
+	}
+	VkMemoryAllocateInfo alloc_info = {};
+	alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	alloc_info.allocationSize = requirements.size;
+	alloc_info.memoryTypeIndex = type;
+	if (vkAllocateMemory(_device, &alloc_info, NULL, &memory) != VK_SUCCESS)
+	{
+		return false;
+	}
+	vkBindImageMemory(_device, image, memory, 0);
+	return true;
+}
+
+bool VulkanBackend::CreateTargets()
+{
+	VkFormat depth_formats[] = { VK_FORMAT_D32_SFLOAT, VK_FORMAT_X8_D24_UNORM_PACK32, VK_FORMAT_D16_UNORM };
+	for (int i = 0; i < 3 && _depth_format == VK_FORMAT_UNDEFINED; i++)
+	{
+		VkFormatProperties properties;
+		vkGetPhysicalDeviceFormatProperties(_physical, depth_formats[i], &properties);
+		if (properties.optimalTilingFeatures & VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT)
+		{
+			_depth_format = depth_formats[i];
+		}
+	}
+
+	VkAttachmentDescription attachments[2] = {};
+	attachments[0].format = VK_FORMAT_R8G8B8A8_UNORM;
+	attachments[0].samples = VK_SAMPLE_COUNT_1_BIT;
+	attachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	attachments[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	attachments[0].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	attachments[0].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	attachments[0].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	// left ready to be read back or copied out
+	attachments[0].finalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+	attachments[1].format = _depth_format;
+	attachments[1].samples = VK_SAMPLE_COUNT_1_BIT;
+	attachments[1].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	attachments[1].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	attachments[1].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	attachments[1].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	attachments[1].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	attachments[1].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+	VkAttachmentReference color_ref = { 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
+	VkAttachmentReference depth_ref = { 1, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL };
+	VkSubpassDescription subpass = {};
+	subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+	subpass.colorAttachmentCount = 1;
+	subpass.pColorAttachments = &color_ref;
+	subpass.pDepthStencilAttachment = &depth_ref;
+
+	// the targets are reused every eye and every frame, order the writes
+	VkSubpassDependency dependency = {};
+	dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+	dependency.dstSubpass = 0;
+	dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT;
+	dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+	dependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_READ_BIT;
+	dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+	VkRenderPassCreateInfo pass_info = {};
+	pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+	pass_info.attachmentCount = 2;
+	pass_info.pAttachments = attachments;
+	pass_info.subpassCount = 1;
+	pass_info.pSubpasses = &subpass;
+	pass_info.dependencyCount = 1;
+	pass_info.pDependencies = &dependency;
+	if (vkCreateRenderPass(_device, &pass_info, NULL, &_render_pass) != VK_SUCCESS)
+	{
+		fprintf(stderr, "vulkan: vkCreateRenderPass failed\n");
+		return false;
+	}
+
+	VkImageCreateInfo image_info = {};
+	image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	image_info.imageType = VK_IMAGE_TYPE_2D;
+	image_info.extent.width = _width;
+	image_info.extent.height = _height;
+	image_info.extent.depth = 1;
+	image_info.mipLevels = 1;
+	image_info.arrayLayers = 1;
+	image_info.samples = VK_SAMPLE_COUNT_1_BIT;
+	image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+	image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+	VkImageViewCreateInfo view_info = {};
+	view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	view_info.subresourceRange.levelCount = 1;
+	view_info.subresourceRange.layerCount = 1;
+
+	image_info.format = _depth_format;
+	image_info.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+	vkCreateImage(_device, &image_info, NULL, &_depth);
+	if (!AllocateImage(_depth, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, _depth_memory))
+	{
+		fprintf(stderr, "vulkan: unable to allocate the depth buffer\n");
+		return false;
+	}
+	view_info.image = _depth;
+	view_info.format = _depth_format;
+	view_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+	vkCreateImageView(_device, &view_info, NULL, &_depth_view);
+
+	for (int i = 0; i < 2; i++)
+	{
+		image_info.format = VK_FORMAT_R8G8B8A8_UNORM;
+		image_info.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+		vkCreateImage(_device, &image_info, NULL, &_color[i]);
+		if (!AllocateImage(_color[i], VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, _color_memory[i]))
+		{
+			fprintf(stderr, "vulkan: unable to allocate the eye targets\n");
+			return false;
+		}
+		view_info.image = _color[i];
+		view_info.format = VK_FORMAT_R8G8B8A8_UNORM;
+		view_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		vkCreateImageView(_device, &view_info, NULL, &_color_view[i]);
+
+		VkImageView views[2] = { _color_view[i], _depth_view };
+		VkFramebufferCreateInfo framebuffer_info = {};
+		framebuffer_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+		framebuffer_info.renderPass = _render_pass;
+		framebuffer_info.attachmentCount = 2;
+		framebuffer_info.pAttachments = views;
+		framebuffer_info.width = _width;
+		framebuffer_info.height = _height;
+		framebuffer_info.layers = 1;
+		vkCreateFramebuffer(_device, &framebuffer_info, NULL, &_framebuffer[i]);
+	}
+	return true;
+}
+
+// SPIR-V sits next to the executable, built from render/shaders
+VkShaderModule VulkanBackend::LoadShader(const char * name)
+{
+	char path[4096 + 64];
+	ssize_t count = readlink("/proc/self/exe", path, 4096);
+	if (count <= 0)
+	{
+		perror("readlink(\"/proc/self/exe\"):");
+		return VK_NULL_HANDLE;
+	}
+	path[count] = '\0';
+	char * slash = strrchr(path, '/');
+	strcpy(slash? slash + 1 : path, name);
+
+	FILE * file = fopen(path, "rb");
+	if (!file)
+	{
+		fprintf(stderr, "vulkan: unable to open %s\n", path);
+		return VK_NULL_HANDLE;
+	}
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	uint32_t * code = (uint32_t*)malloc(size);
+	size_t read = fread(code, 1, size, file);
+	fclose(file);
+
+	VkShaderModule module = VK_NULL_HANDLE;
+	VkShaderModuleCreateInfo module_info = {};
+	module_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+	module_info.codeSize = read;
+	module_info.pCode = code;
+	if (vkCreateShaderModule(_device, &module_info, NULL, &module) != VK_SUCCESS)
+	{
+		fprintf(stderr, "vulkan: bad shader %s\n", path);
+	}
+	free(code);
+	return module;
+}
+
+bool VulkanBackend::CreatePipeline()
+{
+	VkSamplerCreateInfo sampler_info = {};
+	sampler_info.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	sampler_info.magFilter = VK_FILTER_LINEAR;
+	sampler_info.minFilter = VK_FILTER_LINEAR;
+	sampler_info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+	sampler_info.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	sampler_info.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	sampler_info.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	vkCreateSampler(_device, &sampler_info, NULL, &_sampler);
+
+	VkDescriptorSetLayoutBinding binding = {};
+	binding.binding = 0;
+	binding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	binding.descriptorCount = 1;
+	binding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+	binding.pImmutableSamplers = &_sampler;
+	VkDescriptorSetLayoutCreateInfo set_layout_info = {};
+	set_layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	set_layout_info.bindingCount = 1;
+	set_layout_info.pBindings = &binding;
+	vkCreateDescriptorSetLayout(_device, &set_layout_info, NULL, &_set_layout);
+
+	// one set per tile image
+	VkDescriptorPoolSize pool_size = { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VULKAN_MAX_IMAGES };
+	VkDescriptorPoolCreateInfo pool_info = {};
+	pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	pool_info.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
+	pool_info.maxSets = VULKAN_MAX_IMAGES;
+	pool_info.poolSizeCount = 1;
+	pool_info.pPoolSizes = &pool_size;
+	vkCreateDescriptorPool(_device, &pool_info, NULL, &_descriptor_pool);
+
+	VkPushConstantRange range = {};
+	range.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+	range.offset = 0;
+	range.size = sizeof(QuadConstants);
+	VkPipelineLayoutCreateInfo layout_info = {};
+	layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	layout_info.setLayoutCount = 1;
+	layout_info.pSetLayouts = &_set_layout;
+	layout_info.pushConstantRangeCount = 1;
+	layout_info.pPushConstantRanges = &range;
+	vkCreatePipelineLayout(_device, &layout_info, NULL, &_pipeline_layout);
+
+	VkShaderModule vertex = LoadShader("quad.vert.spv");
+	VkShaderModule fragment = LoadShader("quad.frag.spv");
+	if (!vertex || !fragment)
+	{
+		vkDestroyShaderModule(_device, vertex, NULL);
+		vkDestroyShaderModule(_device, fragment, NULL);
+		return false;
+	}
+
+	VkPipelineShaderStageCreateInfo stages[2] = {};
+	stages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	stages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+	stages[0].module = vertex;
+	stages[0].pName = "main";
+	stages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	stages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+	stages[1].module = fragment;
+	stages[1].pName = "main";
+
+	VkPipelineVertexInputStateCreateInfo vertex_input = {};
+	vertex_input.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+
+	VkPipelineInputAssemblyStateCreateInfo input_assembly = {};
+	input_assembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+	input_assembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP;
+
+	VkPipelineViewportStateCreateInfo viewport = {};
+	viewport.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+	viewport.viewportCount = 1;
+	viewport.scissorCount = 1;
+
+	// windows are seen from both sides, like the fixed function path
+	VkPipelineRasterizationStateCreateInfo raster = {};
+	raster.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+	raster.polygonMode = VK_POLYGON_MODE_FILL;
+	raster.cullMode = VK_CULL_MODE_NONE;
+	raster.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+	raster.lineWidth = 1.f;
+
+	VkPipelineMultisampleStateCreateInfo multisample = {};
+	multisample.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+	multisample.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+	VkPipelineDepthStencilStateCreateInfo depth = {};
+	depth.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+	depth.depthTestEnable = VK_TRUE;
+	depth.depthWriteEnable = VK_TRUE;
+	depth.depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+
+	VkPipelineColorBlendAttachmentState blend_attachment = {};
+	blend_attachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
+		VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+	VkPipelineColorBlendStateCreateInfo blend = {};
+	blend.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+	blend.attachmentCount = 1;
+	blend.pAttachments = &blend_attachment;
+
+	VkDynamicState dynamic_states[] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+	VkPipelineDynamicStateCreateInfo dynamic = {};
+	dynamic.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+	dynamic.dynamicStateCount = 2;
+	dynamic.pDynamicStates = dynamic_states;
+
+	VkGraphicsPipelineCreateInfo pipeline_info = {};
+	pipeline_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+	pipeline_info.stageCount = 2;
+	pipeline_info.pStages = stages;
+	pipeline_info.pVertexInputState = &vertex_input;
+	pipeline_info.pInputAssemblyState = &input_assembly;
+	pipeline_info.pViewportState = &viewport;
+	pipeline_info.pRasterizationState = &raster;
+	pipeline_info.pMultisampleState = &multisample;
+	pipeline_info.pDepthStencilState = &depth;
+	pipeline_info.pColorBlendState = &blend;
+	pipeline_info.pDynamicState = &dynamic;
+	pipeline_info.layout = _pipeline_layout;
+	pipeline_info.renderPass = _render_pass;
+	pipeline_info.subpass = 0;
+	VkResult result = vkCreateGraphicsPipelines(_device, VK_NULL_HANDLE, 1, &pipeline_info, NULL, &_pipeline);
+
+	vkDestroyShaderModule(_device, vertex, NULL);
+	vkDestroyShaderModule(_device, fragment, NULL);
+	if (result != VK_SUCCESS)
+	{
+		fprintf(stderr, "vulkan: vkCreateGraphicsPipelines failed %d\n", result);
+		return false;
+	}
+	return true;
+}
+
+// Opens the command buffer of the next slot, waiting for the frame that
+// used it last. Everything recorded until the next Flush goes in there.
+void VulkanBackend::Record()
+{
+	if (_recording)
+	{
+		return;
+	}
+	long long start = GetTimeNs();
+
+	_slot = _frame % _frames;
+	if (_frame >= (uint64_t)_frames)
+	{
+		uint64_t value = _frame - _frames + 1;
+		VkSemaphoreWaitInfo wait_info = {};
+		wait_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+		wait_info.semaphoreCount = 1;
+		wait_info.pSemaphores = &_timeline;
+		wait_info.pValues = &value;
+		vkWaitSemaphores(_device, &wait_info, ~0ULL);
+	}
+	uint64_t completed = 0;
+	vkGetSemaphoreCounterValue(_device, _timeline, &completed);
+	ReleaseImages(completed);
+
+	vkResetCommandBuffer(_cmd[_slot], 0);
+	VkCommandBufferBeginInfo begin_info = {};
+	begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	vkBeginCommandBuffer(_cmd[_slot], &begin_info);
+
+	_staging_used = 0;
+	_recording = true;
+	_wait_ns = GetTimeNs() - start;
+}
+
+// Submits what was recorded, signalling the timeline with the frame number.
+void VulkanBackend::Flush()
+{
+	if (!_recording)
+	{
+		return;
+	}
+	vkEndCommandBuffer(_cmd[_slot]);
+
+	uint64_t value = _frame + 1;
+	VkTimelineSemaphoreSubmitInfo timeline_info = {};
+	timeline_info.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+	timeline_info.signalSemaphoreValueCount = 1;
+	timeline_info.pSignalSemaphoreValues = &value;
+
+	VkSubmitInfo submit_info = {};
+	submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submit_info.pNext = &timeline_info;
+	submit_info.commandBufferCount = 1;
+	submit_info.pCommandBuffers = &_cmd[_slot];
+	submit_info.signalSemaphoreCount = 1;
+	submit_info.pSignalSemaphores = &_timeline;
+	vkQueueSubmit(_queue, 1, &submit_info, VK_NULL_HANDLE);
+
+	_frame++;
+	_recording = false;
+}
+
+void VulkanBackend::BeginFrame()
+{
+	Record();
+}
+
+void VulkanBackend::EndFrame()
+{
+	Flush();
+}
+
+void VulkanBackend::BeginEye(int eye, const Matrix &clip)
+{
+	Record();
+	_clip = Matrix(s_gl_to_vulkan) * clip;
+
+	VkClearValue clear[2];
+	clear[0].color.float32[0] = 96.f / 255.f;
+	clear[0].color.float32[1] = 118.f / 255.f;
+	clear[0].color.float32[2] = 98.f / 255.f;
+	clear[0].color.float32[3] = 1.f;
+	clear[1].depthStencil.depth = 1.f;
+	clear[1].depthStencil.stencil = 0;
+
+	VkRenderPassBeginInfo pass_info = {};
+	pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+	pass_info.renderPass = _render_pass;
+	pass_info.framebuffer = _framebuffer[eye];
+	pass_info.renderArea.extent.width = _width;
+	pass_info.renderArea.extent.height = _height;
+	pass_info.clearValueCount = 2;
+	pass_info.pClearValues = clear;
+	vkCmdBeginRenderPass(_cmd[_slot], &pass_info, VK_SUBPASS_CONTENTS_INLINE);
+
+	VkViewport viewport = { 0.f, 0.f, (float)_width, (float)_height, 0.f, 1.f };
+	VkRect2D scissor = { { 0, 0 }, { (uint32_t)_width, (uint32_t)_height } };
+	vkCmdSetViewport(_cmd[_slot], 0, 1, &viewport);
+	vkCmdSetScissor(_cmd[_slot], 0, 1, &scissor);
+	vkCmdBindPipeline(_cmd[_slot], VK_PIPELINE_BIND_POINT_GRAPHICS, _pipeline);
+	_in_pass = true;
+}
+
+void VulkanBackend::EndEye()
+{
+	vkCmdEndRenderPass(_cmd[_slot]);
+	_in_pass = false;
+}
+
+unsigned int VulkanBackend::CreateImage(int width, int height)
+{
+	int index = 0;
+	while (index < _nimages && _images[index]._used)
+	{
+		index++;
+	}
+	if (index == _nimages)
+	{
+		_nimages = _nimages? _nimages * 2 : 64;
+		_images = (Image*)realloc(_images, sizeof(Image) * _nimages);
+		memset(_images + index, 0, sizeof(Image) * (_nimages - index));
+	}
+
+	Image &image = _images[index];
+	memset(&image, 0, sizeof(Image));
+	image._width = width;
+	image._height = height;
+	image._layout = VK_IMAGE_LAYOUT_UNDEFINED;
+	image._used = true;
+
+	VkImageCreateInfo image_info = {};
+	image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	image_info.imageType = VK_IMAGE_TYPE_2D;
+	image_info.format = VK_FORMAT_R8G8B8A8_UNORM;
+	image_info.extent.width = width;
+	image_info.extent.height = height;
+	image_info.extent.depth = 1;
+	image_info.mipLevels = 1;
+	image_info.arrayLayers = 1;
+	image_info.samples = VK_SAMPLE_COUNT_1_BIT;
+	image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+	image_info.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+	image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	vkCreateImage(_device, &image_info, NULL, &image._image);
+	if (!AllocateImage(image._image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, image._memory))
+	{
+		fprintf(stderr, "vulkan: out of memory for a %dx%d image\n", width, height);
+	}
+
+	VkImageViewCreateInfo view_info = {};
+	view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	view_info.image = image._image;
+	view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	view_info.format = VK_FORMAT_R8G8B8A8_UNORM;
+	view_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	view_info.subresourceRange.levelCount = 1;
+	view_info.subresourceRange.layerCount = 1;
+	vkCreateImageView(_device, &view_info, NULL, &image._view);
+
+	VkDescriptorSetAllocateInfo set_info = {};
+	set_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	set_info.descriptorPool = _descriptor_pool;
+	set_info.descriptorSetCount = 1;
+	set_info.pSetLayouts = &_set_layout;
+	if (vkAllocateDescriptorSets(_device, &set_info, &image._set) != VK_SUCCESS)
+	{
+		fprintf(stderr, "vulkan: out of descriptor sets\n");
+		image._set = VK_NULL_HANDLE;
+	}
+	else
+	{
+		VkDescriptorImageInfo descriptor = {};
+		descriptor.imageView = image._view;
+		descriptor.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		VkWriteDescriptorSet write = {};
+		write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		write.dstSet = image._set;
+		write.dstBinding = 0;
+		write.descriptorCount = 1;
+		write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		write.pImageInfo = &descriptor;
+		vkUpdateDescriptorSets(_device, 1, &write, 0, NULL);
+	}
+	return index + 1;
+}
+
+// Frames still in flight may sample it, it goes once they are done.
+void VulkanBackend::DestroyImage(unsigned int image)
+{
+	if (!image || image > (unsigned int)_nimages)
+	{
+		return;
+	}
+	// the frame being recorded, or the next one, is the last that can use it
+	_images[image - 1]._release = _frame + 1;
+}
+
+void VulkanBackend::ReleaseImages(uint64_t completed)
+{
+	for (int i = 0; i < _nimages; i++)
+	{
+		Image &image = _images[i];
+		if (!image._used || !image._release || image._release > completed)
+		{
+			continue;
+		}
+		if (image._set)
+		{
+			vkFreeDescriptorSets(_device, _descriptor_pool, 1, &image._set);
+		}
+		vkDestroyImageView(_device, image._view, NULL);
+		vkDestroyImage(_device, image._image, NULL);
+		vkFreeMemory(_device, image._memory, NULL);
+		image._used = false;
+	}
+}
+
+int VulkanBackend::AllocateStaging(int size)
+{
+	int offset = (_staging_used + STAGING_ALIGN - 1) & ~(STAGING_ALIGN - 1);
+	if (offset + size > _staging_size)
+	{
+		if (_in_pass || size > _staging_size)
+		{
+			return -1;
+		}
+		// out of room, send what there is and go on in the next slot
+		Flush();
+		Record();
+		offset = 0;
+	}
+	_staging_used = offset + size;
+	return offset;
+}
+
+void * VulkanBackend::MapUpload(int size)
+{
+	Record();
+	int offset = AllocateStaging(size);
+	if (offset < 0)
+	{
+		return NULL;
+	}
+	_mapped_offset = offset;
+	return _staging_data[_slot] + offset;
+}
+
+// coherent and always mapped, the pointer is good as it is
+const void * VulkanBackend::UnmapUpload()
+{
+	return _staging_data[_slot] + _mapped_offset;
+}
+
+void VulkanBackend::Transition(Image &image, VkImageLayout layout)
+{
+	VkImageMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.oldLayout = image._layout;
+	barrier.newLayout = layout;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = image._image;
+	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	barrier.subresourceRange.levelCount = 1;
+	barrier.subresourceRange.layerCount = 1;
+
+	VkPipelineStageFlags src_stage, dst_stage;
+	if (layout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL)
+	{
+		// earlier frames may still be sampling it
+		barrier.srcAccessMask = image._layout == VK_IMAGE_LAYOUT_UNDEFINED? 0 : VK_ACCESS_SHADER_READ_BIT;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		src_stage = image._layout == VK_IMAGE_LAYOUT_UNDEFINED? VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT : VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+		dst_stage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+	}
+	else
+	{
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		src_stage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+		dst_stage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+	}
+	vkCmdPipelineBarrier(_cmd[_slot], src_stage, dst_stage, 0, 0, NULL, 0, NULL, 1, &barrier);
+	image._layout = layout;
+}
+
+void VulkanBackend::UploadImage(unsigned int handle, int x, int y, int width, int height,
+		const void * pixels, int row_length, int bytes_per_pixel)
+{
+	if (!handle || handle > (unsigned int)_nimages || _in_pass)
+	{
+		_dropped_uploads++;
+		return;
+	}
+	Record();
+	Image &image = _images[handle - 1];
+
+	// anything not already RGBA in this slot's staging gets copied over first
+	const unsigned char * src = (const unsigned char *)pixels;
+	const unsigned char * base = _staging_data[_slot];
+	int offset = src - base;
+	if (bytes_per_pixel != 4 || src < base || src >= base + _staging_used)
+	{
+		offset = AllocateStaging(width * height * 4);
+		if (offset < 0)
+		{
+			_dropped_uploads++;
+			return;
+		}
+		unsigned char * dst = _staging_data[_slot] + offset;
+		for (int py = 0; py < height; py++)
+		{
+			const unsigned char * row = src + py * row_length * bytes_per_pixel;
+			for (int px = 0; px < width; px++)
+			{
+				dst[0] = row[0];
+				dst[1] = row[1];
+				dst[2] = row[2];
+				dst[3] = bytes_per_pixel > 3? row[3] : 255;
+				row += bytes_per_pixel;
+				dst += 4;
+			}
+		}
+		row_length = width;
+	}
+
+	Transition(image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+
+	VkBufferImageCopy region = {};
+	region.bufferOffset = offset;
+	region.bufferRowLength = row_length;
+	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	region.imageSubresource.layerCount = 1;
+	region.imageOffset.x = x;
+	region.imageOffset.y = y;
+	region.imageExtent.width = width;
+	region.imageExtent.height = height;
+	region.imageExtent.depth = 1;
+	vkCmdCopyBufferToImage(_cmd[_slot], _staging[_slot], image._image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+
+	Transition(image, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+}
+
+void VulkanBackend::DrawImage(unsigned int handle, const Matrix &model, const float * rect)
+{
+	if (!_in_pass || !handle || handle > (unsigned int)_nimages)
+	{
+		return;
+	}
+	Image &image = _images[handle - 1];
+	// never captured into yet, nothing to sample
+	if (image._layout != VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL || !image._set)
+	{
+		return;
+	}
+
+	QuadConstants constants;
+	Matrix mvp = _clip * model;
+	memcpy(constants._mvp, mvp._m, sizeof(constants._mvp));
+	memcpy(constants._rect, rect, sizeof(constants._rect));
+
+	vkCmdBindDescriptorSets(_cmd[_slot], VK_PIPELINE_BIND_POINT_GRAPHICS, _pipeline_layout, 0, 1, &image._set, 0, NULL);
+	vkCmdPushConstants(_cmd[_slot], _pipeline_layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(constants), &constants);
+	vkCmdDraw(_cmd[_slot], 4, 1, 0, 0);
+}
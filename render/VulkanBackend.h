@@ -0,0 +1,130 @@
+#ifndef VULKANBACKEND_H
+#define VULKANBACKEND_H
+
+#include <vulkan/vulkan.h>
+#include "RenderBackend.h"
+
+#define VULKAN_MAX_FRAMES 4
+
+// Offscreen Vulkan renderer for the window model. Captures go into host
+// visible staging buffers, one per frame in flight, and are copied into the
+// tile images by the frame's command buffer ahead of both eye passes. A
+// timeline semaphore counts finished frames, BeginFrame only waits for the
+// frame that last used the slot. Runs fine on lavapipe, there is no swapchain.
+
+class VulkanBackend : public RenderBackend
+{
+protected:
+	struct Image
+	{
+		VkImage _image;
+		VkDeviceMemory _memory;
+		VkImageView _view;
+		VkDescriptorSet _set;
+		VkImageLayout _layout;
+		int _width;
+		int _height;
+		bool _used;
+		// destroyed once the timeline reaches this, 0 while alive
+		uint64_t _release;
+	};
+
+	int _frames;
+	int _slot;
+	uint64_t _frame;
+	bool _recording;
+	bool _in_pass;
+
+	VkInstance _instance;
+	VkPhysicalDevice _physical;
+	VkDevice _device;
+	VkQueue _queue;
+	uint32_t _queue_family;
+	VkPhysicalDeviceMemoryProperties _memory_properties;
+	uint32_t _max_size;
+
+	VkSemaphore _timeline;
+	VkCommandPool _command_pool;
+	VkCommandBuffer _cmd[VULKAN_MAX_FRAMES];
+
+	VkBuffer _staging[VULKAN_MAX_FRAMES];
+	VkDeviceMemory _staging_memory[VULKAN_MAX_FRAMES];
+	unsigned char * _staging_data[VULKAN_MAX_FRAMES];
+	int _staging_size;
+	int _staging_used;
+	int _mapped_offset;
+
+	// the eye targets, rendered one after the other with a shared depth
+	int _width;
+	int _height;
+	VkFormat _depth_format;
+	VkImage _color[2];
+	VkDeviceMemory _color_memory[2];
+	VkImageView _color_view[2];
+	VkImage _depth;
+	VkDeviceMemory _depth_memory;
+	VkImageView _depth_view;
+	VkRenderPass _render_pass;
+	VkFramebuffer _framebuffer[2];
+
+	VkDescriptorSetLayout _set_layout;
+	VkDescriptorPool _descriptor_pool;
+	VkSampler _sampler;
+	VkPipelineLayout _pipeline_layout;
+	VkPipeline _pipeline;
+
+	Image * _images;
+	int _nimages;
+
+	Matrix _clip;
+
+	long long _wait_ns;
+	int _dropped_uploads;
+
+	bool CreateDevice();
+	bool CreateTargets();
+	bool CreatePipeline();
+	VkShaderModule LoadShader(const char * name);
+	int FindMemory(uint32_t type_bits, VkMemoryPropertyFlags properties);
+	bool AllocateImage(VkImage image, VkMemoryPropertyFlags properties, VkDeviceMemory &memory);
+	void Record();
+	void Flush();
+	void Transition(Image &image, VkImageLayout layout);
+	int AllocateStaging(int size);
+	void ReleaseImages(uint64_t completed);
+
+public:
+	VulkanBackend(int frames = 2, int staging_size = 16 * 1024 * 1024);
+	~VulkanBackend();
+
+	bool Initialize(int eye_width, int eye_height);
+
+	void BeginFrame();
+	// clip is projection times view for the eye, GL conventions
+	void BeginEye(int eye, const Matrix &clip);
+	void EndEye();
+	void EndFrame();
+
+	VkDevice device() { return _device; }
+	VkImage eye(int eye) { return _color[eye]; }
+	float wait_ms() { return _wait_ns / 1000000.f; }
+	int dropped_uploads() { return _dropped_uploads; }
+
+	const char * name() { return "vulkan"; }
+
+	int max_image_size() { return _max_size; }
+	int ImageBytes(int width, int height) { return width * height * 4; }
+
+	unsigned int CreateImage(int width, int height);
+	void DestroyImage(unsigned int image);
+
+	void * MapUpload(int size);
+	const void * UnmapUpload();
+	void UploadImage(unsigned int image, int x, int y, int width, int height,
+			const void * pixels, int row_length, int bytes_per_pixel);
+	void EndUpload() {}
+
+	void DrawImage(unsigned int image, const Matrix &model, const float * rect);
+};
+
+#endif//VULKANBACKEND_H
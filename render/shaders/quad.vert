@@ -0,0 +1,18 @@
+#version 450
+
+// one window tile, a triangle strip of four vertices and no vertex buffer
+layout(push_constant) uniform Quad
+{
+	mat4 mvp;
+	// x, y, x2, y2 in window units
+	vec4 rect;
+} quad;
+
+layout(location = 0) out vec2 uv;
+
+void main()
+{
+	vec2 corner = vec2(gl_VertexIndex & 1, gl_VertexIndex >> 1);
+	uv = corner;
+	gl_Position = quad.mvp * vec4(mix(quad.rect.xy, quad.rect.zw, corner), 0.0, 1.0);
+}
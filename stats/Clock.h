@@ -0,0 +1,20 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <time.h>
+
+// monotonic time, unaffected by wall clock changes (GetTime() is not)
+
+static inline long long GetTimeNs()
+{
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static inline float NsToMs(long long ns)
+{
+	return ns * (1.f / 1000000.f);
+}
+
+#endif//CLOCK_H
@@ -0,0 +1,439 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "Control.h"
+
+// a client that says nothing for this long is dropped
+#define CONTROL_IDLE_MS 30000
+#define CONTROL_LINE 1024
+#define CONTROL_REPLY 8192
+
+Control::Tunable Control::s_tunables[CONTROL_TUNABLES];
+int Control::s_tunable_count;
+Control::Reading Control::s_stats[CONTROL_STATS];
+int Control::s_stat_count;
+void (*Control::s_report)();
+bool Control::s_pending;
+bool Control::s_stats_wanted;
+unsigned int Control::s_applied;
+
+static pthread_mutex_t s_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t s_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t s_thread;
+static int s_listen = -1;
+static int s_wake[2] = { -1, -1 };
+static char s_path[sizeof(((sockaddr_un *)0)->sun_path)];
+
+static void StopAtExit()
+{
+	Control::Stop();
+}
+
+static int Append(char * reply, int size, int length, const char * format, ...) __attribute__((format(printf, 4, 5)));
+
+static int Append(char * reply, int size, int length, const char * format, ...)
+{
+	if (length >= size - 1)
+	{
+		return length;
+	}
+	va_list args;
+	va_start(args, format);
+	int n = vsnprintf(reply + length, size - length, format, args);
+	va_end(args);
+	// cut short rather than overrun, the reply still ends in a line
+	return n < size - length? length + n : size - 1;
+}
+
+void Control::Register(const char * name, float * value, float min, float max)
+{
+	if (s_tunable_count == CONTROL_TUNABLES)
+	{
+		fprintf(stderr, "control: no room for %s\n", name);
+		return;
+	}
+	Tunable &tunable = s_tunables[s_tunable_count++];
+	memset(&tunable, 0, sizeof(tunable));
+	tunable._name = name;
+	tunable._float = value;
+	tunable._min = min;
+	tunable._max = max;
+}
+
+void Control::Register(const char * name, int * value, int min, int max)
+{
+	if (s_tunable_count == CONTROL_TUNABLES)
+	{
+		fprintf(stderr, "control: no room for %s\n", name);
+		return;
+	}
+	Tunable &tunable = s_tunables[s_tunable_count++];
+	memset(&tunable, 0, sizeof(tunable));
+	tunable._name = name;
+	tunable._int = value;
+	tunable._min = (float)min;
+	tunable._max = (float)max;
+}
+
+Control::Tunable * Control::Find(const char * name)
+{
+	for (int i = 0; i < s_tunable_count; i++)
+	{
+		if (!strcmp(s_tunables[i]._name, name))
+		{
+			return &s_tunables[i];
+		}
+	}
+	return NULL;
+}
+
+void Control::Stat(const char * name, double value)
+{
+	if (s_stat_count < CONTROL_STATS)
+	{
+		s_stats[s_stat_count]._name = name;
+		s_stats[s_stat_count]._value = value;
+		s_stat_count++;
+	}
+}
+
+bool Control::Apply()
+{
+	if (!__atomic_load_n(&s_pending, __ATOMIC_ACQUIRE))
+	{
+		return false;
+	}
+	bool changed = false;
+	pthread_mutex_lock(&s_mutex);
+	for (int i = 0; i < s_tunable_count; i++)
+	{
+		Tunable &tunable = s_tunables[i];
+		if (!tunable._dirty)
+		{
+			continue;
+		}
+		if (tunable._float)
+		{
+			*tunable._float = tunable._pending;
+		}
+		else
+		{
+			*tunable._int = (int)lroundf(tunable._pending);
+		}
+		tunable._dirty = false;
+		changed = true;
+	}
+	if (s_stats_wanted)
+	{
+		s_stat_count = 0;
+		if (s_report)
+		{
+			s_report();
+		}
+		s_stats_wanted = false;
+	}
+	__atomic_store_n(&s_pending, false, __ATOMIC_RELAXED);
+	s_applied++;
+	pthread_cond_broadcast(&s_cond);
+	pthread_mutex_unlock(&s_mutex);
+	return changed;
+}
+
+// with the lock held, false when no frame came round in time
+bool Control::WaitApplied(unsigned int applied)
+{
+	timespec deadline;
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	long long ns = deadline.tv_nsec + CONTROL_TIMEOUT_MS * 1000000LL;
+	deadline.tv_sec += ns / 1000000000LL;
+	deadline.tv_nsec = ns % 1000000000LL;
+	while (s_applied == applied)
+	{
+		if (pthread_cond_timedwait(&s_cond, &s_mutex, &deadline) == ETIMEDOUT)
+		{
+			return s_applied != applied;
+		}
+	}
+	return true;
+}
+
+int Control::Command(char * line, char * reply, int size)
+{
+	char * save;
+	char * command = strtok_r(line, " \t\r", &save);
+	int length = 0;
+	if (!command)
+	{
+		return Append(reply, size, length, "ok\n");
+	}
+
+	if (!strcmp(command, "stats"))
+	{
+		char * format = strtok_r(NULL, " \t\r", &save);
+		bool json = format && !strcmp(format, "json");
+		pthread_mutex_lock(&s_mutex);
+		s_stats_wanted = true;
+		__atomic_store_n(&s_pending, true, __ATOMIC_RELEASE);
+		if (!WaitApplied(s_applied))
+		{
+			pthread_mutex_unlock(&s_mutex);
+			return Append(reply, size, length, "error no frame in %d ms\n", CONTROL_TIMEOUT_MS);
+		}
+		if (json)
+		{
+			length = Append(reply, size, length, "{");
+			for (int i = 0; i < s_stat_count; i++)
+			{
+				length = Append(reply, size, length, "%s\"%s\":%.6g", i? "," : "", s_stats[i]._name, s_stats[i]._value);
+			}
+			length = Append(reply, size, length, "}\n");
+		}
+		else
+		{
+			for (int i = 0; i < s_stat_count; i++)
+			{
+				length = Append(reply, size, length, "%s %.6g\n", s_stats[i]._name, s_stats[i]._value);
+			}
+		}
+		pthread_mutex_unlock(&s_mutex);
+		return Append(reply, size, length, "ok\n");
+	}
+
+	if (!strcmp(command, "get"))
+	{
+		char * name = strtok_r(NULL, " \t\r", &save);
+		if (name && !Find(name))
+		{
+			return Append(reply, size, length, "error unknown tunable %s\n", name);
+		}
+		// only Apply writes them, and it holds the lock
+		pthread_mutex_lock(&s_mutex);
+		for (int i = 0; i < s_tunable_count; i++)
+		{
+			Tunable &tunable = s_tunables[i];
+			if (name && strcmp(tunable._name, name))
+			{
+				continue;
+			}
+			if (tunable._float)
+			{
+				length = Append(reply, size, length, "%s %g %g %g\n", tunable._name, *tunable._float, tunable._min, tunable._max);
+			}
+			else
+			{
+				length = Append(reply, size, length, "%s %d %d %d\n", tunable._name, *tunable._int, (int)tunable._min, (int)tunable._max);
+			}
+		}
+		pthread_mutex_unlock(&s_mutex);
+		return Append(reply, size, length, "ok\n");
+	}
+
+	if (!strcmp(command, "set"))
+	{
+		// all of them checked before any is staged
+		Tunable * tunables[CONTROL_TUNABLES];
+		float values[CONTROL_TUNABLES];
+		int count = 0;
+		char * name;
+		while ((name = strtok_r(NULL, " \t\r", &save)))
+		{
+			char * text = strtok_r(NULL, " \t\r", &save);
+			Tunable * tunable = Find(name);
+			if (!tunable)
+			{
+				return Append(reply, size, length, "error unknown tunable %s\n", name);
+			}
+			char * end;
+			float value = text? strtof(text, &end) : 0.f;
+			if (!text || *end || !(value >= tunable->_min && value <= tunable->_max))
+			{
+				return Append(reply, size, length, "error %s takes %g to %g\n", name, tunable->_min, tunable->_max);
+			}
+			if (count == CONTROL_TUNABLES)
+			{
+				return Append(reply, size, length, "error too many tunables\n");
+			}
+			tunables[count] = tunable;
+			values[count] = value;
+			count++;
+		}
+		if (!count)
+		{
+			return Append(reply, size, length, "error set name value ...\n");
+		}
+		pthread_mutex_lock(&s_mutex);
+		for (int i = 0; i < count; i++)
+		{
+			tunables[i]->_pending = values[i];
+			tunables[i]->_dirty = true;
+		}
+		__atomic_store_n(&s_pending, true, __ATOMIC_RELEASE);
+		bool applied = WaitApplied(s_applied);
+		pthread_mutex_unlock(&s_mutex);
+		if (!applied)
+		{
+			return Append(reply, size, length, "error no frame in %d ms, applied at the next\n", CONTROL_TIMEOUT_MS);
+		}
+		return Append(reply, size, length, "ok\n");
+	}
+
+	return Append(reply, size, length, "error unknown command %s, try stats [json], get [name] or set name value ...\n", command);
+}
+
+void Control::Serve(int fd)
+{
+	char line[CONTROL_LINE];
+	char reply[CONTROL_REPLY];
+	int used = 0;
+	for (;;)
+	{
+		pollfd fds[2] = { { fd, POLLIN, 0 }, { s_wake[0], POLLIN, 0 } };
+		if (poll(fds, 2, CONTROL_IDLE_MS) <= 0 || fds[1].revents)
+		{
+			return;
+		}
+		int n = recv(fd, line + used, sizeof(line) - 1 - used, 0);
+		if (n <= 0)
+		{
+			return;
+		}
+		used += n;
+		line[used] = 0;
+
+		char * start = line;
+		char * end;
+		while ((end = strchr(start, '\n')))
+		{
+			*end = 0;
+			int length = Command(start, reply, sizeof(reply));
+			if (send(fd, reply, length, MSG_NOSIGNAL) != length)
+			{
+				return;
+			}
+			start = end + 1;
+		}
+		used -= start - line;
+		memmove(line, start, used);
+		if (used == sizeof(line) - 1)
+		{
+			const char * error = "error line too long\n";
+			send(fd, error, strlen(error), MSG_NOSIGNAL);
+			return;
+		}
+	}
+}
+
+void * Control::Run(void *)
+{
+	for (;;)
+	{
+		pollfd fds[2] = { { s_listen, POLLIN, 0 }, { s_wake[0], POLLIN, 0 } };
+		if (poll(fds, 2, -1) < 0 && errno != EINTR)
+		{
+			fprintf(stderr, "control: poll failed, %s\n", strerror(errno));
+			return NULL;
+		}
+		if (fds[1].revents)
+		{
+			return NULL;
+		}
+		if (!fds[0].revents)
+		{
+			continue;
+		}
+		// one client at a time, they are people at a terminal
+		int fd = accept(s_listen, NULL, NULL);
+		if (fd < 0)
+		{
+			continue;
+		}
+		Serve(fd);
+		close(fd);
+	}
+}
+
+bool Control::Start(const char * path)
+{
+	sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(address.sun_path))
+	{
+		fprintf(stderr, "control: socket path %s too long\n", path);
+		return false;
+	}
+	strcpy(address.sun_path, path);
+
+	// a socket left over from a run that crashed, anything else stays
+	struct stat st;
+	if (lstat(path, &st) == 0)
+	{
+		if (!S_ISSOCK(st.st_mode))
+		{
+			fprintf(stderr, "control: %s is in the way\n", path);
+			return false;
+		}
+		unlink(path);
+	}
+
+	s_listen = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (s_listen < 0)
+	{
+		fprintf(stderr, "control: unable to create a socket, %s\n", strerror(errno));
+		return false;
+	}
+	// the tunables are the user's alone
+	mode_t mask = umask(077);
+	int bound = bind(s_listen, (sockaddr *)&address, sizeof(address));
+	umask(mask);
+	if (bound < 0 || listen(s_listen, 4) < 0 || pipe(s_wake) < 0)
+	{
+		fprintf(stderr, "control: unable to listen on %s, %s\n", path, strerror(errno));
+		close(s_listen);
+		s_listen = -1;
+		return false;
+	}
+	strcpy(s_path, path);
+
+	if (pthread_create(&s_thread, NULL, Run, NULL))
+	{
+		fprintf(stderr, "control: unable to start the thread\n");
+		close(s_wake[0]);
+		close(s_wake[1]);
+		close(s_listen);
+		s_listen = -1;
+		unlink(s_path);
+		return false;
+	}
+	atexit(StopAtExit);
+	return true;
+}
+
+void Control::Stop()
+{
+	if (s_listen < 0)
+	{
+		return;
+	}
+	if (write(s_wake[1], "x", 1) != 1)
+	{
+		fprintf(stderr, "control: unable to wake the thread\n");
+	}
+	pthread_join(s_thread, NULL);
+	close(s_wake[0]);
+	close(s_wake[1]);
+	close(s_listen);
+	s_listen = -1;
+	unlink(s_path);
+}
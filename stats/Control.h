@@ -0,0 +1,71 @@
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#define CONTROL_TUNABLES 64
+#define CONTROL_STATS 128
+// how long a command waits for the frame to come round
+#define CONTROL_TIMEOUT_MS 1000
+
+// A Unix socket a running x3d answers on from a thread of its own, one
+// command per line and every reply ending in a line "ok" or "error ...":
+//
+//   stats              every stat as "name value"
+//   stats json         the same as one JSON object
+//   get [name]         tunables as "name value min max"
+//   set name value ... all of them applied at the same frame boundary, or
+//                      none if one is unknown or out of range
+//
+// Nothing the frame owns is touched from the socket thread. Stats are
+// collected by the report callback and tunables written by Apply, both at
+// the frame boundary. util/x3dctl is the client.
+class Control
+{
+protected:
+	struct Tunable
+	{
+		const char * _name;
+		float * _float;
+		int * _int;
+		float _min;
+		float _max;
+		float _pending;
+		bool _dirty;
+	};
+
+	struct Reading
+	{
+		const char * _name;
+		double _value;
+	};
+
+	static Tunable s_tunables[CONTROL_TUNABLES];
+	static int s_tunable_count;
+	static Reading s_stats[CONTROL_STATS];
+	static int s_stat_count;
+	static void (*s_report)();
+	// anything for Apply to do, checked without the lock
+	static bool s_pending;
+	static bool s_stats_wanted;
+	static unsigned int s_applied;
+
+	static Tunable * Find(const char * name);
+	static bool WaitApplied(unsigned int applied);
+	static void * Run(void * context);
+	static void Serve(int fd);
+	static int Command(char * line, char * reply, int size);
+
+public:
+	// before Start, the names have to outlive it
+	static void Register(const char * name, float * value, float min, float max);
+	static void Register(const char * name, int * value, int min, int max);
+	static void SetReport(void (*report)()) { s_report = report; }
+	// from the report callback only
+	static void Stat(const char * name, double value);
+
+	static bool Start(const char * path);
+	// at the frame boundary, true when a tunable changed
+	static bool Apply();
+	static void Stop();
+};
+
+#endif//CONTROL_H
@@ -0,0 +1,147 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include "Log.h"
+
+Log::Slot Log::s_slots[LOG_SLOTS];
+unsigned int Log::s_write;
+unsigned int Log::s_read;
+int Log::s_level = LOG_LEVEL_DEBUG;
+int Log::s_dropped;
+int Log::s_written;
+bool Log::s_running;
+
+static pthread_once_t s_once = PTHREAD_ONCE_INIT;
+static pthread_t s_thread;
+static bool s_started;
+static bool s_stopped;
+
+static void StopAtExit()
+{
+	Log::Stop();
+}
+
+void Log::Start()
+{
+	// a slot is free for the write position equal to its sequence
+	for (unsigned int i = 0; i < LOG_SLOTS; i++)
+	{
+		s_slots[i]._sequence = i;
+	}
+	s_running = true;
+	if (pthread_create(&s_thread, NULL, Run, NULL))
+	{
+		fprintf(stderr, "log: unable to start the writer thread, writing directly\n");
+		s_running = false;
+		s_stopped = true;
+		return;
+	}
+	s_started = true;
+	atexit(StopAtExit);
+}
+
+void Log::Write(int level, const char * format, ...)
+{
+	pthread_once(&s_once, Start);
+
+	va_list args;
+	va_start(args, format);
+	if (__atomic_load_n(&s_stopped, __ATOMIC_ACQUIRE))
+	{
+		vfprintf(level <= LOG_LEVEL_WARN? stderr : stdout, format, args);
+		va_end(args);
+		return;
+	}
+
+	unsigned int pos = __atomic_load_n(&s_write, __ATOMIC_RELAXED);
+	Slot * slot;
+	for (;;)
+	{
+		slot = &s_slots[pos % LOG_SLOTS];
+		unsigned int sequence = __atomic_load_n(&slot->_sequence, __ATOMIC_ACQUIRE);
+		int diff = (int)(sequence - pos);
+		if (diff == 0)
+		{
+			// pos is reloaded when another writer got there first
+			if (__atomic_compare_exchange_n(&s_write, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			{
+				break;
+			}
+		}
+		else if (diff < 0)
+		{
+			// still holds a message from a lap ago
+			__atomic_fetch_add(&s_dropped, 1, __ATOMIC_RELAXED);
+			va_end(args);
+			return;
+		}
+		else
+		{
+			pos = __atomic_load_n(&s_write, __ATOMIC_RELAXED);
+		}
+	}
+	vsnprintf(slot->_text, sizeof(slot->_text), format, args);
+	va_end(args);
+	slot->_level = level;
+	__atomic_store_n(&slot->_sequence, pos + 1, __ATOMIC_RELEASE);
+}
+
+bool Log::Drain()
+{
+	bool any = false;
+	for (;;)
+	{
+		Slot &slot = s_slots[s_read % LOG_SLOTS];
+		if (__atomic_load_n(&slot._sequence, __ATOMIC_ACQUIRE) != s_read + 1)
+		{
+			break;
+		}
+		fputs(slot._text, slot._level <= LOG_LEVEL_WARN? stderr : stdout);
+		__atomic_store_n(&slot._sequence, s_read + LOG_SLOTS, __ATOMIC_RELEASE);
+		s_read++;
+		__atomic_fetch_add(&s_written, 1, __ATOMIC_RELAXED);
+		any = true;
+	}
+	if (any)
+	{
+		fflush(stdout);
+	}
+	return any;
+}
+
+void * Log::Run(void *)
+{
+	while (__atomic_load_n(&s_running, __ATOMIC_ACQUIRE))
+	{
+		if (!Drain())
+		{
+			// nothing to wake on without a lock in Write, polling is cheap enough
+			timespec ts = { 0, 2000000 };
+			nanosleep(&ts, NULL);
+		}
+	}
+	// whatever was claimed before Stop is published eventually
+	while (s_read != __atomic_load_n(&s_write, __ATOMIC_ACQUIRE))
+	{
+		if (!Drain())
+		{
+			sched_yield();
+		}
+	}
+	return NULL;
+}
+
+void Log::Stop()
+{
+	if (!s_started || s_stopped)
+	{
+		return;
+	}
+	__atomic_store_n(&s_stopped, true, __ATOMIC_RELEASE);
+	__atomic_store_n(&s_running, false, __ATOMIC_RELEASE);
+	pthread_join(s_thread, NULL);
+}
@@ -0,0 +1,74 @@
+#ifndef LOG_H
+#define LOG_H
+
+#define LOG_LEVEL_ERROR 0
+#define LOG_LEVEL_WARN 1
+#define LOG_LEVEL_INFO 2
+#define LOG_LEVEL_DEBUG 3
+
+// anything above is compiled out, arguments and all, build with
+// -DLOG_COMPILED_LEVEL=3 for the debug messages
+#ifndef LOG_COMPILED_LEVEL
+#define LOG_COMPILED_LEVEL LOG_LEVEL_INFO
+#endif
+
+#define LOG_AT(at, ...) \
+	do \
+	{ \
+		if (at <= LOG_COMPILED_LEVEL && at <= Log::level()) \
+			Log::Write(at, __VA_ARGS__); \
+	} while (0)
+
+#define LOG_ERROR(...) LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
+#define LOG_WARN(...) LOG_AT(LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_INFO(...) LOG_AT(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_DEBUG(...) LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+
+// 256 messages of up to 240 characters, longer ones are cut
+#define LOG_SLOTS 256
+#define LOG_MESSAGE 240
+
+// Messages are formatted by the caller into a slot of a lock-free ring and
+// written out by a thread of their own, errors and warnings to stderr and
+// the rest to stdout. A full ring drops the message and counts it rather
+// than wait. The thread starts with the first message and drains what is
+// left at exit.
+
+class Log
+{
+protected:
+	struct Slot
+	{
+		unsigned int _sequence;
+		int _level;
+		char _text[LOG_MESSAGE];
+	};
+
+	static Slot s_slots[LOG_SLOTS];
+	static unsigned int s_write;
+	static unsigned int s_read;
+	static int s_level;
+	static int s_dropped;
+	static int s_written;
+	static bool s_running;
+
+	static void Start();
+	static void * Run(void * context);
+	static bool Drain();
+
+public:
+	static void Write(int level, const char * format, ...) __attribute__((format(printf, 2, 3)));
+
+	// at run time, within LOG_COMPILED_LEVEL
+	static void SetLevel(int level) { s_level = level; }
+	static int level() { return s_level; }
+
+	static int dropped() { return __atomic_load_n(&s_dropped, __ATOMIC_RELAXED); }
+	static int written() { return __atomic_load_n(&s_written, __ATOMIC_RELAXED); }
+
+	// writes out everything queued and stops the thread, later messages
+	// are written straight away
+	static void Stop();
+};
+
+#endif//LOG_H
@@ -0,0 +1,203 @@
+
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "Profile.h"
+
+struct ProfileEvent
+{
+	ProfileStage * _stage;
+	long long _start;
+	long long _end;
+};
+
+// written by its own thread only, DumpTrace reads whatever made it in
+struct ProfileRing
+{
+	ProfileEvent _events[PROFILE_RING];
+	unsigned int _head;
+	int _tid;
+	char _thread[16];
+	ProfileRing * _next;
+};
+
+static ProfileStage * s_stages;
+static ProfileRing * s_rings;
+static pthread_mutex_t s_mutex = PTHREAD_MUTEX_INITIALIZER;
+static __thread ProfileRing * t_ring;
+
+volatile int Profiler::s_dump_requested;
+
+static int Bucket(long long ns)
+{
+	long long us = ns / 1000;
+	if (us < 1)
+	{
+		return 0;
+	}
+	// the octave from the top bit and the quarter from the two below it
+	int octave = 63 - __builtin_clzll(us);
+	int quarter = octave >= 2? (int)((us >> (octave - 2)) & 3) : (int)((us << (2 - octave)) & 3);
+	int bucket = octave * 4 + quarter;
+	return bucket < PROFILE_BUCKETS? bucket : PROFILE_BUCKETS - 1;
+}
+
+// the end of the bucket in ms
+static float BucketLimit(int bucket)
+{
+	int octave = bucket / 4;
+	int quarter = bucket % 4;
+	return (1LL << octave) * (1.f + (quarter + 1) * 0.25f) / 1000.f;
+}
+
+ProfileStage::ProfileStage(const char * name)
+{
+	_name = name;
+	pthread_mutex_lock(&s_mutex);
+	_next = s_stages;
+	s_stages = this;
+	pthread_mutex_unlock(&s_mutex);
+}
+
+void ProfileHistogram::Add(long long ns)
+{
+	__atomic_fetch_add(&_buckets[Bucket(ns)], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&_count, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&_total_ns, ns, __ATOMIC_RELAXED);
+	if (ns > _max_ns)
+	{
+		_max_ns = ns;
+	}
+}
+
+float ProfileHistogram::percentile_ms(float fraction)
+{
+	unsigned int target = (unsigned int)(_count * fraction);
+	unsigned int seen = 0;
+	for (int i = 0; i < PROFILE_BUCKETS; i++)
+	{
+		seen += _buckets[i];
+		if (seen > target)
+		{
+			// the max is better than the bucket when it is in it
+			float limit = BucketLimit(i);
+			float max = _max_ns / 1000000.f;
+			return max < limit? max : limit;
+		}
+	}
+	return _max_ns / 1000000.f;
+}
+
+void ProfileHistogram::Reset()
+{
+	memset(_buckets, 0, sizeof(_buckets));
+	_count = 0;
+	_total_ns = 0;
+	_max_ns = 0;
+}
+
+long long ProfileScope::End()
+{
+	if (!_stage)
+	{
+		return 0;
+	}
+	long long end = GetTimeNs();
+	_stage->Add(end - _start);
+
+	ProfileRing * ring = t_ring;
+	if (!ring)
+	{
+		ring = (ProfileRing *)calloc(1, sizeof(ProfileRing));
+		ring->_tid = (int)syscall(SYS_gettid);
+		pthread_getname_np(pthread_self(), ring->_thread, sizeof(ring->_thread));
+		pthread_mutex_lock(&s_mutex);
+		ring->_next = s_rings;
+		s_rings = ring;
+		pthread_mutex_unlock(&s_mutex);
+		t_ring = ring;
+	}
+	ProfileEvent &event = ring->_events[ring->_head % PROFILE_RING];
+	event._stage = _stage;
+	event._start = _start;
+	event._end = end;
+	__atomic_store_n(&ring->_head, ring->_head + 1, __ATOMIC_RELEASE);
+	_stage = NULL;
+	return end - _start;
+}
+
+void Profiler::Report(FILE * file)
+{
+	pthread_mutex_lock(&s_mutex);
+	for (ProfileStage * stage = s_stages; stage; stage = stage->_next)
+	{
+		if (!stage->_count)
+		{
+			continue;
+		}
+		fprintf(file, "  %-14s p50 %6.2f p90 %6.2f p99 %6.2f max %6.2f ms, avg %.3f over %u\n", stage->_name,
+				stage->percentile_ms(0.5f), stage->percentile_ms(0.9f), stage->percentile_ms(0.99f),
+				stage->max_ms(), stage->avg_ms(), stage->_count);
+		stage->Reset();
+	}
+	pthread_mutex_unlock(&s_mutex);
+}
+
+bool Profiler::DumpTrace(const char * path, float seconds)
+{
+	FILE * file = fopen(path, "w");
+	if (!file)
+	{
+		fprintf(stderr, "profile: unable to write %s\n", path);
+		return false;
+	}
+	long long since = GetTimeNs() - (long long)(seconds * 1e9f);
+	int pid = (int)getpid();
+	int events = 0;
+	bool first = true;
+	fprintf(file, "{\"traceEvents\":[\n");
+	pthread_mutex_lock(&s_mutex);
+	for (ProfileRing * ring = s_rings; ring; ring = ring->_next)
+	{
+		fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+				first? "" : ",\n", pid, ring->_tid, ring->_thread);
+		first = false;
+		unsigned int head = __atomic_load_n(&ring->_head, __ATOMIC_ACQUIRE);
+		unsigned int count = head < PROFILE_RING? head : PROFILE_RING;
+		for (unsigned int i = head - count; i != head; i++)
+		{
+			// the owner may be overwriting the oldest ones as we go
+			ProfileEvent event = ring->_events[i % PROFILE_RING];
+			if (event._end < since || event._end < event._start || !event._stage)
+			{
+				continue;
+			}
+			fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+					event._stage->name(), pid, ring->_tid, event._start / 1000.0, (event._end - event._start) / 1000.0);
+			events++;
+		}
+	}
+	pthread_mutex_unlock(&s_mutex);
+	fprintf(file, "\n],\"displayTimeUnit\":\"ms\"}\n");
+	fclose(file);
+	printf("profile: %d events of the last %.1f s in %s\n", events, seconds, path);
+	return true;
+}
+
+void Profiler::OnSignal(int)
+{
+	RequestDump();
+}
+
+void Profiler::DumpOnSignal(int signal)
+{
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = OnSignal;
+	sigemptyset(&action.sa_mask);
+	action.sa_flags = SA_RESTART;
+	sigaction(signal, &action, NULL);
+}
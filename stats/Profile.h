@@ -0,0 +1,106 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdio.h>
+#include "Clock.h"
+
+// quarter octaves from 1 us, the last one takes anything from about 1 s up
+#define PROFILE_BUCKETS 80
+// per thread, a little over 10 s of the main loop at 90 Hz
+#define PROFILE_RING 65536
+
+// Durations in quarter octave buckets, for anything that wants percentiles
+// without keeping the samples.
+class ProfileHistogram
+{
+protected:
+	unsigned int _buckets[PROFILE_BUCKETS];
+	unsigned int _count;
+	long long _total_ns;
+	long long _max_ns;
+
+public:
+	ProfileHistogram() { Reset(); }
+
+	void Add(long long ns);
+	unsigned int count() { return _count; }
+	float avg_ms() { return _count? _total_ns / (_count * 1000000.f) : 0.f; }
+	float max_ms() { return _max_ns / 1000000.f; }
+	// the upper bound of the bucket the fraction falls in
+	float percentile_ms(float fraction);
+	void Reset();
+};
+
+// One named stage of the frame, with a histogram of how long it took since
+// the last Profiler::Report. Declared through PROFILE, which keeps one per
+// call site.
+class ProfileStage : public ProfileHistogram
+{
+protected:
+	const char * _name;
+	ProfileStage * _next;
+
+	friend class Profiler;
+
+public:
+	ProfileStage(const char * name);
+
+	const char * name() { return _name; }
+};
+
+// Times its scope into the stage's histogram and the thread's ring.
+class ProfileScope
+{
+protected:
+	ProfileStage * _stage;
+	long long _start;
+
+public:
+	ProfileScope(ProfileStage &stage)
+	{
+		_stage = &stage;
+		_start = GetTimeNs();
+	}
+	~ProfileScope() { End(); }
+
+	// for stages that don't fit a block, the destructor does nothing after,
+	// returns how long it took or 0 if it already ended
+	long long End();
+};
+
+#define PROFILE_CONCAT2(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT2(a, b)
+#define PROFILE(name) \
+	static ProfileStage PROFILE_CONCAT(s_profile_stage_, __LINE__)(name); \
+	ProfileScope PROFILE_CONCAT(profile_scope_, __LINE__)(PROFILE_CONCAT(s_profile_stage_, __LINE__))
+
+class Profiler
+{
+protected:
+	static volatile int s_dump_requested;
+
+	static void OnSignal(int signal);
+
+public:
+	// percentiles of every stage that ran since the last report, then starts over
+	static void Report(FILE * file);
+
+	// the scopes every thread ended in the last seconds, as Chrome trace
+	// events for chrome://tracing or Perfetto
+	static bool DumpTrace(const char * path, float seconds);
+
+	// async signal safe, the main loop does the dump when it sees it
+	static void RequestDump() { s_dump_requested = 1; }
+	static bool DumpRequested()
+	{
+		if (!s_dump_requested)
+		{
+			return false;
+		}
+		s_dump_requested = 0;
+		return true;
+	}
+	static void DumpOnSignal(int signal);
+};
+
+#endif//PROFILE_H
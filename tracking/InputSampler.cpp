@@ -0,0 +1,235 @@
+
+#include <stdio.h>
+#include <string.h>
+#include "Clock.h"
+#include "InputSampler.h"
+
+// same hysteresis the per frame VRInputPressed/VRInputReleased use
+#define PRESS_THRESHOLD 0.75f
+#define RELEASE_THRESHOLD 0.25f
+
+InputSampler::InputSampler(Poll poll, void * context, float rate)
+{
+	_poll = poll;
+	_context = context;
+	_interval_ns = (long long)(1000000000.0 / (rate > 1.f? rate : 1.f));
+	_running = false;
+	_samples = 0;
+	_overruns = 0;
+	_nhistory = 0;
+	_newest = 0;
+	_has_pending = false;
+	memset(_down, 0, sizeof(_down));
+	ClearEdges();
+}
+
+InputSampler::~InputSampler()
+{
+	Stop();
+}
+
+bool InputSampler::Start()
+{
+	__atomic_store_n(&_running, true, __ATOMIC_RELEASE);
+	if (pthread_create(&_thread, NULL, Run, this))
+	{
+		_running = false;
+		fprintf(stderr, "input: unable to start the sampling thread\n");
+		return false;
+	}
+	return true;
+}
+
+void InputSampler::Stop()
+{
+	if (!_running)
+	{
+		return;
+	}
+	__atomic_store_n(&_running, false, __ATOMIC_RELEASE);
+	pthread_join(_thread, NULL);
+}
+
+void * InputSampler::Run(void * self)
+{
+	((InputSampler *)self)->Loop();
+	return NULL;
+}
+
+void InputSampler::Loop()
+{
+	long long next = GetTimeNs();
+	while (__atomic_load_n(&_running, __ATOMIC_ACQUIRE))
+	{
+		PoseSample sample;
+		memset(sample._controls, 0, sizeof(sample._controls));
+		sample._hands = _poll(_context, sample._left, sample._right, sample._controls);
+		sample._time_ns = GetTimeNs();
+
+		if (_ring.Push(sample))
+		{
+			__atomic_store_n(&_samples, _samples + 1, __ATOMIC_RELAXED);
+		}
+		else
+		{
+			// nobody drained for a whole ring, newer samples matter more anyway
+			__atomic_store_n(&_overruns, _overruns + 1, __ATOMIC_RELAXED);
+		}
+
+		next += _interval_ns;
+		long long now = GetTimeNs();
+		if (next < now)
+		{
+			// fell behind, don't try to catch up with a burst of polls
+			next = now;
+			continue;
+		}
+		timespec ts;
+		ts.tv_sec = next / 1000000000LL;
+		ts.tv_nsec = next % 1000000000LL;
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+	}
+}
+
+// Counts the edges sample makes against the current button state. Without
+// apply it only reports how many would land on a control that already has
+// an edge pending, which Update uses to hold the sample back.
+int InputSampler::Edges(const PoseSample &sample, bool apply)
+{
+	int repeats = 0;
+	for (int i = 0; i < POSE_CONTROLS; i++)
+	{
+		float value = sample._controls[i];
+		bool press = !_down[i] && value > PRESS_THRESHOLD;
+		bool release = _down[i] && value < RELEASE_THRESHOLD;
+		if (!press && !release)
+		{
+			continue;
+		}
+		if (!apply)
+		{
+			if (_pressed[i] || _released[i])
+			{
+				repeats++;
+			}
+			continue;
+		}
+		_down[i] = press;
+		if (press)
+		{
+			_pressed[i]++;
+		}
+		else
+		{
+			_released[i]++;
+		}
+	}
+	return repeats;
+}
+
+int InputSampler::Update()
+{
+	int count = 0;
+	for (;;)
+	{
+		PoseSample sample;
+		if (_has_pending)
+		{
+			sample = _pending;
+		}
+		else if (!_ring.Pop(sample))
+		{
+			break;
+		}
+
+		// a second edge on one control waits for the next frame, so a quick
+		// click still reaches the frame code as a press and then a release
+		if (Edges(sample, false))
+		{
+			_pending = sample;
+			_has_pending = true;
+			break;
+		}
+		_has_pending = false;
+		Edges(sample, true);
+
+		_newest = (_newest + 1) % INPUTSAMPLER_HISTORY;
+		_history[_newest] = sample;
+		if (_nhistory < INPUTSAMPLER_HISTORY)
+		{
+			_nhistory++;
+		}
+		count++;
+	}
+	return count;
+}
+
+bool InputSampler::Latest(PoseSample &sample)
+{
+	if (!_nhistory)
+	{
+		return false;
+	}
+	sample = _history[_newest];
+	return true;
+}
+
+static void Lerp(const Matrix &a, const Matrix &b, float t, Matrix &m)
+{
+	for (int i = 0; i < 16; i++)
+	{
+		m._m[i] = a._m[i] + (b._m[i] - a._m[i]) * t;
+	}
+	// the samples are a few ms apart, renormalising the axes is close enough
+	// to a slerp of the rotation
+	m.right().normalize();
+	m.up().normalize();
+	m.back().normalize();
+}
+
+bool InputSampler::At(long long time_ns, PoseSample &sample)
+{
+	if (!_nhistory)
+	{
+		return false;
+	}
+
+	int newer = _newest;
+	for (int i = 1; i < _nhistory; i++)
+	{
+		int older = (_newest - i + INPUTSAMPLER_HISTORY) % INPUTSAMPLER_HISTORY;
+		const PoseSample &a = _history[older];
+		const PoseSample &b = _history[newer];
+		if (a._time_ns <= time_ns)
+		{
+			if (b._time_ns <= time_ns || b._time_ns == a._time_ns)
+			{
+				sample = b;
+				return true;
+			}
+			float t = (time_ns - a._time_ns) / (float)(b._time_ns - a._time_ns);
+			sample = a;
+			sample._time_ns = time_ns;
+			sample._hands = a._hands & b._hands;
+			if (sample._hands & 1)
+			{
+				Lerp(a._left, b._left, t, sample._left);
+			}
+			if (sample._hands & 2)
+			{
+				Lerp(a._right, b._right, t, sample._right);
+			}
+			return true;
+		}
+		newer = older;
+	}
+	// older than anything kept
+	sample = _history[newer];
+	return true;
+}
+
+void InputSampler::ClearEdges()
+{
+	memset(_pressed, 0, sizeof(_pressed));
+	memset(_released, 0, sizeof(_released));
+}
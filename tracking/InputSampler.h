@@ -0,0 +1,72 @@
+#ifndef INPUTSAMPLER_H
+#define INPUTSAMPLER_H
+
+#include <pthread.h>
+#include "PoseRing.h"
+
+#define INPUTSAMPLER_HISTORY 8
+
+// Polls the trackers on its own thread at their native rate instead of once
+// per frame. The render thread drains the samples, keeps the last few to
+// interpolate between, and rebuilds button edges from every sample so a
+// press and release between two frames is still seen.
+
+class InputSampler
+{
+public:
+	// fills in the hands it saw, as bits, and the controls of both
+	typedef int (*Poll)(void * context, Matrix &left, Matrix &right, float * controls);
+
+protected:
+	Poll _poll;
+	void * _context;
+	long long _interval_ns;
+
+	pthread_t _thread;
+	bool _running;
+	PoseRing _ring;
+
+	// written by the sampling thread only
+	int _samples;
+	int _overruns;
+
+	// everything below belongs to the render thread
+	PoseSample _history[INPUTSAMPLER_HISTORY];
+	int _nhistory;
+	int _newest;
+	PoseSample _pending;
+	bool _has_pending;
+
+	bool _down[POSE_CONTROLS];
+	int _pressed[POSE_CONTROLS];
+	int _released[POSE_CONTROLS];
+
+	static void * Run(void * self);
+	void Loop();
+	int Edges(const PoseSample &sample, bool apply);
+
+public:
+	InputSampler(Poll poll, void * context, float rate = 250.f);
+	~InputSampler();
+
+	bool Start();
+	void Stop();
+
+	// drains what was sampled since the last call, returns how many samples
+	int Update();
+
+	bool Latest(PoseSample &sample);
+	// interpolated between the two samples around time_ns, never extrapolated
+	bool At(long long time_ns, PoseSample &sample);
+
+	// edges seen by Update since the last ClearEdges
+	int pressed(int control) { return _pressed[control]; }
+	int released(int control) { return _released[control]; }
+	bool down(int control) { return _down[control]; }
+	void ClearEdges();
+
+	int samples() { return __atomic_load_n(&_samples, __ATOMIC_RELAXED); }
+	int overruns() { return __atomic_load_n(&_overruns, __ATOMIC_RELAXED); }
+};
+
+#endif//INPUTSAMPLER_H
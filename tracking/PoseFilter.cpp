@@ -0,0 +1,100 @@
+
+#include <math.h>
+#include <string.h>
+#include "PoseFilter.h"
+
+// seconds
+#define MAX_LEAD 0.1f
+
+// matrix elements filtered as the rotation and the translation groups
+static const int s_elements[12] = { 0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14 };
+
+static inline float Alpha(float cutoff, float dt)
+{
+	float tau = 1.f / (2.f * (float)M_PI * cutoff);
+	return 1.f / (1.f + tau / dt);
+}
+
+static void Orthonormalize(Matrix &m)
+{
+	Vector4 &r = m.right();
+	Vector4 &u = m.up();
+	Vector4 &b = m.back();
+	r.normalize();
+	float d = Dot(u, r);
+	u._x -= r._x * d;
+	u._y -= r._y * d;
+	u._z -= r._z * d;
+	u.normalize();
+	b._x = r._y * u._z - r._z * u._y;
+	b._y = r._z * u._x - r._x * u._z;
+	b._z = r._x * u._y - r._y * u._x;
+}
+
+PoseFilter::PoseFilter()
+{
+	_primed = false;
+	_last_ns = 0;
+	memset(_x, 0, sizeof(_x));
+	memset(_dx, 0, sizeof(_dx));
+	memset(_raw, 0, sizeof(_raw));
+}
+
+void PoseFilter::Filter(const Matrix &pose, long long time_ns, long long display_ns, Matrix &out)
+{
+	float dt = (time_ns - _last_ns) * 1e-9f;
+	if (!_primed || dt < 0.f || dt > 0.5f)
+	{
+		// first sample, or a gap long enough that the history means nothing
+		for (int i = 0; i < 12; i++)
+		{
+			_x[i] = _raw[i] = pose._m[s_elements[i]];
+			_dx[i] = 0.f;
+		}
+		_primed = true;
+		_last_ns = time_ns;
+		out = pose;
+		return;
+	}
+	_last_ns = time_ns;
+
+	// the same sample again only gets predicted further
+	float da = dt > 0.f? Alpha(_params._d_cutoff, dt) : 0.f;
+	for (int group = 0; group < 2 && dt > 0.f; group++)
+	{
+		int first = group? 9 : 0;
+		int last = group? 12 : 9;
+
+		// the speed comes from the smoothed derivative of the raw input
+		float speed = 0.f;
+		for (int i = first; i < last; i++)
+		{
+			float value = pose._m[s_elements[i]];
+			float d = (value - _raw[i]) / dt;
+			_dx[i] += da * (d - _dx[i]);
+			speed += _dx[i] * _dx[i];
+			_raw[i] = value;
+		}
+		speed = sqrtf(speed);
+
+		float beta = group? _params._beta : _params._rotation_beta;
+		float a = Alpha(_params._min_cutoff + beta * speed, dt);
+		for (int i = first; i < last; i++)
+		{
+			_x[i] += a * (_raw[i] - _x[i]);
+		}
+	}
+
+	// constant velocity only holds for so long
+	float lead = (display_ns - time_ns) * 1e-9f + _params._lead_ms * 0.001f;
+	if (lead > MAX_LEAD)
+		lead = MAX_LEAD;
+	if (lead < -MAX_LEAD)
+		lead = -MAX_LEAD;
+	out = pose;
+	for (int i = 0; i < 12; i++)
+	{
+		out._m[s_elements[i]] = _x[i] + _dx[i] * lead;
+	}
+	Orthonormalize(out);
+}
@@ -0,0 +1,60 @@
+#ifndef POSEFILTER_H
+#define POSEFILTER_H
+
+#include "Matrix.h"
+
+// One Euro filter parameters for one device. The cutoff rises from
+// min_cutoff with the filtered speed, so a still hand is smoothed hard and
+// a fast one barely lags. lead_ms is added to the prediction Filter does
+// towards the display time, to make up for latency it can't see.
+struct PoseFilterParams
+{
+	float _min_cutoff;	// Hz
+	float _beta;		// Hz per unit per second of translation
+	float _rotation_beta;	// Hz per radian per second, roughly
+	float _d_cutoff;	// Hz, for the velocity estimate
+	float _lead_ms;
+
+	PoseFilterParams(float min_cutoff = 1.f, float beta = 0.5f, float rotation_beta = 0.5f,
+			float d_cutoff = 1.f, float lead_ms = 0.f)
+	{
+		_min_cutoff = min_cutoff;
+		_beta = beta;
+		_rotation_beta = rotation_beta;
+		_d_cutoff = d_cutoff;
+		_lead_ms = lead_ms;
+	}
+};
+
+// Filters a rigid pose as two groups, the translation and the rotation
+// axes, each with its own speed driving the cutoff. The rotation is put
+// back together orthonormal afterwards.
+
+class PoseFilter
+{
+protected:
+	PoseFilterParams _params;
+	bool _primed;
+	long long _last_ns;
+
+	// the 9 rotation elements then the 3 of the translation
+	float _x[12];
+	float _dx[12];
+	float _raw[12];
+
+public:
+	PoseFilter();
+
+	void SetParams(const PoseFilterParams &params) { _params = params; }
+	const PoseFilterParams & params() { return _params; }
+
+	// pose sampled at time_ns, out is filtered and extrapolated along the
+	// filtered velocity to display_ns plus lead_ms, pose and out may alias
+	void Filter(const Matrix &pose, long long time_ns, long long display_ns, Matrix &out);
+	void Reset() { _primed = false; }
+
+	// filtered, in units per second, valid after the first two samples
+	Vector3 velocity() { return Vector3(_dx[9], _dx[10], _dx[11]); }
+};
+
+#endif//POSEFILTER_H
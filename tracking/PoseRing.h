@@ -0,0 +1,65 @@
+#ifndef POSERING_H
+#define POSERING_H
+
+#include "Matrix.h"
+
+#define POSE_CONTROLS 20
+
+// a power of two, about a second of samples at the usual tracker rates
+#define POSERING_SIZE 256
+
+struct PoseSample
+{
+	long long _time_ns;
+	int _hands;
+	Matrix _left;
+	Matrix _right;
+	float _controls[POSE_CONTROLS];
+};
+
+// Single producer, single consumer ring. Each side only ever writes its own
+// index, the other one's is read with acquire so the sample it covers is
+// complete. The indices sit on their own cache lines.
+
+class PoseRing
+{
+protected:
+	PoseSample _samples[POSERING_SIZE];
+	unsigned int _head __attribute__((aligned(64)));
+	unsigned int _tail __attribute__((aligned(64)));
+
+public:
+	PoseRing()
+	{
+		_head = 0;
+		_tail = 0;
+	}
+
+	// producer side, fails when the consumer is a whole ring behind
+	bool Push(const PoseSample &sample)
+	{
+		unsigned int head = _head;
+		if (head - __atomic_load_n(&_tail, __ATOMIC_ACQUIRE) >= POSERING_SIZE)
+		{
+			return false;
+		}
+		_samples[head & (POSERING_SIZE - 1)] = sample;
+		__atomic_store_n(&_head, head + 1, __ATOMIC_RELEASE);
+		return true;
+	}
+
+	// consumer side
+	bool Pop(PoseSample &sample)
+	{
+		unsigned int tail = _tail;
+		if (tail == __atomic_load_n(&_head, __ATOMIC_ACQUIRE))
+		{
+			return false;
+		}
+		sample = _samples[tail & (POSERING_SIZE - 1)];
+		__atomic_store_n(&_tail, tail + 1, __ATOMIC_RELEASE);
+		return true;
+	}
+};
+
+#endif//POSERING_H
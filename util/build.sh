@@ -2,3 +2,10 @@
 g++ -g -lX11 dump.cpp -o dump
 
 
+g++ -g -I../vertex -I../tracking posetrace.cpp ../tracking/PoseFilter.cpp ../vertex/Matrix.cpp ../vertex/Vector.cpp -o posetrace
+
+
+g++ -g -lX11 loadgen.cpp -o loadgen
+
+
+g++ -g x3dctl.cpp -o x3dctl
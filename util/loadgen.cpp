@@ -0,0 +1,336 @@
+
+// Desktop load for sizing the damage, capture and upload path. Creates
+// windows on a display, usually an Xvfb x3d runs on, and repaints part of
+// each at a set rate, stepping through every window count and scenario
+// given. Each step is named in the _X3D_SCENARIO property of the root
+// window, which x3d reports frame times and capture rates against.
+//
+// loadgen [-d display] [-windows 1,4,16] [-size WxH] [-rate hz]
+//         [-scenario text,video,blink,mixed] [-fraction f] [-seconds s]
+//
+//  text   scrolls the top fraction of the window a line and draws a new one
+//  video  puts new pixels over the top fraction of the window
+//  blink  flips small squares covering the fraction of the window, 1% by default
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/Xatom.h>
+
+#define LINE_HEIGHT 14
+#define BLINK_SIZE 16
+#define MAX_STEPS 32
+
+enum Scenario { TEXT, VIDEO, BLINK, MIXED, SCENARIOS };
+static const char * s_names[SCENARIOS] = { "text", "video", "blink", "mixed" };
+static const float s_fractions[SCENARIOS] = { 1.f, 1.f, 0.01f, 1.f };
+
+struct Load
+{
+	Window _w;
+	Scenario _scenario;
+	XImage * _image;
+	int _blink;
+};
+
+static Display * s_dpy;
+static GC s_gc;
+static int s_width = 640;
+static int s_height = 480;
+static float s_fraction = -1.f;
+static long long s_painted;
+
+static long long Now()
+{
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void SleepUntil(long long ns)
+{
+	timespec ts;
+	ts.tv_sec = ns / 1000000000LL;
+	ts.tv_nsec = ns % 1000000000LL;
+	clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+}
+
+static float Fraction(Scenario scenario)
+{
+	return s_fraction >= 0.f? s_fraction : s_fractions[scenario];
+}
+
+static void Create(Load &load, int index, int count, Scenario scenario)
+{
+	int screen = DefaultScreen(s_dpy);
+	int sw = DisplayWidth(s_dpy, screen);
+	int sh = DisplayHeight(s_dpy, screen);
+
+	// a grid while they fit, cascading over it after that
+	int cols = sw / s_width > 0? sw / s_width : 1;
+	int rows = sh / s_height > 0? sh / s_height : 1;
+	int cell = index % (cols * rows);
+	int layer = index / (cols * rows);
+	int x = (cell % cols) * s_width + layer * 24;
+	int y = (cell / cols) * s_height + layer * 24;
+
+	XSetWindowAttributes attributes;
+	attributes.override_redirect = True;
+	attributes.background_pixel = WhitePixel(s_dpy, screen);
+	load._w = XCreateWindow(s_dpy, DefaultRootWindow(s_dpy), x % sw, y % sh, s_width, s_height, 0,
+			CopyFromParent, InputOutput, CopyFromParent, CWOverrideRedirect | CWBackPixel, &attributes);
+	char name[64];
+	snprintf(name, sizeof(name), "loadgen %s %d/%d", s_names[scenario], index + 1, count);
+	XStoreName(s_dpy, load._w, name);
+	load._scenario = scenario;
+	load._blink = 0;
+	load._image = NULL;
+	if (scenario == VIDEO)
+	{
+		int height = (int)(s_height * Fraction(scenario));
+		if (height < 1)
+			height = 1;
+		load._image = XCreateImage(s_dpy, DefaultVisual(s_dpy, screen), DefaultDepth(s_dpy, screen), ZPixmap, 0,
+				NULL, s_width, height, 32, 0);
+		load._image->data = (char *)malloc(load._image->bytes_per_line * height);
+	}
+	XMapWindow(s_dpy, load._w);
+}
+
+static void Destroy(Load &load)
+{
+	if (load._image)
+	{
+		// frees the data as well
+		XDestroyImage(load._image);
+	}
+	XDestroyWindow(s_dpy, load._w);
+}
+
+static void PaintText(Load &load, int tick)
+{
+	int height = (int)(s_height * Fraction(TEXT));
+	if (height < LINE_HEIGHT * 2)
+		height = LINE_HEIGHT * 2;
+	if (height > s_height)
+		height = s_height;
+	XCopyArea(s_dpy, load._w, load._w, s_gc, 0, LINE_HEIGHT, s_width, height - LINE_HEIGHT, 0, 0);
+	XSetForeground(s_dpy, s_gc, WhitePixel(s_dpy, DefaultScreen(s_dpy)));
+	XFillRectangle(s_dpy, load._w, s_gc, 0, height - LINE_HEIGHT, s_width, LINE_HEIGHT);
+	XSetForeground(s_dpy, s_gc, BlackPixel(s_dpy, DefaultScreen(s_dpy)));
+	char line[256];
+	int length = snprintf(line, sizeof(line), "%08d the quick brown fox jumps over the lazy dog %x", tick, tick * 2654435761u);
+	XDrawString(s_dpy, load._w, s_gc, 2 + tick % 40, height - 3, line, length);
+	s_painted += s_width * height;
+}
+
+static void PaintVideo(Load &load, int tick)
+{
+	XImage * image = load._image;
+	for (int y = 0; y < image->height; y++)
+	{
+		unsigned int * row = (unsigned int *)(image->data + y * image->bytes_per_line);
+		for (int x = 0; x < image->width; x++)
+		{
+			unsigned int v = (x + tick * 5) ^ (y + tick * 3);
+			unsigned int pixel = ((v & 0xff) << 16) | (((v >> 1) & 0xff) << 8) | ((x * y + tick) & 0xff);
+			if (image->bits_per_pixel == 32)
+				row[x] = pixel;
+			else
+				XPutPixel(image, x, y, pixel);
+		}
+	}
+	XPutImage(s_dpy, load._w, s_gc, image, 0, 0, 0, 0, image->width, image->height);
+	s_painted += image->width * image->height;
+}
+
+static void PaintBlink(Load &load, int tick)
+{
+	int squares = (int)(s_width * s_height * Fraction(BLINK) / (BLINK_SIZE * BLINK_SIZE));
+	if (squares < 1)
+		squares = 1;
+	int cols = s_width / BLINK_SIZE;
+	int cells = cols * (s_height / BLINK_SIZE);
+	if (cells < 1)
+		return;
+	load._blink = !load._blink;
+	XSetForeground(s_dpy, s_gc, load._blink? BlackPixel(s_dpy, DefaultScreen(s_dpy)) : WhitePixel(s_dpy, DefaultScreen(s_dpy)));
+	for (int i = 0; i < squares && i < cells; i++)
+	{
+		// spread out, like cursors and spinners in different places
+		int cell = (int)((i * 2654435761u) % cells);
+		XFillRectangle(s_dpy, load._w, s_gc, (cell % cols) * BLINK_SIZE, (cell / cols) * BLINK_SIZE,
+				BLINK_SIZE, BLINK_SIZE);
+	}
+	s_painted += squares * BLINK_SIZE * BLINK_SIZE;
+}
+
+static void Paint(Load &load, int tick)
+{
+	switch (load._scenario)
+	{
+	case TEXT: PaintText(load, tick); break;
+	case VIDEO: PaintVideo(load, tick); break;
+	case BLINK: PaintBlink(load, tick); break;
+	default: break;
+	}
+}
+
+static int ParseList(const char * list, int * values, const char * const * names, int nnames)
+{
+	int count = 0;
+	char buffer[256];
+	strncpy(buffer, list, sizeof(buffer) - 1);
+	buffer[sizeof(buffer) - 1] = 0;
+	for (char * item = strtok(buffer, ","); item && count < MAX_STEPS; item = strtok(NULL, ","))
+	{
+		if (!names)
+		{
+			values[count++] = atoi(item);
+			continue;
+		}
+		for (int i = 0; i < nnames; i++)
+		{
+			if (!strcmp(item, names[i]))
+			{
+				values[count++] = i;
+				break;
+			}
+		}
+	}
+	return count;
+}
+
+static void usage(const char * program)
+{
+	fprintf(stderr, "usage: %s [-d display] [-windows 1,4,16] [-size WxH] [-rate hz] [-scenario text,video,blink,mixed] [-fraction f] [-seconds s]\n", program);
+}
+
+int main(int argc, char **argv)
+{
+	const char * display_name = NULL;
+	int counts[MAX_STEPS] = { 1, 4, 16 };
+	int ncounts = 3;
+	int scenarios[MAX_STEPS] = { TEXT, VIDEO, BLINK };
+	int nscenarios = 3;
+	float rate = 60.f;
+	float seconds = 10.f;
+
+	for (int i = 1; i < argc; i++)
+	{
+		char *arg = argv[i];
+		if (i + 1 >= argc)
+		{
+			usage(argv[0]);
+			return 1;
+		}
+		if (!strcmp(arg, "-d"))
+			display_name = argv[++i];
+		else if (!strcmp(arg, "-windows"))
+			ncounts = ParseList(argv[++i], counts, NULL, 0);
+		else if (!strcmp(arg, "-size"))
+			sscanf(argv[++i], "%dx%d", &s_width, &s_height);
+		else if (!strcmp(arg, "-rate"))
+			rate = atof(argv[++i]);
+		else if (!strcmp(arg, "-scenario"))
+			nscenarios = ParseList(argv[++i], scenarios, s_names, SCENARIOS);
+		else if (!strcmp(arg, "-fraction"))
+			s_fraction = atof(argv[++i]);
+		else if (!strcmp(arg, "-seconds"))
+			seconds = atof(argv[++i]);
+		else
+		{
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (!ncounts || !nscenarios || rate <= 0.f || s_width < 1 || s_height < 1)
+	{
+		usage(argv[0]);
+		return 1;
+	}
+
+	s_dpy = XOpenDisplay(display_name);
+	if (!s_dpy)
+	{
+		fprintf(stderr, "unable to open display '%s'\n", XDisplayName(display_name));
+		return 1;
+	}
+	Window root = DefaultRootWindow(s_dpy);
+	Atom scenario_atom = XInternAtom(s_dpy, "_X3D_SCENARIO", False);
+	XGCValues values;
+	// scrolling copies within the window, no exposures for what it can't see
+	values.graphics_exposures = False;
+	s_gc = XCreateGC(s_dpy, root, GCGraphicsExposures, &values);
+
+	long long interval = (long long)(1000000000.0 / rate);
+	for (int c = 0; c < ncounts; c++)
+	{
+		for (int s = 0; s < nscenarios; s++)
+		{
+			int count = counts[c];
+			Load * loads = new Load[count];
+			for (int i = 0; i < count; i++)
+			{
+				Scenario scenario = (Scenario)scenarios[s];
+				if (scenario == MIXED)
+					scenario = (Scenario)(i % MIXED);
+				Create(loads[i], i, count, scenario);
+			}
+			XSync(s_dpy, False);
+
+			// let x3d pick the new windows up before the measured part
+			SleepUntil(Now() + 500000000LL);
+
+			char name[128];
+			snprintf(name, sizeof(name), "%s %d %dx%d %.0fHz", s_names[scenarios[s]], count, s_width, s_height, rate);
+			XChangeProperty(s_dpy, root, scenario_atom, XA_STRING, 8, PropModeReplace,
+					(unsigned char *)name, strlen(name));
+			printf("%s\n", name);
+
+			s_painted = 0;
+			long long start = Now();
+			long long end = start + (long long)(seconds * 1e9f);
+			long long next = start;
+			int tick = 0;
+			int late = 0;
+			while (next < end)
+			{
+				for (int i = 0; i < count; i++)
+				{
+					Paint(loads[i], tick);
+				}
+				XSync(s_dpy, False);
+				tick++;
+				next += interval;
+				long long now = Now();
+				if (now > next)
+				{
+					// the server can't keep up, count it rather than burst
+					late++;
+					next = now;
+				}
+				SleepUntil(next);
+			}
+			float elapsed = (Now() - start) * 1e-9f;
+			printf("  %d ticks in %.2f s, %d late, %.1f Mpixels/s painted\n", tick, elapsed, late,
+					s_painted / (elapsed * 1000000.f));
+
+			// ends the step before the windows go
+			XDeleteProperty(s_dpy, root, scenario_atom);
+			for (int i = 0; i < count; i++)
+			{
+				Destroy(loads[i]);
+			}
+			delete [] loads;
+			XSync(s_dpy, False);
+		}
+	}
+
+	XFreeGC(s_dpy, s_gc);
+	XCloseDisplay(s_dpy);
+	return 0;
+}
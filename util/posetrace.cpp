@@ -0,0 +1,240 @@
+
+// Replays a pose trace recorded with x3d -posetrace through PoseFilter and
+// reports jitter and latency against the raw input. Without a trace it makes
+// up a noisy one, moving and resting in turns, to have something to tune on.
+//
+// posetrace [-device left|right|head] [-params min_cutoff,beta[,rotation_beta,lead_ms]] [trace]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "PoseFilter.h"
+
+struct Sample
+{
+	long long _time_ns;
+	Matrix _pose;
+};
+
+static Sample * s_samples;
+static int s_count;
+static int s_max;
+
+static void Add(long long time_ns, const Matrix &pose)
+{
+	if (s_count == s_max)
+	{
+		s_max = s_max? s_max * 2 : 4096;
+		s_samples = (Sample *)realloc(s_samples, s_max * sizeof(Sample));
+	}
+	s_samples[s_count]._time_ns = time_ns;
+	s_samples[s_count]._pose = pose;
+	s_count++;
+}
+
+static bool Load(const char * path, const char * device)
+{
+	FILE * file = fopen(path, "r");
+	if (!file)
+	{
+		fprintf(stderr, "unable to open %s\n", path);
+		return false;
+	}
+	char line[1024];
+	while (fgets(line, sizeof(line), file))
+	{
+		long long time_ns;
+		char name[16];
+		int used;
+		if (sscanf(line, "%lld %15s%n", &time_ns, name, &used) != 2 || strcmp(name, device))
+		{
+			continue;
+		}
+		Matrix pose;
+		const char * p = line + used;
+		int i;
+		for (i = 0; i < 16; i++)
+		{
+			char * end;
+			pose._m[i] = strtof(p, &end);
+			if (end == p)
+			{
+				break;
+			}
+			p = end;
+		}
+		if (i == 16)
+		{
+			Add(time_ns, pose);
+		}
+	}
+	fclose(file);
+	return true;
+}
+
+static float Noise()
+{
+	// close enough to gaussian for this
+	float sum = 0.f;
+	for (int i = 0; i < 4; i++)
+	{
+		sum += rand() / (float)RAND_MAX;
+	}
+	return (sum - 2.f) * 1.7f;
+}
+
+// 20 s at 250 Hz in cm, half a second of sway then half a second still
+static void Synthesize()
+{
+	srand(1);
+	for (int i = 0; i < 5000; i++)
+	{
+		long long time_ns = i * 4000000LL;
+		float t = i * 0.004f;
+		float phase = fmodf(t, 2.f);
+		float x = phase < 1.f? 10.f * sinf(phase * (float)M_PI * 2.f) : 0.f;
+		Matrix pose(Matrix::identity);
+		pose.translation()._x = x + Noise() * 0.1f;
+		pose.translation()._y = 0.5f * x + Noise() * 0.1f;
+		pose.translation()._z = Noise() * 0.1f;
+		Add(time_ns, pose);
+	}
+}
+
+// rms distance from a centred moving average, the part no hand makes
+static float Jitter(const Vector3 * p, int count)
+{
+	const int half = 4;
+	double sum = 0.0;
+	int n = 0;
+	for (int i = half; i < count - half; i++)
+	{
+		Vector3 mean(0.f, 0.f, 0.f);
+		for (int j = -half; j <= half; j++)
+		{
+			mean += p[i + j];
+		}
+		mean /= (float)(half * 2 + 1);
+		Vector3 d = p[i] - mean;
+		sum += Dot(d, d);
+		n++;
+	}
+	return n? (float)sqrt(sum / n) : 0.f;
+}
+
+// the raw position at time_ns, linear between samples
+static Vector3 RawAt(long long time_ns)
+{
+	if (time_ns <= s_samples[0]._time_ns)
+		return Vector3(&s_samples[0]._pose._m[12]);
+	int lo = 0;
+	int hi = s_count - 1;
+	if (time_ns >= s_samples[hi]._time_ns)
+		return Vector3(&s_samples[hi]._pose._m[12]);
+	while (hi - lo > 1)
+	{
+		int mid = (lo + hi) / 2;
+		if (s_samples[mid]._time_ns <= time_ns)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	Vector3 a(&s_samples[lo]._pose._m[12]);
+	Vector3 b(&s_samples[hi]._pose._m[12]);
+	float t = (time_ns - s_samples[lo]._time_ns) / (float)(s_samples[hi]._time_ns - s_samples[lo]._time_ns);
+	return a + (b - a) * t;
+}
+
+// the shift of the raw trace that best explains the filtered one, positive
+// when the filter lags and negative when its prediction leads
+static float Latency(const Vector3 * filtered, int count)
+{
+	float best_ms = 0.f;
+	double best = -1.0;
+	for (float ms = -50.f; ms <= 100.f; ms += 0.5f)
+	{
+		long long shift = (long long)(ms * 1000000.f);
+		double sum = 0.0;
+		for (int i = 0; i < count; i++)
+		{
+			Vector3 d = filtered[i] - RawAt(s_samples[i]._time_ns - shift);
+			sum += Dot(d, d);
+		}
+		if (best < 0.0 || sum < best)
+		{
+			best = sum;
+			best_ms = ms;
+		}
+	}
+	return best_ms;
+}
+
+int main(int argc, char ** argv)
+{
+	const char * device = "right";
+	const char * path = NULL;
+	PoseFilterParams params;
+	for (int i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "-device") && i + 1 < argc)
+		{
+			device = argv[++i];
+		}
+		else if (!strcmp(argv[i], "-params") && i + 1 < argc)
+		{
+			sscanf(argv[++i], "%f,%f,%f,%f", &params._min_cutoff, &params._beta,
+					&params._rotation_beta, &params._lead_ms);
+		}
+		else if (argv[i][0] != '-')
+		{
+			path = argv[i];
+		}
+		else
+		{
+			fprintf(stderr, "usage: %s [-device left|right|head] [-params min_cutoff,beta[,rotation_beta,lead_ms]] [trace]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (path)
+	{
+		if (!Load(path, device))
+		{
+			return 1;
+		}
+	}
+	else
+	{
+		Synthesize();
+	}
+	if (s_count < 16)
+	{
+		fprintf(stderr, "only %d %s samples\n", s_count, device);
+		return 1;
+	}
+
+	Vector3 * raw = new Vector3[s_count];
+	Vector3 * filtered = new Vector3[s_count];
+	PoseFilter filter;
+	filter.SetParams(params);
+	for (int i = 0; i < s_count; i++)
+	{
+		Matrix out;
+		filter.Filter(s_samples[i]._pose, s_samples[i]._time_ns, s_samples[i]._time_ns, out);
+		raw[i] = Vector3(&s_samples[i]._pose._m[12]);
+		filtered[i] = Vector3(&out._m[12]);
+	}
+
+	float seconds = (s_samples[s_count - 1]._time_ns - s_samples[0]._time_ns) * 1e-9f;
+	printf("%d %s samples over %.2f s, %.0f Hz\n", s_count, device, seconds, (s_count - 1) / seconds);
+	printf("params min_cutoff %.2f beta %.3f rotation_beta %.3f lead %.1f ms\n",
+			params._min_cutoff, params._beta, params._rotation_beta, params._lead_ms);
+	printf("jitter raw %.4f filtered %.4f\n", Jitter(raw, s_count), Jitter(filtered, s_count));
+	printf("latency %.1f ms\n", Latency(filtered, s_count));
+
+	delete [] raw;
+	delete [] filtered;
+	free(s_samples);
+	return 0;
+}
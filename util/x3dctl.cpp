@@ -0,0 +1,111 @@
+// Talks to a running x3d started with -control socket. Sends the command
+// given, or every line of stdin without one, and prints the replies.
+//
+// x3dctl socket [command ...]
+//
+//   x3dctl /tmp/x3d.sock stats
+//   x3dctl /tmp/x3d.sock stats json
+//   x3dctl /tmp/x3d.sock get
+//   x3dctl /tmp/x3d.sock set ppi 150 right.beta 0.8
+//
+// Exits 1 if any reply was an error.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define LINE 1024
+
+static FILE * s_replies;
+
+static void usage(const char * program)
+{
+	fprintf(stderr, "usage: %s socket [stats [json] | get [name] | set name value ...]\n", program);
+}
+
+// prints the reply up to its last line, false on an error
+static bool Send(int fd, const char * command)
+{
+	if (send(fd, command, strlen(command), MSG_NOSIGNAL) < 0 || send(fd, "\n", 1, MSG_NOSIGNAL) < 0)
+	{
+		perror("x3dctl: send");
+		return false;
+	}
+	char line[LINE];
+	while (fgets(line, sizeof(line), s_replies))
+	{
+		if (!strcmp(line, "ok\n"))
+		{
+			return true;
+		}
+		if (!strncmp(line, "error", 5))
+		{
+			fputs(line, stderr);
+			return false;
+		}
+		fputs(line, stdout);
+	}
+	fprintf(stderr, "x3dctl: x3d hung up\n");
+	return false;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2 || argv[1][0] == '-')
+	{
+		usage(argv[0]);
+		return 1;
+	}
+
+	sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (strlen(argv[1]) >= sizeof(address.sun_path))
+	{
+		fprintf(stderr, "x3dctl: socket path too long\n");
+		return 1;
+	}
+	strcpy(address.sun_path, argv[1]);
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0 || connect(fd, (sockaddr *)&address, sizeof(address)) < 0)
+	{
+		fprintf(stderr, "x3dctl: unable to connect to %s, is x3d running with -control?\n", argv[1]);
+		return 1;
+	}
+	s_replies = fdopen(dup(fd), "r");
+
+	bool ok = true;
+	if (argc > 2)
+	{
+		char command[LINE] = "";
+		for (int i = 2; i < argc; i++)
+		{
+			if (strlen(command) + strlen(argv[i]) + 2 > sizeof(command))
+			{
+				fprintf(stderr, "x3dctl: command too long\n");
+				return 1;
+			}
+			if (i > 2)
+			{
+				strcat(command, " ");
+			}
+			strcat(command, argv[i]);
+		}
+		ok = Send(fd, command);
+	}
+	else
+	{
+		char line[LINE];
+		while (fgets(line, sizeof(line), stdin))
+		{
+			line[strcspn(line, "\n")] = 0;
+			ok = Send(fd, line) && ok;
+		}
+	}
+	fclose(s_replies);
+	close(fd);
+	return ok? 0 : 1;
+}
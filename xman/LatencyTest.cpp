@@ -0,0 +1,173 @@
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "LatencyTest.h"
+#include "Clock.h"
+
+// a code still on screen after this long is a window x3d stopped capturing
+#define LATENCY_TEST_STALE 2000000000LL
+
+// an 8 bit value into a TrueColor channel of any width
+static unsigned long Channel(unsigned long mask, unsigned int value)
+{
+	int shift = __builtin_ctzl(mask);
+	int bits = __builtin_popcountl(mask);
+	unsigned long scaled = bits >= 8? (unsigned long)value << (bits - 8) : value >> (8 - bits);
+	return (scaled << shift) & mask;
+}
+
+LatencyTest::LatencyTest()
+{
+	_dpy = NULL;
+	_w = None;
+	_running = false;
+	_last = -1;
+	memset(_painted_ns, 0, sizeof(_painted_ns));
+}
+
+LatencyTest::~LatencyTest()
+{
+	Stop();
+}
+
+bool LatencyTest::Start(const char * display_name, int width, int height)
+{
+	_dpy = XOpenDisplay(display_name);
+	if (!_dpy)
+	{
+		fprintf(stderr, "latency test: unable to open display '%s'\n", XDisplayName(display_name));
+		return false;
+	}
+	int screen = DefaultScreen(_dpy);
+	_visual = DefaultVisual(_dpy, screen);
+	if (_visual->c_class != TrueColor)
+	{
+		fprintf(stderr, "latency test: needs a TrueColor visual\n");
+		XCloseDisplay(_dpy);
+		_dpy = NULL;
+		return false;
+	}
+
+	// in a corner, over as little as possible of what x3d captures
+	_width = width;
+	_height = height;
+	XSetWindowAttributes attr;
+	attr.override_redirect = True;
+	attr.background_pixel = BlackPixel(_dpy, screen);
+	_w = XCreateWindow(_dpy, RootWindow(_dpy, screen), DisplayWidth(_dpy, screen) - width,
+			DisplayHeight(_dpy, screen) - height, width, height, 0, CopyFromParent, InputOutput,
+			CopyFromParent, CWOverrideRedirect | CWBackPixel, &attr);
+	XStoreName(_dpy, _w, "x3d latency test");
+	_gc = XCreateGC(_dpy, _w, 0, NULL);
+	XMapWindow(_dpy, _w);
+	XSync(_dpy, False);
+
+	_running = true;
+	if (pthread_create(&_thread, NULL, Run, this))
+	{
+		fprintf(stderr, "latency test: unable to start the thread\n");
+		_running = false;
+		Stop();
+		return false;
+	}
+	return true;
+}
+
+void LatencyTest::Stop()
+{
+	if (!_dpy)
+	{
+		return;
+	}
+	if (__atomic_load_n(&_running, __ATOMIC_ACQUIRE))
+	{
+		__atomic_store_n(&_running, false, __ATOMIC_RELEASE);
+		pthread_join(_thread, NULL);
+	}
+	XFreeGC(_dpy, _gc);
+	XDestroyWindow(_dpy, _w);
+	XCloseDisplay(_dpy);
+	_dpy = NULL;
+	_w = None;
+}
+
+void * LatencyTest::Run(void * context)
+{
+	LatencyTest * test = (LatencyTest *)context;
+	unsigned int seed = (unsigned int)GetTimeNs();
+	int code = 0;
+	while (__atomic_load_n(&test->_running, __ATOMIC_ACQUIRE))
+	{
+		test->Paint(code);
+		code = (code + 1) % LATENCY_TEST_CODES;
+		usleep((LATENCY_TEST_MS + rand_r(&seed) % LATENCY_TEST_MS) * 1000);
+	}
+	return NULL;
+}
+
+// the middle of each nibble, so filtering and rounding don't carry it into the next
+void LatencyTest::Paint(int code)
+{
+	unsigned long pixel = Channel(_visual->red_mask, (code & 15) * 16 + 8) |
+			Channel(_visual->green_mask, ((code >> 4) & 15) * 16 + 8) |
+			Channel(_visual->blue_mask, ((code >> 8) & 15) * 16 + 8);
+	// stamped before the request goes out, so x3d can't see it first
+	__atomic_store_n(&_painted_ns[code], GetTimeNs(), __ATOMIC_RELEASE);
+	XSetForeground(_dpy, _gc, pixel);
+	XFillRectangle(_dpy, _w, _gc, 0, 0, _width, _height);
+	XFlush(_dpy);
+}
+
+bool LatencyTest::Decode(const unsigned char * pixels, int count, long long now_ns)
+{
+	int code = -1;
+	for (int i = 0; i < count; i++)
+	{
+		int c = 0;
+		for (int channel = 0; channel < 3; channel++)
+		{
+			int value = pixels[i * 4 + channel];
+			if ((value & 15) < 4 || (value & 15) > 12)
+			{
+				return false;
+			}
+			c |= (value >> 4) << (channel * 4);
+		}
+		if (code >= 0 && c != code)
+		{
+			return false;
+		}
+		code = c;
+	}
+	if (code < 0)
+	{
+		return false;
+	}
+	// still showing the one already counted
+	if (code == _last)
+	{
+		return true;
+	}
+	long long painted = __atomic_load_n(&_painted_ns[code], __ATOMIC_ACQUIRE);
+	if (!painted || now_ns < painted || now_ns - painted > LATENCY_TEST_STALE)
+	{
+		return false;
+	}
+	_last = code;
+	_latency.Add(now_ns - painted);
+	return true;
+}
+
+void LatencyTest::Report(FILE * file)
+{
+	if (!_latency.count())
+	{
+		return;
+	}
+	fprintf(file, "  latency test paint to eye buffer p50 %.2f p90 %.2f p99 %.2f max %.2f ms over %u repaints\n",
+			_latency.percentile_ms(0.5f), _latency.percentile_ms(0.9f), _latency.percentile_ms(0.99f),
+			_latency.max_ms(), _latency.count());
+	_latency.Reset();
+}
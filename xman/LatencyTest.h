@@ -0,0 +1,52 @@
+#ifndef LATENCYTEST_H
+#define LATENCYTEST_H
+
+#include <stdio.h>
+#include <pthread.h>
+#include "Profile.h"
+
+// 4 bits in each of red, green and blue
+#define LATENCY_TEST_CODES 4096
+// between repaints, plus up to as much again so they don't lock to the frame
+#define LATENCY_TEST_MS 50
+
+// End to end damage to eye buffer latency. A client of its own on a thread
+// of its own fills a window with a colour that encodes a sequence number and
+// stamps each before painting it. x3d reads the middle of that window back
+// from the eye buffer and Decode looks the colour up.
+
+class LatencyTest
+{
+protected:
+	Display * _dpy;
+	Window _w;
+	GC _gc;
+	int _width;
+	int _height;
+	pthread_t _thread;
+	bool _running;
+	Visual * _visual;
+	long long _painted_ns[LATENCY_TEST_CODES];
+	int _last;
+	ProfileHistogram _latency;
+
+	static void * Run(void * context);
+	void Paint(int code);
+
+public:
+	LatencyTest();
+	~LatencyTest();
+
+	bool Start(const char * display_name, int width, int height);
+	void Stop();
+
+	Window w() { return _w; }
+
+	// count pixels read back 4 bytes apart, all the same code or it isn't one
+	bool Decode(const unsigned char * pixels, int count, long long now_ns);
+
+	// percentiles since the last report, then starts over
+	void Report(FILE * file);
+};
+
+#endif//LATENCYTEST_H
@@ -0,0 +1,233 @@
+#include <X11/Xlib.h>
+#include <X11/extensions/Xdamage.h>
+#include <stdlib.h>
+#include <string.h>
+#include "XCalls.h"
+
+static const char * s_event_names[LASTEvent] =
+{
+	NULL, NULL, "KeyPress", "KeyRelease", "ButtonPress", "ButtonRelease", "MotionNotify",
+	"EnterNotify", "LeaveNotify", "FocusIn", "FocusOut", "KeymapNotify", "Expose",
+	"GraphicsExpose", "NoExpose", "VisibilityNotify", "CreateNotify", "DestroyNotify",
+	"UnmapNotify", "MapNotify", "MapRequest", "ReparentNotify", "ConfigureNotify",
+	"ConfigureRequest", "GravityNotify", "ResizeRequest", "CirculateNotify",
+	"CirculateRequest", "PropertyNotify", "SelectionClear", "SelectionRequest",
+	"SelectionNotify", "ColormapNotify", "ClientMessage", "MappingNotify", "GenericEvent",
+};
+
+XCallSite * XCalls::s_sites;
+XCalls::Cause XCalls::s_causes[XCALLS_CAUSES];
+int XCalls::s_ncauses;
+XCalls::Cause * XCalls::s_cause;
+unsigned int XCalls::s_frame_round_trips;
+long long XCalls::s_frame_ns;
+long long XCalls::s_frame_bytes;
+int XCalls::s_frames;
+unsigned int XCalls::s_round_trips;
+long long XCalls::s_ns;
+long long XCalls::s_bytes;
+unsigned int XCalls::s_worst_round_trips;
+long long XCalls::s_worst_ns;
+unsigned int XCalls::s_grabs;
+long long XCalls::s_grab_ns;
+
+XCallSite::XCallSite(const char * name, int round_trips) : _stage(name)
+{
+	_round_trips = round_trips;
+	_calls = 0;
+	_ns = 0;
+	_bytes = 0;
+	XCalls::Add(this);
+}
+
+void XCall::End(long long bytes)
+{
+	if (!_site)
+	{
+		return;
+	}
+	long long ns = _scope.End();
+	XCallSite * site = _site;
+	_site = NULL;
+	site->_calls++;
+	site->_ns += ns;
+	site->_bytes += bytes;
+
+	XCalls::Cause * cause = XCalls::s_cause? XCalls::s_cause : XCalls::FindCause("frame");
+	cause->_calls++;
+	cause->_round_trips += site->_round_trips;
+	cause->_ns += ns;
+
+	XCalls::s_frame_round_trips += site->_round_trips;
+	XCalls::s_frame_ns += ns;
+	XCalls::s_frame_bytes += bytes;
+}
+
+void XCalls::Add(XCallSite * site)
+{
+	site->_next = s_sites;
+	s_sites = site;
+}
+
+XCalls::Cause * XCalls::FindCause(const char * name)
+{
+	for (int i = 0; i < s_ncauses; i++)
+	{
+		if (!strcmp(s_causes[i]._name, name))
+		{
+			return &s_causes[i];
+		}
+	}
+	// the last one takes whatever doesn't fit
+	if (s_ncauses == XCALLS_CAUSES)
+	{
+		return &s_causes[XCALLS_CAUSES - 1];
+	}
+	Cause &cause = s_causes[s_ncauses++];
+	memset(&cause, 0, sizeof(cause));
+	cause._name = name;
+	snprintf(cause._stat, sizeof(cause._stat), "x_blocked_ms.%s", name);
+	return &cause;
+}
+
+void XCalls::BeginEvent(const XEvent &event, int damage_event)
+{
+	const char * name = "extension event";
+	if (event.type == damage_event + XDamageNotify)
+	{
+		name = "DamageNotify";
+	}
+	else if (event.type < LASTEvent && s_event_names[event.type])
+	{
+		name = s_event_names[event.type];
+	}
+	s_cause = FindCause(name);
+}
+
+void XCalls::EndEvent()
+{
+	s_cause = NULL;
+}
+
+void XCalls::EndFrame()
+{
+	s_frames++;
+	s_round_trips += s_frame_round_trips;
+	s_ns += s_frame_ns;
+	s_bytes += s_frame_bytes;
+	if (s_frame_round_trips > s_worst_round_trips)
+	{
+		s_worst_round_trips = s_frame_round_trips;
+	}
+	if (s_frame_ns > s_worst_ns)
+	{
+		s_worst_ns = s_frame_ns;
+	}
+	s_frame_round_trips = 0;
+	s_frame_ns = 0;
+	s_frame_bytes = 0;
+}
+
+static int CompareSites(const void * a, const void * b)
+{
+	long long na = (*(XCallSite * const *)a)->ns();
+	long long nb = (*(XCallSite * const *)b)->ns();
+	return na > nb? -1 : na < nb? 1 : 0;
+}
+
+static int CompareCauses(const void * a, const void * b)
+{
+	long long na = ((const XCalls::Cause *)a)->_ns;
+	long long nb = ((const XCalls::Cause *)b)->_ns;
+	return na > nb? -1 : na < nb? 1 : 0;
+}
+
+void XCalls::Report(FILE * file)
+{
+	if (!s_frames)
+	{
+		return;
+	}
+	fprintf(file, "  x %.1f round trips, %.2f ms blocked, %.1f KB per frame, worst frame %u round trips %.2f ms\n",
+			s_round_trips / (float)s_frames, s_ns / (s_frames * 1000000.f), s_bytes / (s_frames * 1024.f),
+			s_worst_round_trips, s_worst_ns / 1000000.f);
+	if (s_grabs)
+	{
+		fprintf(file, "  x server grabbed %u times, %.2f ms per frame\n", s_grabs, s_grab_ns / (s_frames * 1000000.f));
+	}
+
+	// the costliest first
+	int nsites = 0;
+	for (XCallSite * site = s_sites; site; site = site->_next)
+	{
+		nsites++;
+	}
+	XCallSite ** sites = (XCallSite **)malloc(nsites * sizeof(XCallSite *));
+	nsites = 0;
+	for (XCallSite * site = s_sites; site; site = site->_next)
+	{
+		if (site->_calls)
+		{
+			sites[nsites++] = site;
+		}
+	}
+	qsort(sites, nsites, sizeof(XCallSite *), CompareSites);
+	for (int i = 0; i < nsites; i++)
+	{
+		XCallSite * site = sites[i];
+		fprintf(file, "    %-36s %6u calls %8.2f ms %9.1f KB\n", site->_stage.name(), site->_calls,
+				site->_ns / 1000000.f, site->_bytes / 1024.f);
+		site->_calls = 0;
+		site->_ns = 0;
+		site->_bytes = 0;
+	}
+	free(sites);
+
+	Cause causes[XCALLS_CAUSES];
+	memcpy(causes, s_causes, s_ncauses * sizeof(Cause));
+	qsort(causes, s_ncauses, sizeof(Cause), CompareCauses);
+	for (int i = 0; i < s_ncauses; i++)
+	{
+		if (causes[i]._calls)
+		{
+			fprintf(file, "    for %-32s %6u calls %6u round trips %8.2f ms\n", causes[i]._name,
+					causes[i]._calls, causes[i]._round_trips, causes[i]._ns / 1000000.f);
+		}
+	}
+	for (int i = 0; i < s_ncauses; i++)
+	{
+		s_causes[i]._calls = 0;
+		s_causes[i]._round_trips = 0;
+		s_causes[i]._ns = 0;
+	}
+
+	s_frames = 0;
+	s_round_trips = 0;
+	s_ns = 0;
+	s_bytes = 0;
+	s_worst_round_trips = 0;
+	s_worst_ns = 0;
+	s_grabs = 0;
+	s_grab_ns = 0;
+}
+
+void XCalls::Stats(void (*stat)(const char * name, double value))
+{
+	if (!s_frames)
+	{
+		return;
+	}
+	stat("x_round_trips_per_frame", s_round_trips / (double)s_frames);
+	stat("x_blocked_ms_per_frame", s_ns / (s_frames * 1e6));
+	stat("x_kb_per_frame", s_bytes / (s_frames * 1024.));
+	stat("x_worst_frame_round_trips", s_worst_round_trips);
+	stat("x_worst_frame_ms", s_worst_ns / 1e6);
+	stat("x_grab_ms_per_frame", s_grab_ns / (s_frames * 1e6));
+	for (int i = 0; i < s_ncauses; i++)
+	{
+		if (s_causes[i]._calls)
+		{
+			stat(s_causes[i]._stat, s_causes[i]._ns / (s_frames * 1e6));
+		}
+	}
+}
@@ -0,0 +1,112 @@
+#ifndef XCALLS_H
+#define XCALLS_H
+
+#include <stdio.h>
+#include "Profile.h"
+
+#define XCALLS_CAUSES 48
+
+// Synchronous Xlib calls, each blocked on the server for as many round trips
+// as it makes. XCALL times one into a ProfileStage of its own, so it shows in
+// the frame trace, and counts it against its call site, the frame and the X
+// event being handled when it was made. Main thread only.
+//
+//	XCALL(tree, "XQueryTree (UpdateHierarchy)", 1);
+//	XQueryTree(...);
+//	tree.End(32 + nchildren * 4);
+
+class XCallSite
+{
+protected:
+	ProfileStage _stage;
+	int _round_trips;
+	unsigned int _calls;
+	long long _ns;
+	long long _bytes;
+	XCallSite * _next;
+
+	friend class XCall;
+	friend class XCalls;
+
+public:
+	XCallSite(const char * name, int round_trips);
+
+	long long ns() { return _ns; }
+};
+
+class XCall
+{
+protected:
+	XCallSite * _site;
+	ProfileScope _scope;
+
+public:
+	XCall(XCallSite &site) : _site(&site), _scope(site._stage) {}
+	~XCall() { End(0); }
+
+	// with the size of the replies, once the call returned
+	void End(long long bytes);
+};
+
+#define XCALL(scope, name, round_trips) \
+	static XCallSite PROFILE_CONCAT(s_xcall_site_, __LINE__)(name, round_trips); \
+	XCall scope(PROFILE_CONCAT(s_xcall_site_, __LINE__))
+
+class XCalls
+{
+public:
+	struct Cause
+	{
+		const char * _name;
+		unsigned int _calls;
+		unsigned int _round_trips;
+		long long _ns;
+		// for the stats callback, which keeps the name
+		char _stat[48];
+	};
+
+protected:
+	static XCallSite * s_sites;
+	static Cause s_causes[XCALLS_CAUSES];
+	static int s_ncauses;
+	static Cause * s_cause;
+
+	// this frame, then the frames since the last report
+	static unsigned int s_frame_round_trips;
+	static long long s_frame_ns;
+	static long long s_frame_bytes;
+	static int s_frames;
+	static unsigned int s_round_trips;
+	static long long s_ns;
+	static long long s_bytes;
+	static unsigned int s_worst_round_trips;
+	static long long s_worst_ns;
+
+	// XGrabServer doesn't block x3d, it blocks every other client
+	static unsigned int s_grabs;
+	static long long s_grab_ns;
+
+	static Cause * FindCause(const char * name);
+
+	friend class XCall;
+
+public:
+	static void Add(XCallSite * site);
+
+	// what the calls until EndEvent are charged to, "frame" otherwise
+	static void BeginEvent(const XEvent &event, int damage_event);
+	static void EndEvent();
+	static void Grabbed(long long ns)
+	{
+		s_grabs++;
+		s_grab_ns += ns;
+	}
+	static void EndFrame();
+
+	// per site and per cause since the last report, then starts over
+	static void Report(FILE * file);
+	// the same per frame, with a stat per cause, for Control::Stat
+	static void Stats(void (*stat)(const char * name, double value));
+};
+
+#endif//XCALLS_H
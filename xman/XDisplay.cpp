@@ -1,7 +1,9 @@
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
 #include <X11/extensions/Xdamage.h>
+#include <X11/extensions/XTest.h>
 #include <GL/gl.h>
+#include <stdlib.h>
 #include <malloc.h>
 #include <math.h>
 #include <string.h>
@@ -9,8 +11,43 @@
 
 #include "XWindow.h"
 #include "XDisplay.h"
+#include "Occlusion.h"
+#include "RenderBackend.h"
+#include "Clock.h"
+#include "Profile.h"
+
+// an injection nobody redrew for within this long didn't cause anything
+#define REACTION_TIMEOUT 1000000000LL
 
 XWindow * XDisplay::s_table[1024];
+RenderBackend * XDisplay::s_backend;
+int XDisplay::s_culled;
+long long XDisplay::s_stat_culled;
+int XDisplay::s_stat_cull_frames;
+long long XDisplay::s_capture_bytes;
+long long XDisplay::s_capture_ns;
+unsigned int XDisplay::s_frame;
+long long XDisplay::s_texture_budget;
+long long XDisplay::s_resident_bytes;
+long long XDisplay::s_evicted_bytes;
+int XDisplay::s_evictions;
+int XDisplay::s_tile_size;
+XDisplay::Injection XDisplay::s_injection = XDisplay::INJECT_SEND_EVENT;
+int XDisplay::s_pointer_x = -1;
+int XDisplay::s_pointer_y = -1;
+XWindow * XDisplay::s_motion;
+XWindow * XDisplay::s_last_motion;
+Display * XDisplay::s_event_dpy;
+bool XDisplay::s_unflushed;
+int XDisplay::s_events_sent;
+int XDisplay::s_events_coalesced;
+int XDisplay::s_flushes;
+int XDisplay::s_reactions;
+long long XDisplay::s_reaction_ns;
+long long XDisplay::s_reaction_max_ns;
+XWindow * XDisplay::s_drawn;
+
+static ProfileHistogram s_latency;
 
 bool XDisplay::GetNearest(Nearest &nearest, int event_mask)
 {
@@ -200,6 +237,393 @@ bool XDisplay::HitTest(Hit &hit, int event_mask)
 	return hit._w != NULL;
 }
 
+int XDisplay::tile_size()
+{
+	int max_size = s_backend->max_image_size();
+	if (!s_tile_size || s_tile_size > max_size)
+	{
+		s_tile_size = max_size;
+	}
+	return s_tile_size;
+}
+
+void XDisplay::QueueMotion(XWindow * w)
+{
+	if (!w->_motion_pending)
+	{
+		w->_motion_pending = true;
+		w->_next_motion = s_motion;
+		s_motion = w;
+	}
+	s_last_motion = w;
+}
+
+void XDisplay::CancelMotion(XWindow * w)
+{
+	for (XWindow ** link = &s_motion; *link; link = &(*link)->_next_motion)
+	{
+		if (*link == w)
+		{
+			if (s_last_motion == w)
+			{
+				s_last_motion = NULL;
+			}
+			*link = w->_next_motion;
+			w->_next_motion = NULL;
+			w->_motion_pending = false;
+			return;
+		}
+	}
+}
+
+void XDisplay::FlushEvents()
+{
+	// there is only the one real pointer, it ends up where it was sent last
+	XWindow * last = s_injection == INJECT_XTEST? s_last_motion : NULL;
+	while (s_motion)
+	{
+		// both unlink
+		XWindow * w = s_motion;
+		if (last && w != last)
+		{
+			CancelMotion(w);
+			s_events_coalesced++;
+			continue;
+		}
+		w->SendPendingMotion();
+	}
+	if (s_unflushed)
+	{
+		XFlush(s_event_dpy);
+		s_unflushed = false;
+		s_flushes++;
+	}
+}
+
+bool XDisplay::SetInjection(Display * dpy, Injection injection)
+{
+	if (injection == INJECT_XTEST)
+	{
+		int event_base, error_base, major, minor;
+		if (!XTestQueryExtension(dpy, &event_base, &error_base, &major, &minor))
+		{
+			s_injection = INJECT_SEND_EVENT;
+			return false;
+		}
+		// keep working while some client holds a server grab
+		XTestGrabControl(dpy, True);
+	}
+	s_injection = injection;
+	return true;
+}
+
+void XDisplay::WarpPointer(Display * dpy, int x_root, int y_root)
+{
+	XTestFakeMotionEvent(dpy, -1, x_root, y_root, CurrentTime);
+	EventSent(dpy);
+	s_pointer_x = x_root;
+	s_pointer_y = y_root;
+}
+
+static XWindow * TopLevel(XWindow * w)
+{
+	while (w->parent() && w->parent()->parent())
+	{
+		w = w->parent();
+	}
+	return w;
+}
+
+void XDisplay::Injected(XWindow * w)
+{
+	w = TopLevel(w);
+	long long now = GetTimeNs();
+	if (!w->_injected_ns || now - w->_injected_ns > REACTION_TIMEOUT)
+	{
+		w->_injected_ns = now;
+	}
+}
+
+void XDisplay::Reacted(XWindow * w)
+{
+	w = TopLevel(w);
+	if (!w->_injected_ns)
+	{
+		return;
+	}
+	long long ns = GetTimeNs() - w->_injected_ns;
+	w->_injected_ns = 0;
+	if (ns > REACTION_TIMEOUT)
+	{
+		return;
+	}
+	s_reactions++;
+	s_reaction_ns += ns;
+	if (ns > s_reaction_max_ns)
+	{
+		s_reaction_max_ns = ns;
+	}
+}
+
+void XDisplay::ResetReactionStats()
+{
+	s_reactions = 0;
+	s_reaction_ns = 0;
+	s_reaction_max_ns = 0;
+}
+
+void XDisplay::ResetEventStats()
+{
+	s_events_sent = 0;
+	s_events_coalesced = 0;
+	s_flushes = 0;
+}
+
+void XDisplay::Drawn(XWindow * w)
+{
+	w->_next_drawn = s_drawn;
+	s_drawn = w;
+}
+
+void XDisplay::CancelDrawn(XWindow * w)
+{
+	for (XWindow ** link = &s_drawn; *link; link = &(*link)->_next_drawn)
+	{
+		if (*link == w)
+		{
+			*link = w->_next_drawn;
+			w->_next_drawn = NULL;
+			w->_drawn_ns = 0;
+			return;
+		}
+	}
+}
+
+void XDisplay::FrameSubmitted(long long now_ns)
+{
+	while (s_drawn)
+	{
+		XWindow * w = s_drawn;
+		s_drawn = w->_next_drawn;
+		w->_next_drawn = NULL;
+		// unmapped since it was drawn
+		if (w->_upload_damage_ns)
+		{
+			w->_latency[XWindow::LATENCY_DRAW].Add(w->_drawn_ns - w->_uploaded_ns);
+			w->_latency[XWindow::LATENCY_SUBMIT].Add(now_ns - w->_drawn_ns);
+			w->_latency[XWindow::LATENCY_TOTAL].Add(now_ns - w->_upload_damage_ns);
+			s_latency.Add(now_ns - w->_upload_damage_ns);
+		}
+		w->_upload_damage_ns = 0;
+		w->_drawn_ns = 0;
+	}
+}
+
+void XDisplay::ReportLatency(FILE * file)
+{
+	if (!s_latency.count())
+	{
+		return;
+	}
+	fprintf(file, "damage to eye buffer p50 %.2f p99 %.2f ms, per window p50 of each stage:\n",
+			s_latency.percentile_ms(0.5f), s_latency.percentile_ms(0.99f));
+	s_latency.Reset();
+	for (int i = 0; i < 1024; i++)
+	{
+		for (XWindow * w = s_table[i]; w; w = w->_next)
+		{
+			if (!w->_latency || !w->_latency[XWindow::LATENCY_TOTAL].count())
+			{
+				continue;
+			}
+			ProfileHistogram * l = w->_latency;
+			fprintf(file, "  %08x %-16.16s total p50 %6.2f p99 %6.2f ms over %4u: deliver %.2f queue %.2f capture %.2f upload %.2f draw %.2f submit %.2f\n",
+					(unsigned int)w->_w, w->_name? w->_name : "", l[XWindow::LATENCY_TOTAL].percentile_ms(0.5f),
+					l[XWindow::LATENCY_TOTAL].percentile_ms(0.99f), l[XWindow::LATENCY_TOTAL].count(),
+					l[XWindow::LATENCY_DELIVER].percentile_ms(0.5f), l[XWindow::LATENCY_QUEUE].percentile_ms(0.5f),
+					l[XWindow::LATENCY_CAPTURE].percentile_ms(0.5f), l[XWindow::LATENCY_UPLOAD].percentile_ms(0.5f),
+					l[XWindow::LATENCY_DRAW].percentile_ms(0.5f), l[XWindow::LATENCY_SUBMIT].percentile_ms(0.5f));
+			for (int s = 0; s < XWindow::LATENCY_STAGES; s++)
+			{
+				l[s].Reset();
+			}
+		}
+	}
+}
+
+int XDisplay::latency_count()
+{
+	return s_latency.count();
+}
+
+float XDisplay::latency_ms(float fraction)
+{
+	return s_latency.percentile_ms(fraction);
+}
+
+struct Occluder
+{
+	XWindow * _w;
+	Matrix _world;
+	OcclusionBuffer::Quad _quad;
+};
+
+static int CompareOccluders(const void * a, const void * b)
+{
+	float na = ((const Occluder *)a)->_quad._near;
+	float nb = ((const Occluder *)b)->_quad._near;
+	return na < nb? -1 : na > nb? 1 : 0;
+}
+
+void XDisplay::BeginCull()
+{
+	for (int i = 0; i < 1024; i++)
+	{
+		for (XWindow * w = s_table[i]; w; w = w->_next)
+		{
+			w->_occluded = 0;
+			for (int t = 0; t < w->_ntiles; t++)
+			{
+				w->_tiles[t]._occluded = 0;
+			}
+		}
+	}
+}
+
+// Marks the top-levels that are fully covered by nearer ones from this eye.
+void XDisplay::Cull(OcclusionBuffer &buffer, const Matrix &clip, int eye)
+{
+	static Occluder * s_occluders = NULL;
+	static int s_max_occluders = 0;
+	int count = 0;
+
+	buffer.Clear(clip);
+
+	for (int i = 0; i < 1024; i++)
+	{
+		for (XWindow * w = s_table[i]; w; w = w->_next)
+		{
+			if (!w->_mapped || !w->_textured || w->_hdepth != 1)
+			{
+				continue;
+			}
+			if (count == s_max_occluders)
+			{
+				// Matrix isn't plain old data, no realloc
+				s_max_occluders = s_max_occluders? s_max_occluders * 2 : 64;
+				Occluder * occluders = new Occluder[s_max_occluders];
+				for (int j = 0; j < count; j++)
+				{
+					occluders[j] = s_occluders[j];
+				}
+				delete [] s_occluders;
+				s_occluders = occluders;
+			}
+			Matrix world = w->_parent? w->_parent->_matrix * w->_matrix : w->_matrix;
+			if (!buffer.Project(world, w->_width, w->_height, s_occluders[count]._quad))
+			{
+				// too close to reason about, always drawn
+				continue;
+			}
+			s_occluders[count]._w = w;
+			s_occluders[count]._world = world;
+			count++;
+		}
+	}
+
+	// front to back so the nearest windows fill the buffer first
+	qsort(s_occluders, count, sizeof(Occluder), CompareOccluders);
+	for (int i = 0; i < count; i++)
+	{
+		XWindow * w = s_occluders[i]._w;
+		if (buffer.IsOccluded(s_occluders[i]._quad))
+		{
+			w->_occluded |= 1 << eye;
+			continue;
+		}
+		// tiles against the nearer windows only, the window itself goes in after
+		for (int t = 0; w->_ntiles > 1 && t < w->_ntiles; t++)
+		{
+			XWindow::Tile &tile = w->_tiles[t];
+			Matrix world = s_occluders[i]._world;
+			world.PrependTranslate(tile._x, -tile._y, 0.f);
+			OcclusionBuffer::Quad quad;
+			if (buffer.Project(world, tile._width, tile._height, quad) && buffer.IsOccluded(quad))
+			{
+				tile._occluded |= 1 << eye;
+			}
+		}
+		buffer.AddOccluder(s_occluders[i]._quad);
+	}
+}
+
+// Windows hidden from every eye defer their captures, the ones that just
+// came back into view catch up on the damage they missed.
+int XDisplay::EndCull(int eyes)
+{
+	int mask = (1 << eyes) - 1;
+	s_culled = 0;
+	s_frame++;
+	for (int i = 0; i < 1024; i++)
+	{
+		for (XWindow * w = s_table[i]; w; w = w->_next)
+		{
+			bool hidden = (w->_occluded & mask) == mask;
+			if (hidden)
+			{
+				s_culled++;
+				w->_hidden = true;
+				continue;
+			}
+			w->_last_visible = s_frame;
+			if (w->_evicted)
+			{
+				w->_hidden = false;
+				w->Restore();
+			}
+			else if (w->_hidden)
+			{
+				w->_hidden = false;
+				w->UpdateDamage();
+			}
+		}
+	}
+	s_stat_culled += s_culled;
+	s_stat_cull_frames++;
+	EnforceBudget();
+	return s_culled;
+}
+
+// Only hidden windows are evicted, a budget smaller than what is on screen
+// is overrun rather than evicting something drawn this frame.
+void XDisplay::EnforceBudget()
+{
+	while (s_texture_budget && s_resident_bytes > s_texture_budget)
+	{
+		XWindow * oldest = NULL;
+		for (int i = 0; i < 1024; i++)
+		{
+			for (XWindow * w = s_table[i]; w; w = w->_next)
+			{
+				if (!w->_textured || w->_evicted || !w->_hidden || !w->_texture_bytes)
+				{
+					continue;
+				}
+				if (!oldest || w->_last_visible < oldest->_last_visible)
+				{
+					oldest = w;
+				}
+			}
+		}
+		if (!oldest)
+		{
+			return;
+		}
+		oldest->Evict();
+		s_evictions++;
+	}
+}
+
 XWindow * XDisplay::GetWindow(Display * dpy, Window w)
 {
 	int index = ((w & 0xf0000000) >> 26) | (w & 0x3f);
@@ -222,6 +646,35 @@ XWindow * XDisplay::GetWindow(Display * dpy, Window w)
 	return xw;
 }
 
+void XDisplay::AddWindow(XWindow * w)
+{
+	int index = ((w->_w & 0xf0000000) >> 26) | (w->_w & 0x3f);
+	w->_next = s_table[index];
+	s_table[index] = w;
+}
+
+void XDisplay::ForgetWindows()
+{
+	memset(s_table, 0, sizeof(s_table));
+}
+
+void XDisplay::CountWindows(int &windows, int &toplevels)
+{
+	windows = 0;
+	toplevels = 0;
+	for (int i = 0; i < 1024; i++)
+	{
+		for (XWindow * w = s_table[i]; w; w = w->_next)
+		{
+			windows++;
+			if (w->_mapped && w->_hdepth == 1)
+			{
+				toplevels++;
+			}
+		}
+	}
+}
+
 bool XDisplay::RemoveWindow(Window w)
 {
 }
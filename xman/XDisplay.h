@@ -1,12 +1,64 @@
 #ifndef XDISPLAY_H
 #define XDISPLAY_H
 
+#include <stdio.h>
+
 class XWindow;
+class OcclusionBuffer;
+class RenderBackend;
 
 class XDisplay
 {
 protected:
 	static XWindow * s_table[1024];
+	static RenderBackend * s_backend;
+	static int s_culled;
+	// summed over the frames since ResetCullStats
+	static long long s_stat_culled;
+	static int s_stat_cull_frames;
+	static long long s_capture_bytes;
+	static long long s_capture_ns;
+
+	static unsigned int s_frame;
+	static long long s_texture_budget;
+	static long long s_resident_bytes;
+	static long long s_evicted_bytes;
+	static int s_evictions;
+	static int s_tile_size;
+
+public:
+	// how pointer and key input reaches the clients
+	enum Injection
+	{
+		// events sent straight to the window, crossings emulated by the caller
+		INJECT_SEND_EVENT,
+		// the real core pointer and keyboard through XTest, the server
+		// generates crossings and the clients can't tell the difference
+		INJECT_XTEST,
+	};
+
+protected:
+	// synthetic events, see FlushEvents
+	static Injection s_injection;
+	static int s_pointer_x;
+	static int s_pointer_y;
+	static XWindow * s_motion;
+	static XWindow * s_last_motion;
+	static Display * s_event_dpy;
+	static bool s_unflushed;
+	static int s_events_sent;
+	static int s_events_coalesced;
+	static int s_flushes;
+
+	// injected input to the damage the client answers with
+	static int s_reactions;
+	static long long s_reaction_ns;
+	static long long s_reaction_max_ns;
+
+	// drawn since the last FrameSubmitted with damage to trace
+	static XWindow * s_drawn;
+
+	static void EnforceBudget();
 
 public:
 
@@ -71,7 +123,99 @@ public:
 	static bool HitTest(Hit &hit, int event_mask); 
 	static XWindow * GetWindow(Display * dpy, Window w);
 	static bool RemoveWindow(Window w);
+	// synthetic windows that GetWindow won't create, and forgetting them all
+	// again without deleting any, for bench/
+	static void AddWindow(XWindow * w);
+	static void ForgetWindows();
+	// every window known and the mapped top levels among them
+	static void CountWindows(int &windows, int &toplevels);
 	static void GetCross(XWindow * a, XWindow * b, Cross & cross);
+
+	// BeginCull and Cull decide what Draw skips, EndCull hides what no eye
+	// sees and captures what came back. A second BeginCull and Cull without
+	// EndCull only moves what Draw skips, nothing is captured.
+	static void BeginCull();
+	static void Cull(OcclusionBuffer &buffer, const Matrix &clip, int eye);
+	static int EndCull(int eyes);
+	static int culled() { return s_culled; }
+	static float stat_culled() { return s_stat_cull_frames? s_stat_culled / (float)s_stat_cull_frames : 0.f; }
+	static void ResetCullStats()
+	{
+		s_stat_culled = 0;
+		s_stat_cull_frames = 0;
+	}
+
+	// owns the window images, set before any window is captured
+	static void SetBackend(RenderBackend * backend) { s_backend = backend; }
+	static RenderBackend * backend() { return s_backend; }
+
+	static void AddCaptureBytes(int bytes) { s_capture_bytes += bytes; }
+	static long long capture_bytes() { return s_capture_bytes; }
+	// time from XGetImage to the last upload, mip updates included
+	static void AddCaptureTime(long long ns) { s_capture_ns += ns; }
+	static long long capture_ns() { return s_capture_ns; }
+	static void ResetCaptureStats()
+	{
+		s_capture_bytes = 0;
+		s_capture_ns = 0;
+	}
+
+	// 0 for no limit, otherwise textures of the windows seen least recently
+	// are dropped at the end of culling until the rest fits
+	static void SetTextureBudget(long long bytes) { s_texture_budget = bytes; }
+	static long long texture_budget() { return s_texture_budget; }
+	static void AddResidentBytes(int bytes) { s_resident_bytes += bytes; }
+	static void AddEvictedBytes(int bytes) { s_evicted_bytes += bytes; }
+	static long long resident_bytes() { return s_resident_bytes; }
+	static long long evicted_bytes() { return s_evicted_bytes; }
+	static int evictions() { return s_evictions; }
+
+	// largest image a window tile may use, the backend's limit unless smaller
+	static void SetTileSize(int size) { s_tile_size = size; }
+	static int tile_size();
+
+	// sends the motion windows were given this frame, then flushes everything
+	// sent since the last call with a single XFlush
+	static void FlushEvents();
+	static void QueueMotion(XWindow * w);
+	static void CancelMotion(XWindow * w);
+
+	// falls back to INJECT_SEND_EVENT and returns false without XTest
+	static bool SetInjection(Display * dpy, Injection injection);
+	static Injection injection() { return s_injection; }
+	static bool PointerAt(int x_root, int y_root) { return x_root == s_pointer_x && y_root == s_pointer_y; }
+	static void WarpPointer(Display * dpy, int x_root, int y_root);
+
+	// stamps the top level of w unless it already waits on an injection,
+	// Reacted closes that out when damage for any window of it arrives
+	static void Injected(XWindow * w);
+	static void Reacted(XWindow * w);
+	static int reactions() { return s_reactions; }
+	static float reaction_ms() { return s_reactions? s_reaction_ns / (s_reactions * 1000000.f) : 0.f; }
+	static float reaction_max_ms() { return s_reaction_max_ns / 1000000.f; }
+	static void ResetReactionStats();
+	static void EventSent(Display * dpy)
+	{
+		s_event_dpy = dpy;
+		s_unflushed = true;
+		s_events_sent++;
+	}
+	static void EventCoalesced() { s_events_coalesced++; }
+	static int events_sent() { return s_events_sent; }
+	static int events_coalesced() { return s_events_coalesced; }
+	static int flushes() { return s_flushes; }
+	static void ResetEventStats();
+
+	// damage to eye buffer latency, see XWindow::LatencyStage
+	static void Drawn(XWindow * w);
+	static void CancelDrawn(XWindow * w);
+	// closes out the windows drawn since the last call
+	static void FrameSubmitted(long long now_ns);
+	// every top level with damage traced since the last report, then starts over
+	static void ReportLatency(FILE * file);
+	// over every top level since the last report
+	static int latency_count();
+	static float latency_ms(float fraction);
 };
 
 #endif//XDISPLAY_H
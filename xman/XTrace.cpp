@@ -0,0 +1,484 @@
+#include <X11/Xlib.h>
+#include <X11/extensions/Xdamage.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "Clock.h"
+#include "XTrace.h"
+
+#define XTRACE_VERSION 1
+// the file grows this much at a time while recording
+#define XTRACE_CHUNK (16 << 20)
+
+XTrace::XTrace()
+{
+	_fd = -1;
+	_data = NULL;
+	_mapped = 0;
+	_used = 0;
+	_start_ns = 0;
+	_writing = false;
+	_root = None;
+	_dpy = NULL;
+	_gc = NULL;
+	_pos = 0;
+	_replay_start_ns = 0;
+	_time_ns = 0;
+	_max_speed = false;
+	_frame = 0;
+	_frames = 0;
+	_records = 0;
+	_windows = NULL;
+	_nwindows = 0;
+	_maxwindows = 0;
+	_color = 0x406080;
+	_hands = NULL;
+}
+
+XTrace::~XTrace()
+{
+	Close();
+}
+
+bool XTrace::Create(const char * path, int width, int height)
+{
+	_fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (_fd < 0)
+	{
+		fprintf(stderr, "xtrace: unable to create %s\n", path);
+		return false;
+	}
+	_writing = true;
+	_start_ns = GetTimeNs();
+	Header * header = (Header *)Append((Type)0, sizeof(Header));
+	if (!header)
+	{
+		Close();
+		return false;
+	}
+	memcpy(header->_magic, "X3DT", 4);
+	header->_version = XTRACE_VERSION;
+	header->_width = width;
+	header->_height = height;
+	return true;
+}
+
+void * XTrace::Append(Type type, int size)
+{
+	// keeps the long longs aligned
+	size = (size + 7) & ~7;
+	if (_used + size > _mapped)
+	{
+		if (_data)
+		{
+			munmap(_data, _mapped);
+			_data = NULL;
+		}
+		long long mapped = _mapped + XTRACE_CHUNK;
+		void * data = MAP_FAILED;
+		if (!ftruncate(_fd, mapped))
+		{
+			data = mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+		}
+		if (data == MAP_FAILED)
+		{
+			fprintf(stderr, "xtrace: unable to grow the trace past %lld bytes, recording stopped\n", _used);
+			_mapped = 0;
+			_writing = false;
+			return NULL;
+		}
+		_data = (char *)data;
+		_mapped = mapped;
+	}
+	void * p = _data + _used;
+	_used += size;
+	if (type)
+	{
+		Record * record = (Record *)p;
+		record->_type = type;
+		record->_size = size;
+		record->_frame = _frame;
+		record->_time_ns = GetTimeNs() - _start_ns;
+		_records++;
+	}
+	return p;
+}
+
+void XTrace::RecordWindow(Type type, unsigned int w, int x, int y, int width, int height)
+{
+	if (!_writing)
+	{
+		return;
+	}
+	WindowRecord * record = (WindowRecord *)Append(type, sizeof(WindowRecord));
+	if (record)
+	{
+		record->_window = w;
+		record->_x = x;
+		record->_y = y;
+		record->_width = width;
+		record->_height = height;
+	}
+}
+
+void XTrace::RecordWindows(Display * dpy, Window root)
+{
+	Window wroot, wparent;
+	Window * children;
+	unsigned int nchildren;
+	_root = root;
+	if (!_writing || !XQueryTree(dpy, root, &wroot, &wparent, &children, &nchildren))
+	{
+		return;
+	}
+	// bottom to top, which is also the order they get created in on replay
+	for (unsigned int i = 0; i < nchildren; i++)
+	{
+		XWindowAttributes attributes;
+		if (!XGetWindowAttributes(dpy, children[i], &attributes) || attributes.c_class != InputOutput)
+		{
+			continue;
+		}
+		RecordWindow(WINDOW, children[i], attributes.x, attributes.y, attributes.width, attributes.height);
+		Remember(children[i], children[i]);
+		if (attributes.map_state != IsUnmapped)
+		{
+			RecordWindow(MAP, children[i], 0, 0, 0, 0);
+		}
+	}
+	if (children)
+	{
+		XFree(children);
+	}
+}
+
+void XTrace::RecordEvent(const XEvent &event, int damage_event)
+{
+	if (!_writing)
+	{
+		return;
+	}
+	switch (event.type)
+	{
+	case CreateNotify:
+		if (event.xcreatewindow.parent == _root)
+		{
+			RecordWindow(CREATE, event.xcreatewindow.window, event.xcreatewindow.x, event.xcreatewindow.y,
+					event.xcreatewindow.width, event.xcreatewindow.height);
+			Remember(event.xcreatewindow.window, event.xcreatewindow.window);
+		}
+		break;
+	case MapNotify:
+		if (event.xmap.event == _root)
+		{
+			RecordWindow(MAP, event.xmap.window, 0, 0, 0, 0);
+		}
+		break;
+	case UnmapNotify:
+		if (event.xunmap.event == _root)
+		{
+			RecordWindow(UNMAP, event.xunmap.window, 0, 0, 0, 0);
+		}
+		break;
+	case ConfigureNotify:
+		if (event.xconfigure.event == _root)
+		{
+			RecordWindow(CONFIGURE, event.xconfigure.window, event.xconfigure.x, event.xconfigure.y,
+					event.xconfigure.width, event.xconfigure.height);
+		}
+		break;
+	case DestroyNotify:
+		if (event.xdestroywindow.event == _root)
+		{
+			RecordWindow(DESTROY, event.xdestroywindow.window, 0, 0, 0, 0);
+			Forget(event.xdestroywindow.window);
+		}
+		break;
+	default:
+		if (event.type == damage_event + XDamageNotify)
+		{
+			const XDamageNotifyEvent * de = (const XDamageNotifyEvent *)&event;
+			if (Lookup(de->drawable) != None)
+			{
+				RecordWindow(DAMAGE, de->drawable, de->area.x, de->area.y, de->area.width, de->area.height);
+			}
+		}
+	}
+}
+
+void XTrace::RecordFrame(unsigned int frame)
+{
+	_frame = frame;
+	if (_writing)
+	{
+		Append(FRAME, sizeof(Record));
+	}
+}
+
+void XTrace::RecordHands(int hands, const Matrix &left, const Matrix &right, const float * controls)
+{
+	if (!_writing)
+	{
+		return;
+	}
+	HandsRecord * record = (HandsRecord *)Append(HANDS, sizeof(HandsRecord));
+	if (record)
+	{
+		record->_hands = hands;
+		memcpy(record->_left, left._m, sizeof(record->_left));
+		memcpy(record->_right, right._m, sizeof(record->_right));
+		memcpy(record->_controls, controls, sizeof(record->_controls));
+	}
+}
+
+bool XTrace::Open(const char * path, const char * display_name, bool max_speed)
+{
+	_fd = open(path, O_RDONLY);
+	struct stat st;
+	if (_fd < 0 || fstat(_fd, &st) || st.st_size < (long long)sizeof(Header))
+	{
+		fprintf(stderr, "xtrace: unable to read %s\n", path);
+		Close();
+		return false;
+	}
+	void * data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, _fd, 0);
+	if (data == MAP_FAILED)
+	{
+		fprintf(stderr, "xtrace: unable to map %s\n", path);
+		Close();
+		return false;
+	}
+	_data = (char *)data;
+	_mapped = st.st_size;
+	_used = st.st_size;
+
+	const Header * header = (const Header *)_data;
+	if (memcmp(header->_magic, "X3DT", 4) || header->_version != XTRACE_VERSION)
+	{
+		fprintf(stderr, "xtrace: %s is not a version %d trace\n", path, XTRACE_VERSION);
+		Close();
+		return false;
+	}
+
+	_dpy = XOpenDisplay(display_name);
+	if (!_dpy)
+	{
+		fprintf(stderr, "xtrace: unable to open display '%s'\n", XDisplayName(display_name));
+		Close();
+		return false;
+	}
+	int screen = DefaultScreen(_dpy);
+	if (DisplayWidth(_dpy, screen) < header->_width || DisplayHeight(_dpy, screen) < header->_height)
+	{
+		printf("xtrace: recorded on %dx%d, replaying on a smaller %dx%d\n", header->_width, header->_height,
+				DisplayWidth(_dpy, screen), DisplayHeight(_dpy, screen));
+	}
+	_gc = XCreateGC(_dpy, RootWindow(_dpy, screen), 0, NULL);
+	_max_speed = max_speed;
+	_pos = (sizeof(Header) + 7) & ~7;
+
+	// what was there before the first frame, x3d only looks once
+	while (_pos < _used)
+	{
+		const Record * record = (const Record *)(_data + _pos);
+		if (record->_type == FRAME || !record->_size)
+		{
+			break;
+		}
+		Play(record);
+		_pos += record->_size;
+	}
+	XSync(_dpy, False);
+	_replay_start_ns = GetTimeNs();
+	return true;
+}
+
+Window XTrace::Lookup(unsigned int recorded)
+{
+	for (int i = 0; i < _nwindows; i++)
+	{
+		if (_windows[i]._recorded == recorded)
+		{
+			return _windows[i]._w;
+		}
+	}
+	return None;
+}
+
+void XTrace::Remember(unsigned int recorded, Window w)
+{
+	if (_nwindows == _maxwindows)
+	{
+		_maxwindows = _maxwindows? _maxwindows * 2 : 64;
+		_windows = (Mapping *)realloc(_windows, _maxwindows * sizeof(Mapping));
+	}
+	_windows[_nwindows]._recorded = recorded;
+	_windows[_nwindows]._w = w;
+	_nwindows++;
+}
+
+Window XTrace::Forget(unsigned int recorded)
+{
+	for (int i = 0; i < _nwindows; i++)
+	{
+		if (_windows[i]._recorded == recorded)
+		{
+			Window w = _windows[i]._w;
+			_windows[i] = _windows[--_nwindows];
+			return w;
+		}
+	}
+	return None;
+}
+
+void XTrace::Play(const Record * record)
+{
+	_records++;
+	_time_ns = record->_time_ns;
+	if (record->_type == HANDS)
+	{
+		_hands = (const HandsRecord *)record;
+		return;
+	}
+	if (record->_type == FRAME)
+	{
+		_frames++;
+		return;
+	}
+
+	const WindowRecord * wr = (const WindowRecord *)record;
+	Window w = Lookup(wr->_window);
+	switch (record->_type)
+	{
+	case WINDOW:
+	case CREATE:
+		if (w != None || !wr->_width || !wr->_height)
+		{
+			break;
+		}
+		Remember(wr->_window, XCreateSimpleWindow(_dpy, DefaultRootWindow(_dpy), wr->_x, wr->_y,
+				wr->_width, wr->_height, 0, 0, _color));
+		break;
+	case MAP:
+		if (w != None)
+		{
+			XMapWindow(_dpy, w);
+		}
+		break;
+	case UNMAP:
+		if (w != None)
+		{
+			XUnmapWindow(_dpy, w);
+		}
+		break;
+	case CONFIGURE:
+		if (w != None && wr->_width && wr->_height)
+		{
+			XMoveResizeWindow(_dpy, w, wr->_x, wr->_y, wr->_width, wr->_height);
+		}
+		break;
+	case DESTROY:
+		w = Forget(wr->_window);
+		if (w != None)
+		{
+			XDestroyWindow(_dpy, w);
+		}
+		break;
+	case DAMAGE:
+		// new pixels each time, so the capture can't be skipped as unchanged
+		if (w != None)
+		{
+			_color = (_color * 1103515245 + 12345) & 0xffffff;
+			XSetForeground(_dpy, _gc, _color);
+			XFillRectangle(_dpy, w, _gc, wr->_x, wr->_y, wr->_width, wr->_height);
+		}
+		break;
+	}
+}
+
+bool XTrace::Replay()
+{
+	if (!_dpy)
+	{
+		return false;
+	}
+	if (_pos >= _used)
+	{
+		return false;
+	}
+	long long elapsed = GetTimeNs() - _replay_start_ns;
+	while (_pos < _used)
+	{
+		const Record * record = (const Record *)(_data + _pos);
+		if (!record->_size)
+		{
+			// a trace cut short
+			_pos = _used;
+			break;
+		}
+		if (!_max_speed && record->_time_ns > elapsed)
+		{
+			break;
+		}
+		Play(record);
+		_pos += record->_size;
+		if (record->_type == FRAME && _max_speed)
+		{
+			break;
+		}
+	}
+	// the server has it all before x3d goes looking for the events
+	XSync(_dpy, False);
+	return true;
+}
+
+int XTrace::Hands(Matrix &left, Matrix &right, float * controls, long long &time_ns)
+{
+	if (!_hands)
+	{
+		return 0;
+	}
+	memcpy(left._m, _hands->_left, sizeof(_hands->_left));
+	memcpy(right._m, _hands->_right, sizeof(_hands->_right));
+	memcpy(controls, _hands->_controls, sizeof(_hands->_controls));
+	time_ns = _hands->_time_ns;
+	return _hands->_hands;
+}
+
+void XTrace::Close()
+{
+	if (_data)
+	{
+		munmap(_data, _mapped);
+		_data = NULL;
+	}
+	if (_fd >= 0)
+	{
+		if (_writing && ftruncate(_fd, _used))
+		{
+			fprintf(stderr, "xtrace: unable to trim the trace to %lld bytes\n", _used);
+		}
+		close(_fd);
+		_fd = -1;
+	}
+	_writing = false;
+	if (_dpy)
+	{
+		for (int i = 0; i < _nwindows; i++)
+		{
+			XDestroyWindow(_dpy, _windows[i]._w);
+		}
+		XFreeGC(_dpy, _gc);
+		XCloseDisplay(_dpy);
+		_dpy = NULL;
+	}
+	free(_windows);
+	_windows = NULL;
+	_nwindows = 0;
+	_maxwindows = 0;
+	_hands = NULL;
+}
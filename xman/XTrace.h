@@ -0,0 +1,138 @@
+#ifndef XTRACE_H
+#define XTRACE_H
+
+#include "Matrix.h"
+
+#define XTRACE_CONTROLS 20
+
+// A run of the X events x3d acts on and the tracker input it was given,
+// memory mapped, to replay the same load on another server. Replay is a
+// client of its own there: it recreates the recorded top levels and maps,
+// moves and paints them, so x3d sees real events and real damage and
+// captures the windows as it would have.
+
+class XTrace
+{
+public:
+	enum Type
+	{
+		FRAME = 1,
+		// one per top level already there when recording started
+		WINDOW,
+		CREATE,
+		MAP,
+		UNMAP,
+		CONFIGURE,
+		DESTROY,
+		DAMAGE,
+		HANDS,
+	};
+
+	struct Record
+	{
+		unsigned short _type;
+		unsigned short _size;
+		unsigned int _frame;
+		// since the trace started
+		long long _time_ns;
+	};
+
+	// a window and its geometry, for DAMAGE the area within it
+	struct WindowRecord : Record
+	{
+		unsigned int _window;
+		short _x;
+		short _y;
+		unsigned short _width;
+		unsigned short _height;
+	};
+
+	struct HandsRecord : Record
+	{
+		int _hands;
+		float _left[16];
+		float _right[16];
+		float _controls[XTRACE_CONTROLS];
+	};
+
+protected:
+	struct Header
+	{
+		char _magic[4];
+		int _version;
+		int _width;
+		int _height;
+	};
+
+	struct Mapping
+	{
+		unsigned int _recorded;
+		Window _w;
+	};
+
+	int _fd;
+	char * _data;
+	long long _mapped;
+	long long _used;
+	long long _start_ns;
+	bool _writing;
+	// recording, only its children are the top levels replay recreates
+	Window _root;
+
+	// replay
+	Display * _dpy;
+	GC _gc;
+	long long _pos;
+	long long _replay_start_ns;
+	long long _time_ns;
+	bool _max_speed;
+	unsigned int _frame;
+	int _frames;
+	int _records;
+	// replayed windows, or while recording the top levels recorded
+	Mapping * _windows;
+	int _nwindows;
+	int _maxwindows;
+	unsigned int _color;
+	const HandsRecord * _hands;
+
+	void * Append(Type type, int size);
+	void RecordWindow(Type type, unsigned int w, int x, int y, int width, int height);
+	Window Lookup(unsigned int recorded);
+	void Remember(unsigned int recorded, Window w);
+	Window Forget(unsigned int recorded);
+	void Play(const Record * record);
+
+public:
+	XTrace();
+	~XTrace();
+
+	// recording, the file grows as it fills and is cut to size on Close
+	bool Create(const char * path, int width, int height);
+	void RecordWindows(Display * dpy, Window root);
+	// structure events of the root's children and damage to them only, the
+	// subwindows inside are the applications' own and not replayed
+	void RecordEvent(const XEvent &event, int damage_event);
+	void RecordFrame(unsigned int frame);
+	void RecordHands(int hands, const Matrix &left, const Matrix &right, const float * controls);
+
+	// replay on display_name, which should be as large as the recorded
+	// screen, the windows already there at the start are created before this
+	// returns so x3d finds them where the recording did
+	bool Open(const char * path, const char * display_name, bool max_speed);
+	// plays the trace up to the next frame, all of it at once with
+	// max_speed, else no further than the time since Open allows. false once
+	// everything is played
+	bool Replay();
+	// the latest tracker input played, 0 when the trace has none yet
+	int Hands(Matrix &left, Matrix &right, float * controls, long long &time_ns);
+	bool replaying() { return _dpy != NULL; }
+	// trace time played up to
+	long long time_ns() { return _time_ns; }
+	int frames() { return _frames; }
+	int records() { return _records; }
+
+	void Close();
+};
+
+#endif//XTRACE_H
@@ -1,20 +1,29 @@
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
 #include <X11/extensions/Xdamage.h>
-#include <GL/gl.h>
+#include <X11/extensions/XTest.h>
 #include <malloc.h>
+#include <limits.h>
 #include <math.h>
 #include <string.h>
 #include <assert.h>
 #include "XWindow.h"
 #include "XDisplay.h"
+#include "RenderBackend.h"
+#include "Clock.h"
+#include "Profile.h"
+#include "Log.h"
+#include "XCalls.h"
 
 
+static ProfileStage s_grab_stage("XGrabServer held");
+
 class GrabServer
 {
 public:
 	Display * _dpy;
-	GrabServer(Display * dpy)
+	ProfileScope _held;
+	GrabServer(Display * dpy) : _held(s_grab_stage)
 	{
 		_dpy = dpy;
 		XGrabServer(dpy);
@@ -22,9 +31,18 @@ public:
 	~GrabServer()
 	{
 		XUngrabServer(_dpy);
+		XCalls::Grabbed(_held.End());
 	}
 };
 
+// the replies XGetWindowAttributes waits for, GetWindowAttributes and GetGeometry
+#define ATTRIBUTES_REPLY_BYTES (44 + 32)
+
+// GetEventWindow's grid, at most this many cells a side and no smaller than
+// the minimum in pixels
+#define INDEX_CELLS 32
+#define INDEX_MIN_CELL 16
+
 int GetTime();
 
 XWindow::XWindow(Display * dpy, Window w, XWindow * next) : _matrix(Matrix::identity)
@@ -37,15 +55,62 @@ XWindow::XWindow(Display * dpy, Window w, XWindow * next) : _matrix(Matrix::iden
 	_nchildren = 0;
 	_children = NULL;
 	_name = NULL;
-	_texture = false;
+	_tiles = NULL;
+	_ntiles = 0;
+	_tiles_x = 0;
+	_hdepth = 0;
+	_textured = false;
 	_mapped = false;
 	_width = 0;
 	_height = 0;
+	memset(&_state, 0, sizeof(_state));
+	_occluded = 0;
+	_hidden = false;
+	_damaged = false;
+	_texture_bytes = 0;
+	_last_visible = 0;
+	_evicted = false;
+	_motion_pending = false;
+	_next_motion = NULL;
+	_sent_x = -1;
+	_sent_y = -1;
+	_sent_state = -1;
+	_injected_ns = 0;
+	_damage_ns = 0;
+	_upload_damage_ns = 0;
+	_uploaded_ns = 0;
+	_drawn_ns = 0;
+	_next_drawn = NULL;
+	_latency = NULL;
+	_entries = NULL;
+	_nentries = 0;
+	_max_entries = 0;
+	_cell_start = NULL;
+	_cell_entries = NULL;
+	_max_cell_entries = 0;
+	_index_x = 0;
+	_index_y = 0;
+	_cells_x = 0;
+	_cells_y = 0;
+	_cell_size = INDEX_MIN_CELL;
+	_index_dirty = true;
 }
 
 XWindow::~XWindow()
 {
+	if (_motion_pending)
+	{
+		XDisplay::CancelMotion(this);
+	}
+	if (_drawn_ns)
+	{
+		XDisplay::CancelDrawn(this);
+	}
+	// what it hangs off may be gone already, there's no index to keep
+	_parent = NULL;
 	Unmap();
+	delete [] _latency;
+	FreeIndex();
 }
 
 void XWindow::Add(XWindow * new_child)
@@ -76,6 +141,9 @@ void XWindow::Add(XWindow * new_child)
 		_nchildren++;
 		_children = new_child;
 	}
+	// new_child's own for a new top level
+	InvalidateIndex();
+	new_child->InvalidateIndex();
 }
 
 void XWindow::Remove(XWindow * rem_child)
@@ -90,6 +158,7 @@ void XWindow::Remove(XWindow * rem_child)
 		// assert _parent == this
 		_children = rem_child->_sibling;
 		rem_child->_parent = NULL;
+		InvalidateIndex();
 		return;
 	}
 	prev = _children;
@@ -105,18 +174,24 @@ void XWindow::Remove(XWindow * rem_child)
 	}
 	prev->_sibling = child->_sibling;
 	child->_parent = NULL;
+	InvalidateIndex();
 }
 
 bool XWindow::Initialize()
 {
 	XWindowAttributes attrib;
+	XCALL(attributes, "XGetWindowAttributes (Initialize)", 2);
 	if (!XGetWindowAttributes(_dpy, _w, &attrib))
 	{
-		printf(" unabled to get window attributes\n");
+		LOG_ERROR(" unabled to get window attributes\n");
 		return false;
 	}
+	attributes.End(ATTRIBUTES_REPLY_BYTES);
+	SetState(attrib);
 
+	XCALL(name, "XFetchName (Initialize)", 1);
 	XFetchName(_dpy, _w, &_name);
+	name.End(32 + (_name? strlen(_name) : 0));
 
 	_x = attrib.x;
 	_y = attrib.y;
@@ -130,7 +205,7 @@ bool XWindow::Initialize()
 	_event_mask = attrib.all_event_masks;
 	// attrib.override_redirect can indicate popup window!
 	
-	printf("0x%08x rect %d %d %d %d (%d) root %08x class %d, gravity bit %d win %d, backing store %d planes %d pixels %d, save under %d, map %d, events %x, do not prop %x, override %d\n",
+	LOG_DEBUG("0x%08x rect %d %d %d %d (%d) root %08x class %d, gravity bit %d win %d, backing store %d planes %d pixels %d, save under %d, map %d, events %x, do not prop %x, override %d\n",
 			(int)_w,
 			attrib.x, attrib.y, attrib.width, attrib.height, attrib.depth,
 			(int)attrib.root, attrib.c_class, attrib.bit_gravity, attrib.win_gravity,
@@ -186,10 +261,12 @@ void XWindow::UpdateHierarchy()
 	Window *children, dummy;
 	unsigned int nchildren;
 
+	XCALL(tree, "XQueryTree (UpdateHierarchy)", 1);
 	if (!XQueryTree(_dpy, _w, &dummy, &dummy, &children, &nchildren))
 	{
 		return;
 	}
+	tree.End(32 + nchildren * 4);
 
 	_hdepth = 0;
 	for (XWindow * parent = _parent; parent; parent = parent->_parent)
@@ -210,35 +287,95 @@ void XWindow::UpdateHierarchy()
 	}
 }
 
-bool XWindow::Update(int x, int y, int width, int height)
+void XWindow::Damaged(long long arrival_ns, unsigned int server_ms)
 {
-	GrabServer grab(_dpy);
+	if (_hdepth != 1)
+	{
+		return;
+	}
+	if (!_latency)
+	{
+		_latency = new ProfileHistogram[LATENCY_STAGES];
+	}
+	// a local Xorg stamps with the same monotonic clock, in ms
+	int deliver_ms = (int)((unsigned int)(arrival_ns / 1000000) - server_ms);
+	if (deliver_ms >= 0 && deliver_ms < 1000)
+	{
+		_latency[LATENCY_DELIVER].Add(deliver_ms * 1000000LL);
+	}
+	if (!_damage_ns)
+	{
+		_damage_ns = arrival_ns;
+	}
+}
+
+void XWindow::SetState(const XWindowAttributes &attrib)
+{
+	_state._x = attrib.x;
+	_state._y = attrib.y;
+	_state._width = attrib.width;
+	_state._height = attrib.height;
+	_state._map_state = attrib.map_state;
+	_state._class = attrib.c_class;
+	_state._depth = attrib.depth;
+	_state._valid = true;
+
+	bool mapped = attrib.map_state == IsViewable;
+	if (mapped != _mapped)
+	{
+		InvalidateIndex();
+	}
+	_mapped = mapped;
+}
 
+bool XWindow::Refresh()
+{
 	XWindowAttributes attrib;
+	XCALL(attributes, "XGetWindowAttributes (Refresh)", 2);
 	if (!XGetWindowAttributes(_dpy, _w, &attrib))
 	{
-		printf(" unabled to get window attributes\n");
+		LOG_ERROR(" unabled to get window attributes\n");
 		return false;
 	}
+	attributes.End(ATTRIBUTES_REPLY_BYTES);
+	SetState(attrib);
+	return true;
+}
 
-	_mapped = attrib.map_state == IsViewable;
-
+bool XWindow::Update(int x, int y, int width, int height)
+{
+	// damage that doesn't make it to a capture, hidden or evicted, isn't traced
+	long long damage_ns = _damage_ns;
+	_damage_ns = 0;
 	if (_hdepth != 1)
 	{
 		return true;
 	}
 
+	PROFILE("capture");
+	GrabServer grab(_dpy);
+	if (!_state._valid && !Refresh())
+	{
+		return false;
+	}
+	// XGetImage would come back with fewer than 3 bytes a pixel, nothing the
+	// tiles take, so it isn't textured at all
+	if (_state._depth < 24)
+	{
+		LOG_WARN("depth %d\n", _state._depth);
+		return true;
+	}
+
 	if (!_textured)
 	{
-		if (attrib.map_state == IsViewable && attrib.c_class == InputOutput)
+		if (_state._map_state == IsViewable && _state._class == InputOutput)
 		{
 			x = 0;
 			y = 0;
-			width = attrib.width;
-			height = attrib.height;
+			width = _state._width;
+			height = _state._height;
 			_width = 0;
 			_height = 0;
-			glGenTextures(1, &_texture);
 			_textured = true;
 		}
 		else
@@ -248,25 +385,29 @@ bool XWindow::Update(int x, int y, int width, int height)
 	}
 	else
 	{
-		if (attrib.map_state != IsViewable)
+		if (_state._map_state != IsViewable)
 		{
 			Unmap();
 			return true;
 		}
+		if (_evicted)
+		{
+			// captured in full by Restore once it is visible again
+			_width = _state._width;
+			_height = _state._height;
+			return true;
+		}
 	}
 
-	glBindTexture(GL_TEXTURE_2D, _texture);
-	if (_width != attrib.width || _height != attrib.height)
+	if (_width != _state._width || _height != _state._height || !_texture_bytes)
 	{
 		x = 0;
 		y = 0;
-		width = attrib.width;
-		height = attrib.height;
-		_width = attrib.width;
-		_height = attrib.height;
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA, _width, _height, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+		width = _state._width;
+		height = _state._height;
+		_width = _state._width;
+		_height = _state._height;
+		AllocateTiles();
 	}
 	else
 	{
@@ -296,51 +437,198 @@ bool XWindow::Update(int x, int y, int width, int height)
 		{
 			height = _height - y;
 		}
-	}
 
+		if (_hidden)
+		{
+			// nobody can see it, remember the area and capture once it shows up again
+			if (!_damaged)
+			{
+				_damage_x = x;
+				_damage_y = y;
+				_damage_x2 = x + width;
+				_damage_y2 = y + height;
+				_damaged = true;
+			}
+			else
+			{
+				if (x < _damage_x) _damage_x = x;
+				if (y < _damage_y) _damage_y = y;
+				if (x + width > _damage_x2) _damage_x2 = x + width;
+				if (y + height > _damage_y2) _damage_y2 = y + height;
+			}
+			return true;
+		}
+	}
+	// a full capture covers everything held back
+	if (x == 0 && y == 0 && width == _width && height == _height)
+	{
+		_damaged = false;
+	}
+	long long start = GetTimeNs();
+	XCALL(get_image, "XGetImage (Update)", 1);
 	XImage *image = XGetImage (_dpy, _w, x, y, width, height, AllPlanes, ZPixmap);
 	if (!image)
 	{
-		printf(" unabled to get the image\n");
+		// most likely resized or unmapped by events still queued
+		LOG_ERROR(" unabled to get the image\n");
+		Invalidate();
 		return false;
 	}
+	get_image.End(32 + image->bytes_per_line * height);
 
     int bytes_per_pixel = image->bits_per_pixel / 8;
-    unsigned char * texture = (unsigned char *)malloc(width * height * bytes_per_pixel);
-    unsigned char * dst = texture;
+    int size = width * height * bytes_per_pixel;
+    XDisplay::AddCaptureBytes(size);
+    RenderBackend * backend = XDisplay::backend();
+    unsigned char * upload = (unsigned char *)backend->MapUpload(size);
+    unsigned char * texture = upload? upload : (unsigned char *)malloc(size);
+    Swizzle(texture, (const unsigned char *)image->data, width, height, image->bytes_per_line, bytes_per_pixel);
+    long long captured = GetTimeNs();
+
+    const void * pixels = upload? backend->UnmapUpload() : texture;
+    if (bytes_per_pixel == 4 || bytes_per_pixel == 3)
+    {
+        UploadTiles(x, y, width, height, (const unsigned char *)pixels, bytes_per_pixel);
+    }
+    else
+    {
+        LOG_WARN("depth %d\n", image->depth);
+    }
+    backend->EndUpload();
+    if (!upload)
+    {
+        free(texture);
+    }
+
+    long long uploaded = GetTimeNs();
+
+    XDestroyImage(image);
+    XDisplay::AddCaptureTime(GetTimeNs() - start);
+
+    if (damage_ns && _latency)
+    {
+        _latency[LATENCY_QUEUE].Add(start - damage_ns);
+        _latency[LATENCY_CAPTURE].Add(captured - start);
+        _latency[LATENCY_UPLOAD].Add(uploaded - captured);
+        if (!_upload_damage_ns)
+        {
+            _upload_damage_ns = damage_ns;
+        }
+        _uploaded_ns = uploaded;
+    }
+
+	return true;
+}
+
+void XWindow::Swizzle(unsigned char * dst, const unsigned char * src, int width, int height, int stride, int bytes_per_pixel)
+{
     for ( int py = 0; py < height; py++)
     {
-        unsigned char * src = ((unsigned char*)image->data) + (image->bytes_per_line * py);
+        const unsigned char * row = src + stride * py;
         for ( int px = 0; px < width; px++)
         {
-            unsigned char t;
-            dst[0] = src[2];
-            dst[1] = src[1];
-            dst[2] = src[0];
+            dst[0] = row[2];
+            dst[1] = row[1];
+            dst[2] = row[0];
             if (bytes_per_pixel > 3)
                 dst[3] = 255;
-            src += bytes_per_pixel;
+            row += bytes_per_pixel;
             dst += bytes_per_pixel;
         }
     }
+}
 
-    if (bytes_per_pixel == 4)
-    {
-        glTexSubImage2D( GL_TEXTURE_2D, 0, x, y, width, height, GL_RGBA, GL_UNSIGNED_BYTE, texture);
-    }
-    else if (bytes_per_pixel == 3)
-    {
-        glTexSubImage2D( GL_TEXTURE_2D, 0, x, y, width, height, GL_RGB, GL_UNSIGNED_BYTE, texture);
-    }
-    else
-    {
-        printf("depth %d\n", image->depth);
-    }
-	free(texture);
+void XWindow::Synthesize(int x, int y, int width, int height, int event_mask, int hdepth)
+{
+	_x = x;
+	_y = y;
+	_width = width;
+	_height = height;
+	_event_mask = event_mask;
+	_hdepth = hdepth;
+	_mapped = true;
+	_state._x = x;
+	_state._y = y;
+	_state._width = width;
+	_state._height = height;
+	_state._map_state = IsViewable;
+	_state._class = InputOutput;
+	_state._depth = 24;
+	_state._valid = true;
+	_textured = false;
+	_matrix = *(Matrix*)Matrix::identity;
+	_matrix.translation()._x += x;
+	_matrix.translation()._y -= y;
+}
 
-    XDestroyImage(image);
+void XWindow::Mapped()
+{
+	// the root always is viewable, anything else once its parent is
+	bool viewable = !_parent || _parent->_state._map_state == IsViewable;
+	_state._map_state = viewable? IsViewable : IsUnviewable;
+	if (viewable != _mapped)
+	{
+		InvalidateIndex();
+	}
+	_mapped = viewable;
+	Viewable(viewable);
+}
 
-	return true;
+void XWindow::Unmapped()
+{
+	_state._map_state = IsUnmapped;
+	Unmap();
+	Viewable(false);
+}
+
+// what is mapped below a window is seen or not with it, without events of its own
+void XWindow::Viewable(bool viewable)
+{
+	for (XWindow * child = _children; child; child = child->_sibling)
+	{
+		if (child->_state._map_state == IsUnmapped)
+		{
+			continue;
+		}
+		child->_state._map_state = viewable? IsViewable : IsUnviewable;
+		if (child->_mapped != viewable)
+		{
+			child->InvalidateIndex();
+		}
+		child->_mapped = viewable;
+		child->Viewable(viewable);
+	}
+}
+
+void XWindow::Configure(int x, int y, int width, int height)
+{
+	_state._x = x;
+	_state._y = y;
+	_state._width = width;
+	_state._height = height;
+	if (!_parent || !_parent->_parent)
+	{
+		return;
+	}
+	if (x == _x && y == _y && width == _width && height == _height)
+	{
+		return;
+	}
+	_x = x;
+	_y = y;
+	_width = width;
+	_height = height;
+	InvalidateIndex();
+}
+
+bool XWindow::UpdateDamage()
+{
+	if (!_damaged)
+	{
+		return true;
+	}
+	_damaged = false;
+	return Update(_damage_x, _damage_y, _damage_x2 - _damage_x, _damage_y2 - _damage_y);
 }
 
 void XWindow::Unmap()
@@ -351,13 +639,302 @@ void XWindow::Unmap()
 	}
 	if (_textured)
 	{
-		glDeleteTextures(1, &_texture);
+		if (_evicted)
+		{
+			XDisplay::AddEvictedBytes(-_texture_bytes);
+		}
+		else
+		{
+			FreeTiles();
+			XDisplay::AddResidentBytes(-_texture_bytes);
+		}
 		_textured = false;
 	}
+	_texture_bytes = 0;
+	_evicted = false;
 	_mapped = false;
+	InvalidateIndex();
+	_damaged = false;
+	_damage_ns = 0;
+	_upload_damage_ns = 0;
+}
+
+// Drops the texture but keeps the window textured for culling and picking,
+// whatever it shows is captured again from scratch by Restore.
+void XWindow::Evict()
+{
+	if (!_textured || _evicted)
+	{
+		return;
+	}
+	FreeTiles();
+	XDisplay::AddResidentBytes(-_texture_bytes);
+	XDisplay::AddEvictedBytes(_texture_bytes);
+	_evicted = true;
+	_damaged = false;
+}
+
+bool XWindow::Restore()
+{
+	if (!_evicted)
+	{
+		return true;
+	}
+	XDisplay::AddEvictedBytes(-_texture_bytes);
+	_texture_bytes = 0;
+	_evicted = false;
+	return Update(0, 0, 0, 0);
+}
+
+// One texture per tile, sized for the current _width and _height.
+void XWindow::AllocateTiles()
+{
+	FreeTiles();
+
+	RenderBackend * backend = XDisplay::backend();
+	int size = XDisplay::tile_size();
+	_tiles_x = (_width + size - 1) / size;
+	int tiles_y = (_height + size - 1) / size;
+	_ntiles = _tiles_x * tiles_y;
+	_tiles = (Tile*)malloc(sizeof(Tile) * _ntiles);
+	int bytes = 0;
+
+	for (int ty = 0; ty < tiles_y; ty++)
+	{
+		for (int tx = 0; tx < _tiles_x; tx++)
+		{
+			Tile &tile = _tiles[ty * _tiles_x + tx];
+			tile._x = tx * size;
+			tile._y = ty * size;
+			tile._width = _width - tile._x < size? _width - tile._x : size;
+			tile._height = _height - tile._y < size? _height - tile._y : size;
+			tile._occluded = 0;
+			tile._image = backend->CreateImage(tile._width, tile._height);
+			bytes += backend->ImageBytes(tile._width, tile._height);
+		}
+	}
+
+	XDisplay::AddResidentBytes(bytes - _texture_bytes);
+	_texture_bytes = bytes;
+}
+
+void XWindow::FreeTiles()
+{
+	RenderBackend * backend = XDisplay::backend();
+	for (int i = 0; i < _ntiles; i++)
+	{
+		backend->DestroyImage(_tiles[i]._image);
+	}
+	free(_tiles);
+	_tiles = NULL;
+	_ntiles = 0;
+	_tiles_x = 0;
+}
+
+// Routes a captured rectangle to the tiles it overlaps, pixels holds width x
+// height tightly packed and may be whatever the backend's UnmapUpload gave.
+void XWindow::UploadTiles(int x, int y, int width, int height, const unsigned char * pixels, int bytes_per_pixel)
+{
+	RenderBackend * backend = XDisplay::backend();
+	int size = XDisplay::tile_size();
+	int x2 = x + width;
+	int y2 = y + height;
+
+	for (int ty = y / size; ty * size < y2; ty++)
+	{
+		for (int tx = x / size; tx * size < x2; tx++)
+		{
+			Tile &tile = _tiles[ty * _tiles_x + tx];
+			int ux = x > tile._x? x : tile._x;
+			int uy = y > tile._y? y : tile._y;
+			int ux2 = x2 < tile._x + tile._width? x2 : tile._x + tile._width;
+			int uy2 = y2 < tile._y + tile._height? y2 : tile._y + tile._height;
+
+			const unsigned char * src = pixels + ((uy - y) * width + (ux - x)) * bytes_per_pixel;
+			backend->UploadImage(tile._image, ux - tile._x, uy - tile._y, ux2 - ux, uy2 - uy,
+					src, width, bytes_per_pixel);
+		}
+	}
+}
+
+void XWindow::InvalidateIndex()
+{
+	XWindow * top = this;
+	while (top->_parent && top->_parent->_parent)
+	{
+		top = top->_parent;
+	}
+	// nothing for the root
+	if (top->_parent)
+	{
+		top->_index_dirty = true;
+	}
+}
+
+void XWindow::FreeIndex()
+{
+	free(_entries);
+	free(_cell_start);
+	free(_cell_entries);
+	_entries = NULL;
+	_nentries = 0;
+	_max_entries = 0;
+	_cell_start = NULL;
+	_cell_entries = NULL;
+	_max_cell_entries = 0;
+	_cells_x = 0;
+	_cells_y = 0;
+}
+
+// preorder with siblings bottom to top, so a window comes after everything
+// that is below it and the last entry under a point is the one the
+// recursive walk would end up at
+void XWindow::IndexChildren(XWindow * top, int ox, int oy, int x, int y, int x2, int y2)
+{
+	for (XWindow * w = _children; w; w = w->_sibling)
+	{
+		if (!w->_mapped)
+		{
+			continue;
+		}
+		int wox = ox + w->_x;
+		int woy = oy + w->_y;
+		int wx = wox > x? wox : x;
+		int wy = woy > y? woy : y;
+		int wx2 = wox + w->_width < x2? wox + w->_width : x2;
+		int wy2 = woy + w->_height < y2? woy + w->_height : y2;
+		if (wx >= wx2 || wy >= wy2)
+		{
+			continue;
+		}
+
+		if (top->_nentries == top->_max_entries)
+		{
+			top->_max_entries = top->_max_entries? top->_max_entries * 2 : 64;
+			top->_entries = (IndexEntry *)realloc(top->_entries, top->_max_entries * sizeof(IndexEntry));
+		}
+		IndexEntry &entry = top->_entries[top->_nentries++];
+		entry._w = w;
+		entry._x = wx;
+		entry._y = wy;
+		entry._x2 = wx2;
+		entry._y2 = wy2;
+		entry._ox = wox;
+		entry._oy = woy;
+
+		w->IndexChildren(top, wox, woy, wx, wy, wx2, wy2);
+	}
+}
+
+void XWindow::BuildIndex()
+{
+	PROFILE("event window index");
+	_index_dirty = false;
+	_nentries = 0;
+	_cells_x = 0;
+	_cells_y = 0;
+	// a top level doesn't clip its children for GetEventWindow either
+	IndexChildren(this, 0, 0, INT_MIN / 2, INT_MIN / 2, INT_MAX / 2, INT_MAX / 2);
+	if (!_nentries)
+	{
+		return;
+	}
+
+	int x = INT_MAX, y = INT_MAX, x2 = INT_MIN, y2 = INT_MIN;
+	for (int i = 0; i < _nentries; i++)
+	{
+		IndexEntry &entry = _entries[i];
+		x = entry._x < x? entry._x : x;
+		y = entry._y < y? entry._y : y;
+		x2 = entry._x2 > x2? entry._x2 : x2;
+		y2 = entry._y2 > y2? entry._y2 : y2;
+	}
+	int size = (x2 - x > y2 - y? x2 - x : y2 - y) + INDEX_CELLS - 1;
+	_cell_size = size / INDEX_CELLS > INDEX_MIN_CELL? size / INDEX_CELLS : INDEX_MIN_CELL;
+	_index_x = x;
+	_index_y = y;
+	_cells_x = (x2 - x + _cell_size - 1) / _cell_size;
+	_cells_y = (y2 - y + _cell_size - 1) / _cell_size;
+
+	// count, then fill, each cell's list in entry order
+	int ncells = _cells_x * _cells_y;
+	_cell_start = (int *)realloc(_cell_start, (ncells + 1) * sizeof(int));
+	memset(_cell_start, 0, (ncells + 1) * sizeof(int));
+	for (int i = 0; i < _nentries; i++)
+	{
+		IndexEntry &entry = _entries[i];
+		int cx = (entry._x - x) / _cell_size, cx2 = (entry._x2 - 1 - x) / _cell_size;
+		int cy = (entry._y - y) / _cell_size, cy2 = (entry._y2 - 1 - y) / _cell_size;
+		for (int cell_y = cy; cell_y <= cy2; cell_y++)
+		{
+			for (int cell_x = cx; cell_x <= cx2; cell_x++)
+			{
+				_cell_start[cell_y * _cells_x + cell_x + 1]++;
+			}
+		}
+	}
+	for (int i = 0; i < ncells; i++)
+	{
+		_cell_start[i + 1] += _cell_start[i];
+	}
+	if (_cell_start[ncells] > _max_cell_entries)
+	{
+		_max_cell_entries = _cell_start[ncells];
+		_cell_entries = (int *)realloc(_cell_entries, _max_cell_entries * sizeof(int));
+	}
+	for (int i = 0; i < _nentries; i++)
+	{
+		IndexEntry &entry = _entries[i];
+		int cx = (entry._x - x) / _cell_size, cx2 = (entry._x2 - 1 - x) / _cell_size;
+		int cy = (entry._y - y) / _cell_size, cy2 = (entry._y2 - 1 - y) / _cell_size;
+		for (int cell_y = cy; cell_y <= cy2; cell_y++)
+		{
+			for (int cell_x = cx; cell_x <= cx2; cell_x++)
+			{
+				// the starts move up as they fill, back down below
+				_cell_entries[_cell_start[cell_y * _cells_x + cell_x]++] = i;
+			}
+		}
+	}
+	for (int i = ncells; i > 0; i--)
+	{
+		_cell_start[i] = _cell_start[i - 1];
+	}
+	_cell_start[0] = 0;
 }
 
 XWindow * XWindow::GetEventWindow(int event_mask, int &x, int &y)
+{
+	// only top levels keep an index
+	if (!_parent || _parent->_parent)
+	{
+		return FindEventWindow(event_mask, x, y);
+	}
+	if (_index_dirty)
+	{
+		BuildIndex();
+	}
+	int cx = x - _index_x;
+	int cy = y - _index_y;
+	if (cx < 0 || cy < 0 || cx >= _cells_x * _cell_size || cy >= _cells_y * _cell_size)
+	{
+		return this;
+	}
+	int cell = (cy / _cell_size) * _cells_x + cx / _cell_size;
+	for (int i = _cell_start[cell + 1] - 1; i >= _cell_start[cell]; i--)
+	{
+		IndexEntry &entry = _entries[_cell_entries[i]];
+		if (x >= entry._x && y >= entry._y && x < entry._x2 && y < entry._y2)
+		{
+			x -= entry._ox;
+			y -= entry._oy;
+			return entry._w;
+		}
+	}
+	return this;
+}
+
+XWindow * XWindow::FindEventWindow(int event_mask, int &x, int &y)
 {
 	XWindow * child = NULL;
 	int cx, cy;
@@ -386,54 +963,46 @@ XWindow * XWindow::GetEventWindow(int event_mask, int &x, int &y)
 	{
 		x = cx;
 		y = cy;
-		return child->GetEventWindow(event_mask, x, y);
+		return child->FindEventWindow(event_mask, x, y);
 	}
 	return this;
 }
 
-void XWindow::Draw()
+void XWindow::Draw(int eye, const Matrix &parent)
 {
-	float w = _width;
-	float h = _height;
-	float vertices[] =
-	{
-		0.f, 0.f, 0.f, 0.f,
-		w, 0.f, 1.f, 0.f,
-		w, -h, 1.f, 1.f,
-		0.f, -h, 0.f, 1.f
-	};
-
-	glPushMatrix();
-	glMultMatrixf(_matrix._m);
+	Matrix model = parent * _matrix;
 
-	if (_textured)
+	if (_textured && !(_occluded & (1 << eye)))
 	{
-		glColor4f(1.0, 1.0, 1.0, 1.0);
-		glBindTexture(GL_TEXTURE_2D, _texture);
-
-		glDisable(GL_BLEND);
-		glBlendFunc( GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-		glEnable(GL_TEXTURE_2D);
-		glClientActiveTexture(GL_TEXTURE0);
-		glActiveTexture(GL_TEXTURE0);
-		glEnableClientState(GL_TEXTURE_COORD_ARRAY);
-		glEnableClientState(GL_VERTEX_ARRAY);
-
-		glVertexPointer(2, GL_FLOAT, 4*4, vertices );
-		glTexCoordPointer(2, GL_FLOAT, 4*4, vertices + 2 );
-
-		glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+		if (_upload_damage_ns && !_drawn_ns)
+		{
+			_drawn_ns = GetTimeNs();
+			XDisplay::Drawn(this);
+		}
+		RenderBackend * backend = XDisplay::backend();
+		for (int i = 0; i < _ntiles; i++)
+		{
+			Tile &tile = _tiles[i];
+			if (tile._occluded & (1 << eye))
+			{
+				continue;
+			}
+			float rect[] =
+			{
+				(float)tile._x, (float)-tile._y,
+				(float)(tile._x + tile._width), (float)(-tile._y - tile._height)
+			};
+			backend->DrawImage(tile._image, model, rect);
+		}
 	}
 
 	if (_hdepth == 0)
 	{
 		for (XWindow * child = _children; child; child = child->_sibling)
 		{
-			child->Draw();
+			child->Draw(eye, model);
 		}
 	}
-
-	glPopMatrix();
 }
 
 bool XWindow::IsParent(XWindow * w)
@@ -448,15 +1017,73 @@ bool XWindow::IsParent(XWindow * w)
 	return false;
 }
 
-void XWindow::SendMotionEvent(Window root, int x, int y, int state)
+void XWindow::RootPosition(int x, int y, int &x_root, int &y_root)
 {
-	int x_root = x + _x;
-	int y_root = y + _y;
+	x_root = x + _x;
+	y_root = y + _y;
 	for (XWindow * parent = _parent; parent; parent = parent->_parent)
 	{
 		x_root += parent->_x;
 		y_root += parent->_y;
 	}
+}
+
+void XWindow::SendMotionEvent(Window root, int x, int y, int state)
+{
+	if (!_motion_pending)
+	{
+		// nothing the client doesn't know already
+		bool known;
+		if (XDisplay::injection() == XDisplay::INJECT_XTEST)
+		{
+			int x_root, y_root;
+			RootPosition(x, y, x_root, y_root);
+			known = XDisplay::PointerAt(x_root, y_root);
+		}
+		else
+		{
+			known = x == _sent_x && y == _sent_y && state == _sent_state;
+		}
+		if (known)
+		{
+			XDisplay::EventCoalesced();
+			return;
+		}
+	}
+	else
+	{
+		// the newer position replaces the one not sent yet
+		XDisplay::EventCoalesced();
+	}
+	_motion_root = root;
+	_motion_x = x;
+	_motion_y = y;
+	_motion_state = state;
+	XDisplay::QueueMotion(this);
+}
+
+void XWindow::SendPendingMotion()
+{
+	if (!_motion_pending)
+	{
+		return;
+	}
+	// clears _motion_pending
+	XDisplay::CancelMotion(this);
+
+	Window root = _motion_root;
+	int x = _motion_x;
+	int y = _motion_y;
+	int state = _motion_state;
+	int x_root, y_root;
+	RootPosition(x, y, x_root, y_root);
+	XDisplay::Injected(this);
+	if (XDisplay::injection() == XDisplay::INJECT_XTEST)
+	{
+		XDisplay::WarpPointer(_dpy, x_root, y_root);
+		return;
+	}
+
 	XEvent event;
 	event.xmotion.type = MotionNotify;
 	event.xmotion.display = _dpy;
@@ -472,18 +1099,25 @@ void XWindow::SendMotionEvent(Window root, int x, int y, int state)
 	event.xmotion.is_hint = 0;
 	event.xmotion.same_screen = True;
 	XSendEvent(_dpy, _w, True, PointerMotionMask, &event);
-	XFlush(_dpy);
+	XDisplay::EventSent(_dpy);
+	_sent_x = x;
+	_sent_y = y;
+	_sent_state = state;
 }
 
 void XWindow::SendCrossingEvent(Window root, int x, int y, int state, int detail, Window child, bool enter)
 {
-	int x_root = x + _x;
-	int y_root = y + _y;
-	for (XWindow * parent = _parent; parent; parent = parent->_parent)
+	// the server works the crossings out itself from the real pointer
+	if (XDisplay::injection() == XDisplay::INJECT_XTEST)
 	{
-		x_root += parent->_x;
-		y_root += parent->_y;
+		return;
 	}
+
+	// whatever moved before has to arrive first
+	SendPendingMotion();
+
+	int x_root, y_root;
+	RootPosition(x, y, x_root, y_root);
 	XEvent event;
 	event.xcrossing.type = enter? EnterNotify : LeaveNotify;
 	event.xcrossing.display = _dpy;
@@ -501,17 +1135,30 @@ void XWindow::SendCrossingEvent(Window root, int x, int y, int state, int detail
 	event.xcrossing.focus = True;//enter? True : False;
 	event.xcrossing.state = state;
 	XSendEvent(_dpy, _w, True, enter? EnterWindowMask : LeaveWindowMask, &event);
-	XFlush(_dpy);
+	XDisplay::EventSent(_dpy);
+	// an enter tells where the pointer is, after a leave any motion is news
+	_sent_x = enter? x : -1;
+	_sent_y = enter? y : -1;
+	_sent_state = state;
 }
 
 void XWindow::SendButtonEvent(Window root, int x, int y, int button, int state, bool press)
 {
-	int x_root = x + _x;
-	int y_root = y + _y;
-	for (XWindow * parent = _parent; parent; parent = parent->_parent)
+	SendPendingMotion();
+
+	int x_root, y_root;
+	RootPosition(x, y, x_root, y_root);
+	XDisplay::Injected(this);
+	if (XDisplay::injection() == XDisplay::INJECT_XTEST)
 	{
-		x_root += parent->_x;
-		y_root += parent->_y;
+		// the press lands wherever the real pointer is
+		if (!XDisplay::PointerAt(x_root, y_root))
+		{
+			XDisplay::WarpPointer(_dpy, x_root, y_root);
+		}
+		XTestFakeButtonEvent(_dpy, button, press, CurrentTime);
+		XDisplay::EventSent(_dpy);
+		return;
 	}
 
 	XEvent event;
@@ -532,11 +1179,26 @@ void XWindow::SendButtonEvent(Window root, int x, int y, int button, int state,
 	event.xbutton.same_screen = True;
 
 	XSendEvent(_dpy, _w, True, press? ButtonPressMask : ButtonReleaseMask, &event);
-	XFlush(_dpy);
+	XDisplay::EventSent(_dpy);
+	// the button changes the state the next motion carries
+	_sent_x = x;
+	_sent_y = y;
+	_sent_state = -1;
 }
 
 void XWindow::SendKeyEvent(Window root, int key, int state, bool press)
 {
+	SendPendingMotion();
+
+	XDisplay::Injected(this);
+	if (XDisplay::injection() == XDisplay::INJECT_XTEST)
+	{
+		// goes to the focus, which is this window once it was clicked
+		XTestFakeKeyEvent(_dpy, key, press, CurrentTime);
+		XDisplay::EventSent(_dpy);
+		return;
+	}
+
 	XKeyEvent event;
 	event.type = press? KeyPress : KeyRelease;
 	event.display = _dpy;
@@ -552,6 +1214,6 @@ void XWindow::SendKeyEvent(Window root, int key, int state, bool press)
 	event.keycode = key;
 	event.state = state;
 	XSendEvent(_dpy, _w, True, press? KeyPressMask : KeyReleaseMask, (XEvent*)&event);
-	XFlush(_dpy);
+	XDisplay::EventSent(_dpy);
 }
 
@@ -5,12 +5,25 @@
 #include "Matrix.h"
 
 class XDisplay;
+class ProfileHistogram;
 
 class XWindow
 {
 protected:
 	friend class XDisplay;
 
+	// the contents as a grid of textures no larger than XDisplay::tile_size
+	struct Tile
+	{
+		unsigned int _image;
+		int _x;
+		int _y;
+		int _width;
+		int _height;
+		// culled per eye, like _occluded for the whole window
+		int _occluded;
+	};
+
 	Display * _dpy;
 	Window _w;
 	XWindow * _next;
@@ -19,7 +32,9 @@ protected:
 	int _nchildren;
 	XWindow * _children;
 	char * _name;
-	GLuint _texture;
+	Tile * _tiles;
+	int _ntiles;
+	int _tiles_x;
 	int _x;
 	int _y;
 	int _width;
@@ -31,11 +46,118 @@ protected:
 	bool _textured;
 	bool _mapped;
 
+	// what the server last said, from Initialize and then MapNotify,
+	// UnmapNotify and ConfigureNotify, only asked again after Invalidate
+	struct State
+	{
+		int _x;
+		int _y;
+		int _width;
+		int _height;
+		int _map_state;
+		int _class;
+		int _depth;
+		bool _valid;
+	};
+	State _state;
+
+	// occlusion, one bit per eye, and damage held back while hidden
+	int _occluded;
+	bool _hidden;
+	bool _damaged;
+	int _damage_x;
+	int _damage_y;
+	int _damage_x2;
+	int _damage_y2;
+
+	// texture residency, see XDisplay::SetTextureBudget
+	int _texture_bytes;
+	unsigned int _last_visible;
+	bool _evicted;
+
+	// synthetic motion held until XDisplay::FlushEvents, one per frame at
+	// most, and the pointer state the window was last told about
+	bool _motion_pending;
+	XWindow * _next_motion;
+	Window _motion_root;
+	int _motion_x;
+	int _motion_y;
+	int _motion_state;
+	int _sent_x;
+	int _sent_y;
+	int _sent_state;
+	// on top levels, the oldest injection the client hasn't redrawn for yet
+	long long _injected_ns;
+
+	// damage to eye buffer latency on top levels, the oldest damage not
+	// captured yet, then the oldest uploaded but not drawn yet
+	long long _damage_ns;
+	long long _upload_damage_ns;
+	long long _uploaded_ns;
+	long long _drawn_ns;
+	XWindow * _next_drawn;
+	ProfileHistogram * _latency;
+
 	Matrix _matrix;
 
+	// on top levels, a uniform grid over every mapped descendant for
+	// GetEventWindow, rebuilt on the first lookup after anything in the
+	// tree below changed
+	struct IndexEntry
+	{
+		XWindow * _w;
+		// clipped to all its ancestors, relative to the top level
+		int _x;
+		int _y;
+		int _x2;
+		int _y2;
+		// the window's own origin, relative to the top level
+		int _ox;
+		int _oy;
+	};
+	IndexEntry * _entries;
+	int _nentries;
+	int _max_entries;
+	// per cell, the entries overlapping it in stacking order
+	int * _cell_start;
+	int * _cell_entries;
+	int _max_cell_entries;
+	int _index_x;
+	int _index_y;
+	int _cells_x;
+	int _cells_y;
+	int _cell_size;
+	bool _index_dirty;
+
 	bool Initialize();
+	void SetState(const XWindowAttributes &attrib);
+	bool Refresh();
+	void Viewable(bool viewable);
+	void AllocateTiles();
+	void FreeTiles();
+	void UploadTiles(int x, int y, int width, int height, const unsigned char * pixels, int bytes_per_pixel);
+	void SendPendingMotion();
+	void InvalidateIndex();
+	void IndexChildren(XWindow * top, int ox, int oy, int x, int y, int x2, int y2);
+	void BuildIndex();
+	void FreeIndex();
+	XWindow * FindEventWindow(int event_mask, int &x, int &y);
+	void RootPosition(int x, int y, int &x_root, int &y_root);
 
 public:
+	// the stages of XDisplay::ReportLatency
+	enum LatencyStage
+	{
+		LATENCY_DELIVER,	// the server's timestamp to the event read, when both clocks agree
+		LATENCY_QUEUE,		// event read to capture
+		LATENCY_CAPTURE,	// XGetImage and swizzle
+		LATENCY_UPLOAD,		// handing the pixels to the backend
+		LATENCY_DRAW,		// upload to the first draw sampling it
+		LATENCY_SUBMIT,		// that draw to the frame going out
+		LATENCY_TOTAL,		// event read to the frame going out
+		LATENCY_STAGES,
+	};
+
 	XWindow(Display * dpy, Window w, XWindow * next = NULL);
 	~XWindow();
 
@@ -44,18 +166,43 @@ public:
 
 	void UpdateHierarchy();
 
+	// an XDamageNotify read at arrival_ns, traced through the next Update
+	void Damaged(long long arrival_ns, unsigned int server_ms);
+	// captures top levels, anything else is turned away without a request
 	bool Update(int x, int y, int width, int height);
+	// MapNotify, UnmapNotify and ConfigureNotify, to keep the state Update
+	// goes by. Below a top level the geometry is also where GetEventWindow
+	// finds it, top levels are placed by x3d and their textures sized by Update
+	void Mapped();
+	void Unmapped();
+	void Configure(int x, int y, int width, int height);
+	// the next Update asks the server
+	void Invalidate() { _state._valid = false; }
+	bool UpdateDamage();
 	void Unmap();
+	void Evict();
+	bool Restore();
 
-	void Draw();
+	// through XDisplay::backend, parent is the model matrix of the parent
+	void Draw(int eye = 0, const Matrix &parent = Matrix(Matrix::identity));
 
+	// the deepest, topmost mapped descendant under x, y, which are relative to
+	// this window on the way in and to the one returned on the way out
 	XWindow * GetEventWindow(int event_mask, int &x, int &y);
 
+	// BGRX as XGetImage returns it to the RGBA the textures take, alpha opaque
+	static void Swizzle(unsigned char * dst, const unsigned char * src, int width, int height, int stride, int bytes_per_pixel);
+	// the state Initialize and UpdateHierarchy would find for a mapped,
+	// not yet captured window, without asking a server, for bench/
+	void Synthesize(int x, int y, int width, int height, int event_mask, int hdepth);
+
 	Window w() { return _w; }
 	int width() { return _width; }
 	int height() { return _height; }
 	Matrix & matrix() { return _matrix; }
 	bool mapped() { return _mapped; }
+	bool hidden() { return _hidden; }
+	bool evicted() { return _evicted; }
 	int event_mask() { return _event_mask; }
 	int x() { return _x; }
 	int y() { return _y; }
@@ -67,6 +214,7 @@ public:
 
 	bool IsParent(XWindow * w);
 
+	// none of these flush, XDisplay::FlushEvents does once per frame
 	void SendMotionEvent(Window root, int x, int y, int state);
 	void SendCrossingEvent(Window root, int x, int y, int state, int detail, Window child, bool enter);
 	void SendButtonEvent(Window root, int x, int y, int button, int state, bool press);